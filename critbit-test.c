@@ -6,11 +6,13 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <assert.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "critbit.h"
 
@@ -79,70 +81,2201 @@ el_alloc(void)
 	return malloc(sizeof(struct element));
 }
 
+static __inline uint32_t
+hashint(uintptr_t h)
+{
+	h = (~h) + (h << 18);
+	h = h ^ (h >> 31);
+	h = h * 21;
+	h = h ^ (h >> 11);
+	h = h + (h << 6);
+	h = h ^ (h >> 22);
+	return (h);
+}
+
+static void
+test_contains(void)
+{
+	CRITBIT_HEAD(eltree) tree;
+	struct element *el;
+	struct critbit_node *nnode;
+	int i;
+
+	CRITBIT_INIT(eltree, &tree, std_free, NULL);
+
+	for (i = 0; elems[i]; ++i) {
+		el = el_alloc();
+		el->k = elems[i];
+		nnode = malloc(critbit_node_size());
+		CRITBIT_INSERT(eltree, &tree, nnode, el);
+	}
+
+	for (i = 0; elems[i]; ++i) {
+		el = CRITBIT_GET(eltree, &tree, elems[i]);
+		if (el == NULL)
+			abort();
+	}
+}
+
+static void
+test_delete(void)
+{
+	CRITBIT_HEAD(eltree) tree;
+	struct element *el;
+	struct critbit_node *nnode;
+	int i, j;
+
+	CRITBIT_INIT(eltree, &tree, std_free, NULL);
+
+	for (i = 1; elems[i]; ++i) {
+
+		for (j = 0; j < i; ++j) {
+			el = el_alloc();
+			el->k = elems[j];
+			nnode = malloc(critbit_node_size());
+			el = CRITBIT_INSERT(eltree, &tree, nnode, el);
+			if (el != NULL)
+				abort();
+		}
+		for (j = 0; j < i; ++j) {
+			if (CRITBIT_GET(eltree, &tree, elems[j]) == NULL)
+				abort();
+		}
+		for (j = 0; j < i; ++j) {
+			el = CRITBIT_REMOVE(eltree, &tree, elems[j]);
+			if (el == NULL)
+				abort();
+			free(el);
+		}
+		for (j = 0; j < i; ++j) {
+			if (CRITBIT_GET(eltree, &tree, elems[j]) != NULL)
+				abort();
+		}
+	}
+}
+
+static void
+test_iterate(void)
+{
+	CRITBIT_HEAD(eltree) tree;
+	CRITBIT_HEAD(elinttree) inttree;
+	struct critbit_cursor cursor;
+	struct element *el, *prev, *xel;
+	char *deep;
+	int i, n;
+
+	CRITBIT_INIT(eltree, &tree, std_free, NULL);
+
+	el = CRITBIT_FIRST(eltree, &tree, &cursor);
+	if (el != NULL || CRITBIT_NEXT(eltree, &cursor) != NULL)
+		abort();
+
+	for (n = 0; elems[n]; ++n) {
+		el = el_alloc();
+		el->k = elems[n];
+		CRITBIT_INSERT(eltree, &tree, malloc(critbit_node_size()), el);
+	}
+
+	i = 0;
+	prev = NULL;
+	CRITBIT_FOREACH(el, eltree, &tree, &cursor) {
+		if (prev != NULL && strcmp(prev->k, el->k) >= 0)
+			abort();
+		prev = el;
+		i++;
+	}
+	if (i != n)
+		abort();
+
+	i = 0;
+	prev = NULL;
+	CRITBIT_FOREACH_REVERSE(el, eltree, &tree, &cursor) {
+		if (prev != NULL && strcmp(prev->k, el->k) <= 0)
+			abort();
+		prev = el;
+		i++;
+	}
+	if (i != n)
+		abort();
+
+	/* path longer than cursor can hold */
+	n = CRITBIT_CURSOR_DEPTH * 3;
+	deep = malloc(n + 1);
+	memset(deep, 'a', n);
+	deep[n] = '\0';
+	CRITBIT_INIT(eltree, &tree, std_free, NULL);
+	for (i = 0; i < n; ++i) {
+		el = el_alloc();
+		el->k = deep + i;
+		CRITBIT_INSERT(eltree, &tree, malloc(critbit_node_size()), el);
+	}
+	i = 0;
+	CRITBIT_FOREACH(el, eltree, &tree, &cursor) {
+		if (strlen(el->k) != (size_t)i + 1)
+			abort();
+		i++;
+	}
+	if (i != n)
+		abort();
+	CRITBIT_FOREACH_REVERSE(el, eltree, &tree, &cursor) {
+		if (strlen(el->k) != (size_t)i)
+			abort();
+		i--;
+	}
+	if (i != 0)
+		abort();
+
+	/* integer keys are visited in numeric order */
+	n = 1000;
+	xel = malloc(sizeof(*xel) * n);
+	CRITBIT_INIT(elinttree, &inttree, std_free, NULL);
+	for (i = 0; i < n; ++i) {
+		xel[i].kint = (int64_t)((i * 7919) % n - n / 2) * 1048573;
+		CRITBIT_INSERT(elinttree, &inttree,
+		    malloc(critbit_node_size()), &xel[i]);
+	}
+	i = 0;
+	prev = NULL;
+	CRITBIT_FOREACH(el, elinttree, &inttree, &cursor) {
+		if (prev != NULL && prev->kint >= el->kint)
+			abort();
+		prev = el;
+		i++;
+	}
+	if (i != n)
+		abort();
+}
+
+static void
+test_seek(void)
+{
+	CRITBIT_HEAD(eltree) tree;
+	CRITBIT_HEAD(elinttree) inttree;
+	struct critbit_cursor cursor;
+	struct element *el, *xel;
+	int64_t q;
+	int i, n;
+
+	static const char *keys[] = {
+		"b", "bb", "bba", "bbc", "d", NULL
+	};
+
+	n = 201;
+	xel = malloc(sizeof(*xel) * n);
+	CRITBIT_INIT(elinttree, &inttree, std_free, NULL);
+	if (CRITBIT_SEEK(elinttree, &inttree, NULL, 0, CRITBIT_SEEK_GE) != NULL)
+		abort();
+	for (i = 0; i < n; ++i) {
+		/* multiples of 3 in [-300, 300] */
+		xel[i].kint = ((i * 7) % n - n / 2) * 3;
+		CRITBIT_INSERT(elinttree, &inttree,
+		    malloc(critbit_node_size()), &xel[i]);
+	}
+
+	for (q = -310; q <= 310; ++q) {
+		int64_t ge = q <= -300 ? -300 : (q + 302) / 3 * 3 - 300;
+		int64_t le = q >= 300 ? 300 : (q + 300) / 3 * 3 - 300;
+
+		if (q < -300)
+			le = INT64_MIN;
+		if (q > 300)
+			ge = INT64_MAX;
+
+		el = elinttree_critbit_lower_bound(&inttree, q);
+		if (el == NULL ? ge != INT64_MAX : el->kint != ge)
+			abort();
+		el = elinttree_critbit_successor(&inttree, q);
+		if (ge == q)
+			ge += 3;
+		if (ge > 300)
+			ge = INT64_MAX;
+		if (el == NULL ? ge != INT64_MAX : el->kint != ge)
+			abort();
+		el = CRITBIT_SEEK(elinttree, &inttree, NULL, q,
+		    CRITBIT_SEEK_LE);
+		if (el == NULL ? le != INT64_MIN : el->kint != le)
+			abort();
+		el = elinttree_critbit_predecessor(&inttree, q);
+		if (le == q)
+			le -= 3;
+		if (le < -300)
+			le = INT64_MIN;
+		if (el == NULL ? le != INT64_MIN : el->kint != le)
+			abort();
+	}
+
+	/* cursor continues from the position found */
+	el = CRITBIT_SEEK(elinttree, &inttree, &cursor, 100, CRITBIT_SEEK_GE);
+	for (i = 0; el != NULL; ++i)
+		el = CRITBIT_NEXT(elinttree, &cursor);
+	if (i != 67)
+		abort();
+
+	CRITBIT_INIT(eltree, &tree, std_free, NULL);
+	for (i = 0; keys[i]; ++i) {
+		el = el_alloc();
+		el->k = keys[i];
+		CRITBIT_INSERT(eltree, &tree, malloc(critbit_node_size()), el);
+	}
+
+	if (eltree_critbit_lower_bound(&tree, "a") != CRITBIT_GET(eltree,
+	    &tree, "b"))
+		abort();
+	if (eltree_critbit_predecessor(&tree, "a") != NULL)
+		abort();
+	if (strcmp(eltree_critbit_lower_bound(&tree, "bb")->k, "bb") != 0)
+		abort();
+	if (strcmp(eltree_critbit_upper_bound(&tree, "bb")->k, "bba") != 0)
+		abort();
+	if (strcmp(eltree_critbit_lower_bound(&tree, "bbb")->k, "bbc") != 0)
+		abort();
+	if (strcmp(eltree_critbit_predecessor(&tree, "bbb")->k, "bba") != 0)
+		abort();
+	if (strcmp(eltree_critbit_predecessor(&tree, "bc")->k, "bbc") != 0)
+		abort();
+	if (strcmp(eltree_critbit_lower_bound(&tree, "bc")->k, "d") != 0)
+		abort();
+	if (strcmp(eltree_critbit_predecessor(&tree, "ba")->k, "b") != 0)
+		abort();
+	if (strcmp(eltree_critbit_predecessor(&tree, "zz")->k, "d") != 0)
+		abort();
+	if (eltree_critbit_upper_bound(&tree, "d") != NULL)
+		abort();
+}
+
+struct range_result {
+	int cnt;
+	int64_t last;
+};
+
+static int
+range_cb(void *arg, struct element *el)
+{
+	struct range_result *r = arg;
+
+	if (r->cnt > 0 && el->kint <= r->last)
+		abort();
+	r->last = el->kint;
+	r->cnt++;
+	return (0);
+}
+
+static int
+range_key_cb(void *arg, void *key)
+{
+	return (range_cb(arg, CRITBIT_CAST(element, kint, key)));
+}
+
+static int
+range_str_cb(void *arg, struct element *el)
+{
+	struct range_result *r = arg;
+
+	r->cnt++;
+	return (strcmp(el->k, "bb") == 0);
+}
+
+static void
+test_range(void)
+{
+	CRITBIT_HEAD(eltree) tree;
+	CRITBIT_HEAD(elinttree) inttree;
+	struct range_result r;
+	struct element *el, *xel;
+	int64_t lo, hi, expect;
+	int i, n;
+
+	n = 500;
+	xel = malloc(sizeof(*xel) * n);
+	CRITBIT_INIT(elinttree, &inttree, std_free, NULL);
+	for (i = 0; i < n; ++i) {
+		/* even numbers in [-500, 498] */
+		xel[i].kint = ((i * 7) % n - n / 2) * 2;
+		CRITBIT_INSERT(elinttree, &inttree,
+		    malloc(critbit_node_size()), &xel[i]);
+	}
+
+	for (i = 0; i < 2000; ++i) {
+		lo = (int64_t)(hashint(i) % 1200) - 600;
+		hi = lo + (int64_t)(hashint(i + 7777) % 300) - 50;
+		for (expect = 0, r.last = lo; r.last < hi; r.last++) {
+			if (r.last >= -500 && r.last <= 498 &&
+			    (r.last & 1) == 0)
+				expect++;
+		}
+		r.cnt = 0;
+		CRITBIT_RANGE(elinttree, &inttree, lo, hi, range_cb, &r);
+		if (r.cnt != expect)
+			abort();
+	}
+
+	r.cnt = 0;
+	critbit_int_range(&inttree.treehead, NULL, NULL, range_key_cb, &r);
+	if (r.cnt != n)
+		abort();
+
+	CRITBIT_INIT(eltree, &tree, std_free, NULL);
+	for (i = 0; elems[i]; ++i) {
+		el = el_alloc();
+		el->k = elems[i];
+		CRITBIT_INSERT(eltree, &tree, malloc(critbit_node_size()), el);
+	}
+
+	/* "aa", "ab", "aba", "b" */
+	r.cnt = 0;
+	CRITBIT_RANGE(eltree, &tree, "a0", "b0", range_str_cb, &r);
+	if (r.cnt != 4)
+		abort();
+	/* stops at "bb" */
+	r.cnt = 0;
+	if (CRITBIT_RANGE(eltree, &tree, "aa", "zz", range_str_cb, &r) != 1 ||
+	    r.cnt != 7)
+		abort();
+	r.cnt = 0;
+	CRITBIT_RANGE(eltree, &tree, "b", "b", range_str_cb, &r);
+	CRITBIT_RANGE(eltree, &tree, "bb", "a", range_str_cb, &r);
+	if (r.cnt != 0)
+		abort();
+}
+
+static void
+count_free(void *arg, void *node)
+{
+	(*(int *)arg)++;
+	free(node);
+}
+
+static void
+el_free(void *arg, struct element *el)
+{
+	(*(int *)arg)++;
+	free(el);
+}
+
+struct entel {
+	int64_t k;
+	CRITBIT_ENTRY(entel) link;
+};
+
+CRITBIT_HEAD_PROTOTYPE(enttree);
+CRITBIT_GENERATE_ENTRY_STATIC(enttree, entel, int64, k, link);
+
+static void
+ent_free(void *arg, struct entel *e)
+{
+	(*(int *)arg)++;
+	free(e);
+}
+
+static void
+test_destroy(void)
+{
+	CRITBIT_HEAD(eltree) tree;
+	CRITBIT_HEAD(enttree) etree;
+	struct element *el;
+	struct entel *e;
+	int i, n, nodes, els;
+
+	nodes = 0;
+	els = 0;
+	CRITBIT_INIT(eltree, &tree, count_free, &nodes);
+	CRITBIT_DESTROY(eltree, &tree, el_free, &els);
+
+	for (i = 0, n = 0; test_data[i]; ++i) {
+		el = el_alloc();
+		el->k = test_data[i];
+		if (CRITBIT_INSERT(eltree, &tree,
+		    malloc(critbit_node_size()), el) == NULL)
+			n++;
+		else
+			free(el);
+	}
+	/* every node handed to insert is freed exactly once */
+	CRITBIT_DESTROY(eltree, &tree, el_free, &els);
+	if (nodes != i || els != n)
+		abort();
+	if (CRITBIT_GET(eltree, &tree, test_data[0]) != NULL)
+		abort();
+
+	/* single leaf, nothing to free for elements */
+	el = el_alloc();
+	el->k = elems[0];
+	CRITBIT_INSERT(eltree, &tree, malloc(critbit_node_size()), el);
+	CRITBIT_DESTROY(eltree, &tree, NULL, NULL);
+	if (nodes != i + 1)
+		abort();
+	free(el);
+
+	/* intrusive nodes die with their elements, each freed once */
+	CRITBIT_INIT_ENTRY(enttree, &etree, 0);
+	for (i = 0, n = 0; i < 2000; ++i) {
+		e = malloc(sizeof(*e));
+		e->k = hashint(i % 1500);
+		if (CRITBIT_INSERT_ENTRY(enttree, &etree, e) != NULL) {
+			free(CRITBIT_REMOVE(enttree, &etree, e->k));
+			free(e);
+			n--;
+		} else
+			n++;
+	}
+	els = 0;
+	CRITBIT_DESTROY(enttree, &etree, ent_free, &els);
+	if (els != n || !critbit_empty(&etree.treehead))
+		abort();
+}
+
+static void
+test_rank(void)
+{
+	CRITBIT_HEAD(elinttree) tree;
+	struct critbit_cursor cursor;
+	struct element *el, *xel;
+	int64_t q;
+	int i, n;
+
+	n = 300;
+	xel = malloc(sizeof(*xel) * n);
+	CRITBIT_INIT_FLAGS(elinttree, &tree, std_free, NULL, CRITBIT_F_COUNT);
+	if (critbit_count(&tree.treehead) != 0 ||
+	    CRITBIT_RANK(elinttree, &tree, 5) != 0 ||
+	    CRITBIT_SELECT(elinttree, &tree, NULL, 0) != NULL)
+		abort();
+
+	/* keys -300, -298, ..., 298; then remove every multiple of 3 */
+	for (i = 0; i < n; ++i) {
+		xel[i].kint = ((i * 7) % n - n / 2) * 2;
+		CRITBIT_INSERT(elinttree, &tree,
+		    malloc(CRITBIT_NODE_SIZE(&tree)), &xel[i]);
+	}
+	for (i = 0; i < n; ++i) {
+		if (xel[i].kint % 3 == 0 &&
+		    CRITBIT_REMOVE(elinttree, &tree, xel[i].kint) != &xel[i])
+			abort();
+	}
+	if (critbit_count(&tree.treehead) != 200)
+		abort();
+	/* misses leave counts alone */
+	if (CRITBIT_REMOVE(elinttree, &tree, 6) != NULL ||
+	    CRITBIT_REMOVE(elinttree, &tree, 1) != NULL ||
+	    critbit_count(&tree.treehead) != 200)
+		abort();
+
+	for (q = -305, n = 0; q <= 305; ++q) {
+		if (CRITBIT_RANK(elinttree, &tree, q) != (size_t)n)
+			abort();
+		if (q >= -300 && q < 300 && q % 2 == 0 && q % 3 != 0) {
+			el = CRITBIT_SELECT(elinttree, &tree, NULL, n);
+			if (el == NULL || el->kint != q)
+				abort();
+			n++;
+		}
+	}
+	if (CRITBIT_SELECT(elinttree, &tree, NULL, n) != NULL)
+		abort();
+
+	if (elinttree_critbit_count_range(&tree, -10, 10) != 7 ||
+	    elinttree_critbit_count_range(&tree, 10, -10) != 0 ||
+	    critbit_int_count_range(&tree.treehead, NULL, NULL) != 200)
+		abort();
+
+	/* page through with select and cursor */
+	el = CRITBIT_SELECT(elinttree, &tree, &cursor, 150);
+	for (i = 150; el != NULL; ++i)
+		el = CRITBIT_NEXT(elinttree, &cursor);
+	if (i != 200)
+		abort();
+}
+
+static void
+test_prefix_count(void)
+{
+	CRITBIT_HEAD(eltree) tree, ctree;
+	struct element *el, *cel;
+	char *k, prefix[32];
+	int i, j;
+
+	CRITBIT_INIT(eltree, &tree, std_free, NULL);
+	CRITBIT_INIT_FLAGS(eltree, &ctree, std_free, NULL, CRITBIT_F_COUNT);
+
+	/* tenant/<i>/<j> with i keys under tenant i */
+	for (i = 0; i < 40; ++i) {
+		for (j = 0; j < i; ++j) {
+			k = malloc(32);
+			snprintf(k, 32, "tenant/%d/%d", i, j);
+			el = el_alloc();
+			cel = el_alloc();
+			el->k = cel->k = k;
+			CRITBIT_INSERT(eltree, &tree,
+			    malloc(CRITBIT_NODE_SIZE(&tree)), el);
+			CRITBIT_INSERT(eltree, &ctree,
+			    malloc(CRITBIT_NODE_SIZE(&ctree)), cel);
+		}
+	}
+
+	for (i = 0; i < 40; ++i) {
+		snprintf(prefix, sizeof(prefix), "tenant/%d/", i);
+		if (CRITBIT_PREFIX_COUNT(eltree, &tree, prefix,
+		    strlen(prefix)) != (size_t)i)
+			abort();
+		if (CRITBIT_PREFIX_COUNT(eltree, &ctree, prefix,
+		    strlen(prefix)) != (size_t)i)
+			abort();
+	}
+
+	/* tenant/1/, tenant/10/ ... tenant/19/ */
+	if (CRITBIT_PREFIX_COUNT(eltree, &ctree, "tenant/1", 8) != 1 + 145)
+		abort();
+	if (CRITBIT_PREFIX_COUNT(eltree, &ctree, "tenant/", 7) != 780 ||
+	    CRITBIT_PREFIX_COUNT(eltree, &ctree, "", 0) != 780)
+		abort();
+	if (CRITBIT_PREFIX_COUNT(eltree, &ctree, "tenant/0", 8) != 0 ||
+	    CRITBIT_PREFIX_COUNT(eltree, &ctree, "tenant/39/38/", 13) != 0 ||
+	    CRITBIT_PREFIX_COUNT(eltree, &ctree, "x", 1) != 0)
+		abort();
+}
+
+static int
+el_strcmp(const void *a, const void *b)
+{
+	return (strcmp((*(struct element *const *)a)->k,
+	    (*(struct element *const *)b)->k));
+}
+
+static void
+test_bulk_load(void)
+{
+	CRITBIT_HEAD(eltree) tree;
+	CRITBIT_HEAD(elinttree) inttree;
+	struct critbit_cursor cursor;
+	struct critbit_node **nodes;
+	struct element *el, **els, *xel;
+	int i, j, n;
+
+	for (n = 0; test_data[n]; )
+		n++;
+	els = malloc(sizeof(*els) * n);
+	nodes = malloc(sizeof(*nodes) * n);
+	for (i = 0; i < n; ++i) {
+		els[i] = el_alloc();
+		els[i]->k = test_data[i];
+		nodes[i] = malloc(critbit_node_size());
+	}
+	qsort(els, n, sizeof(*els), el_strcmp);
+	for (i = 1, j = 1; i < n; ++i) {
+		if (strcmp(els[j - 1]->k, els[i]->k) != 0)
+			els[j++] = els[i];
+	}
+	n = j;
+
+	CRITBIT_INIT(eltree, &tree, std_free, NULL);
+	if (CRITBIT_BULK_LOAD(eltree, &tree, els, 0, nodes) != 0 ||
+	    CRITBIT_BULK_LOAD(eltree, &tree, els, 1, nodes) != 0 ||
+	    CRITBIT_FIRST(eltree, &tree, &cursor) != els[0])
+		abort();
+	CRITBIT_INIT(eltree, &tree, std_free, NULL);
+	if (CRITBIT_BULK_LOAD(eltree, &tree, els, n, nodes) != 0)
+		abort();
+	i = 0;
+	CRITBIT_FOREACH(el, eltree, &tree, &cursor) {
+		if (el != els[i++])
+			abort();
+	}
+	if (i != n)
+		abort();
+	for (i = 0; i < n; ++i) {
+		if (CRITBIT_GET(eltree, &tree, els[i]->k) != els[i])
+			abort();
+	}
+	/* tree stays usable for updates */
+	for (i = 0; i < n; i += 2) {
+		if (CRITBIT_REMOVE(eltree, &tree, els[i]->k) != els[i])
+			abort();
+	}
+	for (i = 0; i < n; ++i) {
+		if ((CRITBIT_GET(eltree, &tree, els[i]->k) == NULL) != !(i & 1))
+			abort();
+	}
+
+	/* unsorted and duplicate input, nodes above were partly freed */
+	for (i = 0; i < n; ++i)
+		nodes[i] = malloc(critbit_node_size());
+	CRITBIT_INIT(eltree, &tree, std_free, NULL);
+	el = els[1];
+	els[1] = els[2];
+	els[2] = el;
+	if (CRITBIT_BULK_LOAD(eltree, &tree, els, n, nodes) != EINVAL ||
+	    !critbit_empty(&tree.treehead))
+		abort();
+	els[1] = els[2];
+	if (CRITBIT_BULK_LOAD(eltree, &tree, els, n, nodes) != EINVAL)
+		abort();
+
+	/* counted integer tree, negative keys first */
+	n = 1000;
+	xel = malloc(sizeof(*xel) * n);
+	els = realloc(els, sizeof(*els) * n);
+	nodes = realloc(nodes, sizeof(*nodes) * n);
+	CRITBIT_INIT_FLAGS(elinttree, &inttree, std_free, NULL,
+	    CRITBIT_F_COUNT);
+	for (i = 0; i < n; ++i) {
+		xel[i].kint = (int64_t)(i - n / 2) * 1000003;
+		els[i] = &xel[i];
+		nodes[i] = malloc(CRITBIT_NODE_SIZE(&inttree));
+	}
+	if (CRITBIT_BULK_LOAD(elinttree, &inttree, els, n, nodes) != 0)
+		abort();
+	for (i = 0; i < n; ++i) {
+		if (CRITBIT_GET(elinttree, &inttree, xel[i].kint) != &xel[i] ||
+		    CRITBIT_RANK(elinttree, &inttree, xel[i].kint) != (size_t)i)
+			abort();
+	}
+	if (critbit_count(&inttree.treehead) != (size_t)n)
+		abort();
+}
+
+static void
+test_get_batch(void)
+{
+	CRITBIT_HEAD(eltree) tree;
+	CRITBIT_HEAD(elinttree) inttree;
+	struct element *el, **out, *xel;
+	const char **keys;
+	int64_t *ikeys;
+	int i, n;
+
+	for (n = 0; test_data[n]; )
+		n++;
+	keys = malloc(sizeof(*keys) * n * 2);
+	out = malloc(sizeof(*out) * n * 2);
+
+	CRITBIT_INIT(eltree, &tree, std_free, NULL);
+	for (i = 0; i < n; ++i)
+		keys[i] = test_data[i];
+	CRITBIT_GET_BATCH(eltree, &tree, keys, n, out);
+	for (i = 0; i < n; ++i) {
+		if (out[i] != NULL)
+			abort();
+	}
+
+	for (i = 0; i < n; ++i) {
+		el = el_alloc();
+		el->k = test_data[i];
+		CRITBIT_INSERT(eltree, &tree, malloc(critbit_node_size()), el);
+		/* suffixes of stored keys, mostly misses */
+		keys[n + i] = test_data[i] + 1;
+	}
+	CRITBIT_GET_BATCH(eltree, &tree, keys, n * 2, out);
+	for (i = 0; i < n * 2; ++i) {
+		if (out[i] != CRITBIT_GET(eltree, &tree, keys[i]))
+			abort();
+	}
+
+	n = 1000;
+	xel = malloc(sizeof(*xel) * n);
+	ikeys = malloc(sizeof(*ikeys) * n);
+	CRITBIT_INIT(elinttree, &inttree, std_free, NULL);
+	for (i = 0; i < n; ++i) {
+		xel[i].kint = hashint(i);
+		ikeys[i] = i & 1 ? xel[i].kint : -xel[i].kint - 1;
+		CRITBIT_INSERT(elinttree, &inttree,
+		    malloc(critbit_node_size()), &xel[i]);
+	}
+	CRITBIT_GET_BATCH(elinttree, &inttree, ikeys, n, out);
+	for (i = 0; i < n; ++i) {
+		if (out[i] != (i & 1 ? &xel[i] : NULL))
+			abort();
+	}
+}
+
+static void
+test_insert_finger(void)
+{
+	CRITBIT_HEAD(eltree) tree;
+	CRITBIT_HEAD(elinttree) inttree;
+	struct critbit_cursor finger, cursor;
+	struct element *el, *prev, *xel;
+	int i, n;
+
+	/* ascending, descending and scattered runs */
+	n = 3000;
+	xel = malloc(sizeof(*xel) * n);
+	CRITBIT_INIT_FLAGS(elinttree, &inttree, std_free, NULL,
+	    CRITBIT_F_COUNT);
+	critbit_cursor_init(&finger);
+	for (i = 0; i < n; ++i) {
+		if (i < 1000)
+			xel[i].kint = i - 500;
+		else if (i < 2000)
+			xel[i].kint = 10000 - i;
+		else
+			xel[i].kint = (int64_t)hashint(i) - (1 << 30);
+		el = CRITBIT_INSERT_FINGER(elinttree, &inttree, &finger,
+		    malloc(CRITBIT_NODE_SIZE(&inttree)), &xel[i]);
+		if (el != NULL)
+			abort();
+	}
+	if (critbit_count(&inttree.treehead) != (size_t)n)
+		abort();
+	for (i = 0; i < n; ++i) {
+		el = CRITBIT_INSERT_FINGER(elinttree, &inttree, &finger,
+		    malloc(CRITBIT_NODE_SIZE(&inttree)), &xel[(i * 7) % n]);
+		if (el != &xel[(i * 7) % n])
+			abort();
+		if (CRITBIT_GET(elinttree, &inttree, xel[i].kint) != &xel[i])
+			abort();
+	}
+	i = 0;
+	prev = NULL;
+	CRITBIT_FOREACH(el, elinttree, &inttree, &cursor) {
+		if (prev != NULL && prev->kint >= el->kint)
+			abort();
+		if (CRITBIT_RANK(elinttree, &inttree, el->kint) != (size_t)i)
+			abort();
+		prev = el;
+		i++;
+	}
+	if (i != n)
+		abort();
+
+	/* string keys deeper than the finger path */
+	CRITBIT_INIT(eltree, &tree, std_free, NULL);
+	critbit_cursor_init(&finger);
+	for (i = 0; test_data[i]; ++i) {
+		el = el_alloc();
+		el->k = test_data[i];
+		if (CRITBIT_INSERT_FINGER(eltree, &tree, &finger,
+		    malloc(critbit_node_size()), el) != NULL)
+			free(el);
+	}
+	for (i = 0; test_data[i]; ++i) {
+		if (CRITBIT_GET(eltree, &tree, test_data[i]) == NULL)
+			abort();
+	}
+}
+
+static int merge_conflicts;
+
+static struct element *
+merge_take_src(void *arg __unused, struct element *a __unused,
+    struct element *b)
+{
+	merge_conflicts++;
+	return (b);
+}
+
+static struct element *
+merge_keep_dst(void *arg __unused, struct element *a, struct element *b)
+{
+	free(b);
+	return (a);
+}
+
+static void
+test_merge_check(CRITBIT_HEAD(elinttree) *tree, size_t n)
+{
+	struct critbit_cursor cursor, sc;
+	struct element *el, *prev;
+	size_t i;
+
+	if (critbit_count(&tree->treehead) != n)
+		abort();
+	i = 0;
+	prev = NULL;
+	CRITBIT_FOREACH(el, elinttree, tree, &cursor) {
+		if (prev != NULL && prev->kint >= el->kint)
+			abort();
+		if (CRITBIT_RANK(elinttree, tree, el->kint) != i)
+			abort();
+		if (CRITBIT_SELECT(elinttree, tree, &sc, i) != el)
+			abort();
+		prev = el;
+		i++;
+	}
+	if (i != n)
+		abort();
+}
+
+static void
+test_merge(void)
+{
+	CRITBIT_HEAD(eltree) tree, stree;
+	CRITBIT_HEAD(elinttree) a, b;
+	struct critbit_cursor cursor;
+	struct element *el, *xa, *xb;
+	int i, k, n;
+
+	n = 2000;
+	xa = malloc(sizeof(*xa) * n);
+	xb = malloc(sizeof(*xb) * n);
+	for (k = 0; k < 4; ++k) {
+		CRITBIT_INIT_FLAGS(elinttree, &a, std_free, NULL,
+		    CRITBIT_F_COUNT);
+		CRITBIT_INIT_FLAGS(elinttree, &b, std_free, NULL,
+		    CRITBIT_F_COUNT);
+		for (i = 0; i < n; ++i) {
+			switch (k) {
+			case 0:		/* disjoint */
+				xa[i].kint = -i - 1;
+				xb[i].kint = i;
+				break;
+			case 1:		/* interleaved */
+				xa[i].kint = i * 2;
+				xb[i].kint = i * 2 + 1;
+				break;
+			case 2:		/* overlapping */
+				xa[i].kint = i;
+				xb[i].kint = i + n / 2;
+				break;
+			default:	/* scattered */
+				xa[i].kint = (int64_t)(hashint(i) % 3000);
+				xb[i].kint = (int64_t)(hashint(i + n) % 3000);
+				break;
+			}
+			if (CRITBIT_INSERT(elinttree, &a,
+			    malloc(CRITBIT_NODE_SIZE(&a)), &xa[i]) != NULL)
+				xa[i].kint = INT64_MIN;
+			if (CRITBIT_INSERT(elinttree, &b,
+			    malloc(CRITBIT_NODE_SIZE(&b)), &xb[i]) != NULL)
+				xb[i].kint = INT64_MIN;
+		}
+		merge_conflicts = 0;
+		CRITBIT_MERGE(elinttree, &a, &b, malloc(CRITBIT_NODE_SIZE(&a)),
+		    merge_take_src, NULL);
+		if (CRITBIT_FIRST(elinttree, &b, &cursor) != NULL)
+			abort();
+		for (i = 0; i < n; ++i) {
+			if (xb[i].kint != INT64_MIN &&
+			    CRITBIT_GET(elinttree, &a, xb[i].kint) != &xb[i])
+				abort();
+			if (xa[i].kint == INT64_MIN)
+				continue;
+			el = CRITBIT_GET(elinttree, &a, xa[i].kint);
+			if (el == NULL || (el != &xa[i] && el->kint != xa[i].kint))
+				abort();
+		}
+		test_merge_check(&a, critbit_count(&a.treehead));
+		switch (k) {
+		case 0:
+		case 1:
+			if (merge_conflicts != 0 ||
+			    critbit_count(&a.treehead) != (size_t)n * 2)
+				abort();
+			break;
+		case 2:
+			if (merge_conflicts != n / 2 ||
+			    critbit_count(&a.treehead) != (size_t)n * 3 / 2)
+				abort();
+			break;
+		}
+
+		/* merging into and from an empty tree */
+		CRITBIT_MERGE(elinttree, &b, &a, malloc(CRITBIT_NODE_SIZE(&b)),
+		    merge_take_src, NULL);
+		if (CRITBIT_FIRST(elinttree, &a, &cursor) != NULL)
+			abort();
+		CRITBIT_MERGE(elinttree, &b, &a, malloc(CRITBIT_NODE_SIZE(&b)),
+		    merge_take_src, NULL);
+		test_merge_check(&b, critbit_count(&b.treehead));
+	}
+	free(xa);
+	free(xb);
+
+	/* string keys, dst wins and the dropped src element is freed */
+	CRITBIT_INIT(eltree, &tree, std_free, NULL);
+	CRITBIT_INIT(eltree, &stree, std_free, NULL);
+	for (i = 0; test_data[i]; ++i) {
+		el = el_alloc();
+		el->k = test_data[i];
+		if (CRITBIT_INSERT(eltree, (i & 1) ? &tree : &stree,
+		    malloc(critbit_node_size()), el) != NULL)
+			free(el);
+	}
+	for (i = 0; elems[i]; ++i) {
+		el = el_alloc();
+		el->k = elems[i];
+		if (CRITBIT_INSERT(eltree, &stree,
+		    malloc(critbit_node_size()), el) != NULL)
+			free(el);
+	}
+	CRITBIT_MERGE(eltree, &tree, &stree, malloc(critbit_node_size()),
+	    merge_keep_dst, NULL);
+	for (i = 0; test_data[i]; ++i) {
+		if (CRITBIT_GET(eltree, &tree, test_data[i]) == NULL)
+			abort();
+	}
+	for (i = 0; elems[i]; ++i) {
+		if (CRITBIT_GET(eltree, &tree, elems[i]) == NULL)
+			abort();
+	}
+	xa = NULL;
+	CRITBIT_FOREACH(el, eltree, &tree, &cursor) {
+		if (xa != NULL && strcmp(xa->k, el->k) >= 0)
+			abort();
+		xa = el;
+	}
+}
+
+static int
+setop_collect(void *arg, struct element *el)
+{
+	int64_t **out = arg;
+
+	*(*out)++ = el->kint;
+	return (0);
+}
+
+static int
+setop_stop(void *arg __unused, struct element *el __unused)
+{
+	return (7);
+}
+
+static void
+test_setop(void)
+{
+	CRITBIT_HEAD(eltree) sa, sb;
+	CRITBIT_HEAD(elinttree) a, b;
+	struct element *el, *xa, *xb;
+	int64_t *res, *out;
+	int i, n, m, j;
+
+	n = 3000;
+	m = 4000;
+	xa = malloc(sizeof(*xa) * n);
+	xb = malloc(sizeof(*xb) * (n / 10));
+	res = malloc(sizeof(*res) * n);
+	CRITBIT_INIT(elinttree, &a, std_free, NULL);
+	CRITBIT_INIT_FLAGS(elinttree, &b, std_free, NULL, CRITBIT_F_COUNT);
+	for (i = 0; i < n; ++i) {
+		xa[i].kint = (int64_t)(hashint(i) % m) - m / 2;
+		CRITBIT_INSERT(elinttree, &a, malloc(critbit_node_size()),
+		    &xa[i]);
+	}
+	for (i = 0; i < n / 10; ++i) {
+		xb[i].kint = (int64_t)(hashint(i + n) % m) - m / 2;
+		CRITBIT_INSERT(elinttree, &b, malloc(CRITBIT_NODE_SIZE(&b)),
+		    &xb[i]);
+	}
+
+	/* compare against probing every possible key */
+	out = res;
+	if (CRITBIT_INTERSECT_FOREACH(elinttree, &a, &b, setop_collect,
+	    &out) != 0)
+		abort();
+	for (j = 0, i = -m / 2; i < m / 2; ++i) {
+		if (CRITBIT_GET(elinttree, &a, i) == NULL ||
+		    CRITBIT_GET(elinttree, &b, i) == NULL)
+			continue;
+		if (res + j >= out || res[j] != i)
+			abort();
+		j++;
+	}
+	if (res + j != out)
+		abort();
+
+	out = res;
+	if (CRITBIT_DIFF_FOREACH(elinttree, &a, &b, setop_collect, &out) != 0)
+		abort();
+	for (j = 0, i = -m / 2; i < m / 2; ++i) {
+		if (CRITBIT_GET(elinttree, &a, i) == NULL ||
+		    CRITBIT_GET(elinttree, &b, i) != NULL)
+			continue;
+		if (res + j >= out || res[j] != i)
+			abort();
+		j++;
+	}
+	if (res + j != out)
+		abort();
+
+	if (CRITBIT_DIFF_FOREACH(elinttree, &a, &b, setop_stop, NULL) != 7)
+		abort();
+
+	/* b minus empty tree is b, intersection is empty */
+	CRITBIT_INIT(elinttree, &a, std_free, NULL);
+	out = res;
+	CRITBIT_INTERSECT_FOREACH(elinttree, &b, &a, setop_collect, &out);
+	if (out != res)
+		abort();
+	CRITBIT_DIFF_FOREACH(elinttree, &b, &a, setop_collect, &out);
+	if ((size_t)(out - res) != critbit_count(&b.treehead))
+		abort();
+
+	/* strings, b is a subset of a */
+	CRITBIT_INIT(eltree, &sa, std_free, NULL);
+	CRITBIT_INIT(eltree, &sb, std_free, NULL);
+	for (i = 0; test_data[i]; ++i) {
+		el = el_alloc();
+		el->k = test_data[i];
+		if (CRITBIT_INSERT(eltree, &sa, malloc(critbit_node_size()),
+		    el) != NULL)
+			free(el);
+		if ((i % 3) != 0)
+			continue;
+		el = el_alloc();
+		el->k = test_data[i];
+		if (CRITBIT_INSERT(eltree, &sb, malloc(critbit_node_size()),
+		    el) != NULL)
+			free(el);
+	}
+	if (CRITBIT_INTERSECT_FOREACH(eltree, &sa, &sb, setop_stop, NULL) != 7)
+		abort();
+	if (CRITBIT_DIFF_FOREACH(eltree, &sb, &sa, setop_stop, NULL) != 0)
+		abort();
+	free(res);
+}
+
+static void
+test_split_join(void)
+{
+	CRITBIT_HEAD(eltree) tree, sleft, sright;
+	CRITBIT_HEAD(elinttree) t, left, right;
+	struct critbit_cursor cursor;
+	struct element *el, *xel;
+	int i, n, split;
+
+	n = 2000;
+	xel = malloc(sizeof(*xel) * n);
+	CRITBIT_INIT_FLAGS(elinttree, &t, std_free, NULL, CRITBIT_F_COUNT);
+	CRITBIT_INIT_FLAGS(elinttree, &left, std_free, NULL, CRITBIT_F_COUNT);
+	CRITBIT_INIT_FLAGS(elinttree, &right, std_free, NULL, CRITBIT_F_COUNT);
+	for (i = 0; i < n; ++i) {
+		xel[i].kint = i * 3 - n;
+		CRITBIT_INSERT(elinttree, &t, malloc(CRITBIT_NODE_SIZE(&t)),
+		    &xel[i]);
+	}
+
+	for (split = -n - 5; split < 2 * n + 5; split += 97) {
+		CRITBIT_SPLIT(elinttree, &t, split, &left, &right);
+		if (CRITBIT_FIRST(elinttree, &t, &cursor) != NULL)
+			abort();
+		CRITBIT_FOREACH(el, elinttree, &left, &cursor) {
+			if (el->kint >= split)
+				abort();
+		}
+		CRITBIT_FOREACH(el, elinttree, &right, &cursor) {
+			if (el->kint < split)
+				abort();
+		}
+		if (CRITBIT_RANK(elinttree, &left, split) +
+		    CRITBIT_RANK(elinttree, &right, INT64_MAX) != (size_t)n)
+			abort();
+
+		/* wrong order is refused and leaves trees alone */
+		if (left.treehead.ct_root != NULL &&
+		    right.treehead.ct_root != NULL) {
+			if (CRITBIT_JOIN(elinttree, &right, &left,
+			    malloc(CRITBIT_NODE_SIZE(&t))) != EINVAL)
+				abort();
+		}
+		if (CRITBIT_JOIN(elinttree, &left, &right,
+		    malloc(CRITBIT_NODE_SIZE(&t))) != 0)
+			abort();
+		if (CRITBIT_FIRST(elinttree, &right, &cursor) != NULL)
+			abort();
+		i = 0;
+		CRITBIT_FOREACH(el, elinttree, &left, &cursor) {
+			if (el != &xel[i])
+				abort();
+			if (CRITBIT_RANK(elinttree, &left, el->kint) !=
+			    (size_t)i)
+				abort();
+			i++;
+		}
+		if (i != n)
+			abort();
+		t = left;
+		left.treehead.ct_root = NULL;
+	}
+	free(xel);
+
+	/* strings, split at a key which is a prefix of other keys */
+	CRITBIT_INIT(eltree, &tree, std_free, NULL);
+	CRITBIT_INIT(eltree, &sleft, std_free, NULL);
+	CRITBIT_INIT(eltree, &sright, std_free, NULL);
+	for (i = 0; elems[i]; ++i) {
+		el = el_alloc();
+		el->k = elems[i];
+		CRITBIT_INSERT(eltree, &tree, malloc(critbit_node_size()), el);
+	}
+	CRITBIT_SPLIT(eltree, &tree, "ab", &sleft, &sright);
+	i = 0;
+	CRITBIT_FOREACH(el, eltree, &sleft, &cursor) {
+		if (strcmp(el->k, "ab") >= 0)
+			abort();
+		i++;
+	}
+	CRITBIT_FOREACH(el, eltree, &sright, &cursor) {
+		if (strcmp(el->k, "ab") < 0)
+			abort();
+		i++;
+	}
+	if (i != 8)
+		abort();
+	if (CRITBIT_JOIN(eltree, &sleft, &sright,
+	    malloc(critbit_node_size())) != 0)
+		abort();
+	for (i = 0; elems[i]; ++i) {
+		if (CRITBIT_GET(eltree, &sleft, elems[i]) == NULL)
+			abort();
+	}
+}
+
+struct hash_diff {
+	int64_t	keys[8];
+	int	side[8];
+	int	n;
+};
+
+static int
+hash_diff_collect(void *arg, struct element *a, struct element *b)
+{
+	struct hash_diff *hd = arg;
+
+	if (hd->n == 8)
+		abort();
+	hd->keys[hd->n] = a != NULL ? a->kint : b->kint;
+	hd->side[hd->n++] = a != NULL ? 0 : 1;
+	return (0);
+}
+
+static void
+test_hash_diff(void)
+{
+	CRITBIT_HEAD(elinttree) a, b;
+	struct critbit_node **nodes;
+	struct critbit_cursor finger;
+	struct element *xa, *xb, **els, extra[2];
+	struct hash_diff hd;
+	int flags, i, n;
+
+	n = 5000;
+	flags = CRITBIT_F_HASH | CRITBIT_F_COUNT;
+	xa = malloc(sizeof(*xa) * n);
+	xb = malloc(sizeof(*xb) * n);
+	els = malloc(sizeof(*els) * n);
+	nodes = malloc(sizeof(*nodes) * n);
+	CRITBIT_INIT_FLAGS(elinttree, &a, std_free, NULL, flags);
+	CRITBIT_INIT_FLAGS(elinttree, &b, std_free, NULL, flags);
+
+	/* same keys, a built by random inserts, b by bulk load */
+	for (i = 0; i < n; ++i) {
+		xa[(i * 7) % n].kint = i * 10;
+		xb[i].kint = i * 10;
+		els[i] = &xb[i];
+		nodes[i] = malloc(CRITBIT_NODE_SIZE(&b));
+	}
+	for (i = 0; i < n; ++i)
+		CRITBIT_INSERT(elinttree, &a, malloc(CRITBIT_NODE_SIZE(&a)),
+		    &xa[i]);
+	if (CRITBIT_BULK_LOAD(elinttree, &b, els, n, nodes) != 0)
+		abort();
+	hd.n = 0;
+	if (CRITBIT_DIFF(elinttree, &a, &b, hash_diff_collect, &hd) != 0 ||
+	    hd.n != 0)
+		abort();
+
+	/* three keys gone from a, two new ones in b */
+	CRITBIT_REMOVE(elinttree, &a, 0);
+	CRITBIT_REMOVE(elinttree, &a, 25000);
+	CRITBIT_REMOVE(elinttree, &a, (n - 1) * 10);
+	if (CRITBIT_REMOVE(elinttree, &a, 12345) != NULL)
+		abort();
+	critbit_cursor_init(&finger);
+	extra[0].kint = 12345;
+	extra[1].kint = -1;
+	CRITBIT_INSERT_FINGER(elinttree, &b, &finger,
+	    malloc(CRITBIT_NODE_SIZE(&b)), &extra[0]);
+	CRITBIT_INSERT_FINGER(elinttree, &b, &finger,
+	    malloc(CRITBIT_NODE_SIZE(&b)), &extra[1]);
+	hd.n = 0;
+	CRITBIT_DIFF(elinttree, &a, &b, hash_diff_collect, &hd);
+	if (hd.n != 5 ||
+	    hd.keys[0] != -1 || hd.side[0] != 1 ||
+	    hd.keys[1] != 0 || hd.side[1] != 1 ||
+	    hd.keys[2] != 12345 || hd.side[2] != 1 ||
+	    hd.keys[3] != 25000 || hd.side[3] != 1 ||
+	    hd.keys[4] != (n - 1) * 10 || hd.side[4] != 1)
+		abort();
+
+	/* make them equal again by moving keys around */
+	CRITBIT_REMOVE(elinttree, &b, 12345);
+	CRITBIT_REMOVE(elinttree, &b, -1);
+	CRITBIT_REMOVE(elinttree, &b, 0);
+	CRITBIT_REMOVE(elinttree, &b, 25000);
+	CRITBIT_REMOVE(elinttree, &b, (n - 1) * 10);
+	hd.n = 0;
+	CRITBIT_DIFF(elinttree, &b, &a, hash_diff_collect, &hd);
+	if (hd.n != 0)
+		abort();
+	free(xa);
+	free(xb);
+	free(els);
+	free(nodes);
+}
+
+static void
+test_replace(void)
+{
+	CRITBIT_HEAD(eltree) tree;
+	CRITBIT_HEAD(elinttree) inttree, copy;
+	struct element *el, *xel, *yel;
+	struct hash_diff hd;
+	int flags, i, n;
+
+	n = 1000;
+	flags = CRITBIT_F_COUNT | CRITBIT_F_HASH;
+	xel = malloc(sizeof(*xel) * n);
+	yel = malloc(sizeof(*yel) * n);
+	CRITBIT_INIT_FLAGS(elinttree, &inttree, std_free, NULL, flags);
+	CRITBIT_INIT_FLAGS(elinttree, &copy, std_free, NULL, flags);
+	for (i = 0; i < n; ++i) {
+		xel[i].kint = yel[i].kint = (int64_t)hashint(i);
+		if (i % 2 == 0)
+			continue;
+		if (CRITBIT_REPLACE(elinttree, &inttree,
+		    malloc(CRITBIT_NODE_SIZE(&inttree)), &xel[i]) != NULL)
+			abort();
+	}
+	for (i = 0; i < n; ++i) {
+		el = CRITBIT_REPLACE(elinttree, &inttree,
+		    malloc(CRITBIT_NODE_SIZE(&inttree)), &yel[i]);
+		if (el != (i % 2 == 0 ? NULL : &xel[i]))
+			abort();
+		CRITBIT_INSERT(elinttree, &copy,
+		    malloc(CRITBIT_NODE_SIZE(&copy)), &xel[i]);
+	}
+	if (critbit_count(&inttree.treehead) != (size_t)n)
+		abort();
+	for (i = 0; i < n; ++i) {
+		if (CRITBIT_GET(elinttree, &inttree, yel[i].kint) != &yel[i])
+			abort();
+	}
+	hd.n = 0;
+	CRITBIT_DIFF(elinttree, &inttree, &copy, hash_diff_collect, &hd);
+	if (hd.n != 0)
+		abort();
+	free(xel);
+	free(yel);
+
+	CRITBIT_INIT(eltree, &tree, std_free, NULL);
+	for (i = 0; elems[i]; ++i) {
+		el = el_alloc();
+		el->k = elems[i];
+		if (CRITBIT_REPLACE(eltree, &tree, malloc(critbit_node_size()),
+		    el) != NULL)
+			abort();
+	}
+	for (i = 0; elems[i]; ++i) {
+		el = el_alloc();
+		el->k = elems[i];
+		xel = CRITBIT_REPLACE(eltree, &tree,
+		    malloc(critbit_node_size()), el);
+		if (xel == NULL || strcmp(xel->k, elems[i]) != 0)
+			abort();
+		free(xel);
+		if (CRITBIT_GET(eltree, &tree, elems[i]) != el)
+			abort();
+	}
+}
+
+static void
+test_prepare_commit(void)
+{
+	CRITBIT_HEAD(eltree) tree;
+	CRITBIT_HEAD(elinttree) inttree, copy;
+	struct critbit_slot slot;
+	struct element *el, *xel;
+	struct hash_diff hd;
+	int flags, i, n, found;
+
+	n = 3000;
+	flags = CRITBIT_F_COUNT | CRITBIT_F_HASH;
+	xel = malloc(sizeof(*xel) * n);
+	CRITBIT_INIT_FLAGS(elinttree, &inttree, std_free, NULL, flags);
+	CRITBIT_INIT_FLAGS(elinttree, &copy, std_free, NULL, flags);
+	found = 0;
+	for (i = 0; i < n; ++i) {
+		xel[i].kint = (int64_t)(hashint(i) % 2000) - 1000;
+		el = CRITBIT_FIND_OR_PREPARE(elinttree, &inttree,
+		    xel[i].kint, &slot);
+		if (el != NULL) {
+			if (el->kint != xel[i].kint)
+				abort();
+			found++;
+			continue;
+		}
+		CRITBIT_COMMIT(elinttree, &slot, i == 0 ? NULL :
+		    malloc(CRITBIT_NODE_SIZE(&inttree)), &xel[i]);
+		if (CRITBIT_INSERT(elinttree, &copy,
+		    malloc(CRITBIT_NODE_SIZE(&copy)), &xel[i]) != NULL)
+			abort();
+	}
+	if (found == 0 ||
+	    critbit_count(&inttree.treehead) != (size_t)(n - found))
+		abort();
+	for (i = 0; i < n; ++i) {
+		el = CRITBIT_GET(elinttree, &inttree, xel[i].kint);
+		if (el == NULL || el->kint != xel[i].kint)
+			abort();
+		if (CRITBIT_RANK(elinttree, &inttree, xel[i].kint) !=
+		    CRITBIT_RANK(elinttree, &copy, xel[i].kint))
+			abort();
+	}
+	hd.n = 0;
+	CRITBIT_DIFF(elinttree, &inttree, &copy, hash_diff_collect, &hd);
+	if (hd.n != 0)
+		abort();
+	free(xel);
+
+	CRITBIT_INIT(eltree, &tree, std_free, NULL);
+	for (i = 0; test_data[i]; ++i) {
+		if (CRITBIT_FIND_OR_PREPARE(eltree, &tree, test_data[i],
+		    &slot) != NULL)
+			continue;
+		el = el_alloc();
+		el->k = test_data[i];
+		CRITBIT_COMMIT(eltree, &slot, malloc(critbit_node_size()), el);
+	}
+	for (i = 0; test_data[i]; ++i) {
+		el = CRITBIT_GET(eltree, &tree, test_data[i]);
+		if (el == NULL || strcmp(el->k, test_data[i]) != 0)
+			abort();
+	}
+}
+
+struct longkey {
+	uint8_t	key[64];
+};
+
+static int
+longkey_cmp(const void *a, const void *b)
+{
+	return (memcmp(*(const struct longkey *const *)a,
+	    *(const struct longkey *const *)b, sizeof(struct longkey)));
+}
+
+/* keys differing at every byte and bit of long buffers and strings */
+static void
+test_long_keys(void)
+{
+	struct critbit_tree t, st;
+	struct critbit_cursor cursor;
+	struct longkey *keys, **sorted;
+	char **strs, buf[256];
+	void *k;
+	int i, n;
+
+	n = 64 * 8 + 1;
+	keys = malloc(sizeof(*keys) * n);
+	sorted = malloc(sizeof(*sorted) * n);
+	critbit_init(&t, std_free, NULL, sizeof(struct longkey));
+	for (i = 0; i < n; ++i) {
+		memset(keys[i].key, 0x5a, sizeof(keys[i].key));
+		if (i > 0)
+			keys[i].key[(i - 1) / 8] ^= 1 << ((i - 1) % 8);
+		sorted[i] = &keys[i];
+		if (critbit_buf_insert(&t, malloc(critbit_node_size()),
+		    keys[i].key) != NULL)
+			abort();
+	}
+	qsort(sorted, n, sizeof(*sorted), longkey_cmp);
+	i = 0;
+	for (k = critbit_first(&t, &cursor); k != NULL;
+	    k = critbit_buf_next(&cursor)) {
+		if (k != sorted[i++]->key)
+			abort();
+	}
+	if (i != n)
+		abort();
+	for (i = 0; i < n; ++i) {
+		if (critbit_buf_get(&t, keys[i].key) != keys[i].key)
+			abort();
+	}
+
+	/* strings sharing long prefixes, some being prefixes of others */
+	strs = malloc(sizeof(*strs) * n);
+	critbit_init(&st, std_free, NULL, 0);
+	for (i = 0; i < n; ++i) {
+		strs[i] = malloc(i % 200 + 2);
+		memset(strs[i], 'a' + i / 200, i % 200 + 1);
+		strs[i][i % 200 + 1] = '\0';
+		if (critbit_str_insert(&st, malloc(critbit_node_size()),
+		    (const char **)&strs[i]) != NULL)
+			abort();
+	}
+	for (i = 0; i < n; ++i) {
+		if (critbit_str_get(&st, strs[i]) != &strs[i])
+			abort();
+		memcpy(buf, strs[i], i % 200);
+		buf[i % 200] = '\0';
+		k = critbit_str_get(&st, buf);
+		if (i % 200 == 0 ? k != NULL : k != &strs[i - 1])
+			abort();
+	}
+	free(keys);
+	free(sorted);
+}
+
+struct lelement {
+	struct critbit_lstr k;
+};
+
+CRITBIT_HEAD_PROTOTYPE(ellstrtree);
+CRITBIT_GENERATE_STATIC(ellstrtree, lelement, lstr, k);
+
+/* length-aware keys sliced out of buffers with no terminators */
 static void
-test_contains(void)
+test_lstr(void)
 {
-	CRITBIT_HEAD(eltree) tree;
-	struct element *el;
-	struct critbit_node *nnode;
+	CRITBIT_HEAD(ellstrtree) tree;
+	struct critbit_cursor cursor;
+	struct critbit_lstr q;
+	struct lelement lel[8], *el;
+	char *buf, *qbuf;
 	int i;
 
-	CRITBIT_INIT(eltree, &tree, std_free, NULL);
+	static const struct { size_t off, len; } slices[8] = {
+		{ 0, 1 }, { 0, 2 }, { 1, 2 }, { 1, 3 },
+		{ 2, 1 }, { 2, 2 }, { 5, 3 }, { 4, 2 }
+	};
+
+	buf = malloc(8);
+	qbuf = malloc(8);
+	memcpy(buf, "aababbab", 8);
+	memcpy(qbuf, buf, 8);
+
+	CRITBIT_INIT_FLAGS(ellstrtree, &tree, std_free, NULL,
+	    CRITBIT_F_COUNT | CRITBIT_F_HASH);
+	for (i = 0; i < 8; ++i) {
+		el = &lel[i * 3 % 8];
+		el->k.cl_str = buf + slices[i * 3 % 8].off;
+		el->k.cl_len = slices[i * 3 % 8].len;
+		if (CRITBIT_INSERT(ellstrtree, &tree,
+		    malloc(CRITBIT_NODE_SIZE(&tree)), el) != NULL)
+			abort();
+	}
 
-	for (i = 0; elems[i]; ++i) {
-		el = el_alloc();
-		el->k = elems[i];
-		nnode = malloc(critbit_node_size());
-		CRITBIT_INSERT(eltree, &tree, nnode, el);
+	/* sorted as a, aa, ab, aba, b, ba, bab, bb */
+	i = 0;
+	CRITBIT_FOREACH(el, ellstrtree, &tree, &cursor) {
+		if (el != &lel[i++])
+			abort();
 	}
+	if (i != 8)
+		abort();
 
-	for (i = 0; elems[i]; ++i) {
-		el = CRITBIT_GET(eltree, &tree, elems[i]);
-		if (el == NULL)
+	for (i = 0; i < 8; ++i) {
+		q.cl_str = qbuf + slices[i].off;
+		q.cl_len = slices[i].len;
+		if (CRITBIT_GET(ellstrtree, &tree, &q) != &lel[i])
 			abort();
 	}
+	q.cl_str = qbuf + 3;
+	q.cl_len = 3;
+	if (CRITBIT_GET(ellstrtree, &tree, &q) != NULL)
+		abort();
+
+	q.cl_str = qbuf + 1;
+	q.cl_len = 3;
+	if (CRITBIT_PREFIX_COUNT(ellstrtree, &tree, &q, 2) != 2 ||
+	    CRITBIT_PREFIX_COUNT(ellstrtree, &tree, &q, 1) != 4)
+		abort();
+
+	q.cl_len = 2;
+	if (CRITBIT_REMOVE(ellstrtree, &tree, &q) != &lel[2])
+		abort();
+	if (CRITBIT_GET(ellstrtree, &tree, &q) != NULL ||
+	    CRITBIT_PREFIX_COUNT(ellstrtree, &tree, &q, 2) != 1)
+		abort();
+	q.cl_len = 3;
+	if (CRITBIT_GET(ellstrtree, &tree, &q) != &lel[3])
+		abort();
+
+	CRITBIT_DESTROY(ellstrtree, &tree, NULL, NULL);
+	free(buf);
+	free(qbuf);
 }
 
+/* nodes come from aligned slabs, are recycled and released in bulk */
 static void
-test_delete(void)
+test_node_pool(void)
 {
-	CRITBIT_HEAD(eltree) tree;
-	struct element *el;
-	struct critbit_node *nnode;
-	int i, j;
+	CRITBIT_HEAD(elinttree) tree;
+	struct critbit_node_pool pool;
+	struct critbit_node *first, *node;
+	struct element *xel;
+	char *next;
+	int i, n = 10000;
+
+	xel = malloc(sizeof(*xel) * n);
+	CRITBIT_INIT_FLAGS(elinttree, &tree, critbit_node_pool_free, &pool,
+	    CRITBIT_F_COUNT | CRITBIT_F_HASH);
+	critbit_node_pool_init(&pool, CRITBIT_NODE_SIZE(&tree));
+	first = critbit_node_pool_alloc(&pool);
+	if (((uintptr_t)first & (CRITBIT_CACHE_LINE - 1)) != 0)
+		abort();
+	critbit_node_pool_free(&pool, first);
+	for (i = 0; i < n; ++i) {
+		xel[i].kint = (int64_t)i * 2654435761LL;
+		node = critbit_node_pool_alloc(&pool);
+		if (node == NULL || (i == 0 && node != first))
+			abort();
+		if (CRITBIT_INSERT(elinttree, &tree, node, &xel[i]) != NULL)
+			abort();
+	}
 
-	CRITBIT_INIT(eltree, &tree, std_free, NULL);
+	/* removed nodes are reused before new ones are carved */
+	for (i = 0; i < n; i += 2) {
+		if (CRITBIT_REMOVE(elinttree, &tree, xel[i].kint) != &xel[i])
+			abort();
+	}
+	if (critbit_count(&tree.treehead) != n / 2)
+		abort();
+	next = pool.cp_next;
+	for (i = 0; i < n; i += 2) {
+		if (CRITBIT_INSERT(elinttree, &tree,
+		    critbit_node_pool_alloc(&pool), &xel[i]) != NULL)
+			abort();
+	}
+	if (pool.cp_next != next || pool.cp_free != NULL)
+		abort();
+	if (critbit_count(&tree.treehead) != n)
+		abort();
+	for (i = 0; i < n; ++i) {
+		if (CRITBIT_GET(elinttree, &tree, xel[i].kint) != &xel[i])
+			abort();
+	}
 
-	for (i = 1; elems[i]; ++i) {
+	/* reset hands out the first slab again */
+	critbit_node_pool_reset(&pool);
+	CRITBIT_INIT_FLAGS(elinttree, &tree, critbit_node_pool_free, &pool,
+	    CRITBIT_F_COUNT | CRITBIT_F_HASH);
+	if (critbit_node_pool_alloc(&pool) != first)
+		abort();
+	critbit_node_pool_destroy(&pool);
+	free(xel);
+}
 
-		for (j = 0; j < i; ++j) {
-			el = el_alloc();
-			el->k = elems[j];
-			nnode = malloc(critbit_node_size());
-			el = CRITBIT_INSERT(eltree, &tree, nnode, el);
-			if (el != NULL)
+static int
+entry_diff(void *arg __unused, void *akey __unused, void *bkey __unused)
+{
+	abort();
+	return (0);
+}
+
+static struct entel *
+entry_merge(void *arg __unused, struct entel *a __unused,
+    struct entel *b __unused)
+{
+	abort();
+	return (NULL);
+}
+
+/* intrusive tree against a tree with allocated nodes */
+static void
+test_entry(void)
+{
+	CRITBIT_HEAD(enttree) tree, left, right;
+	CRITBIT_HEAD(elinttree) ref;
+	struct critbit_cursor cursor, rcursor;
+	struct critbit_slot slot;
+	struct entel *ents, *alt, **cur, *e;
+	struct element *xel, *el;
+	char *in;
+	int i, j, n = 512;
+
+	ents = malloc(sizeof(*ents) * n);
+	alt = malloc(sizeof(*alt) * n);
+	cur = malloc(sizeof(*cur) * n);
+	xel = malloc(sizeof(*xel) * n);
+	in = calloc(n, 1);
+	CRITBIT_INIT_ENTRY(enttree, &tree, CRITBIT_F_COUNT | CRITBIT_F_HASH);
+	CRITBIT_INIT_FLAGS(elinttree, &ref, std_free, NULL,
+	    CRITBIT_F_COUNT | CRITBIT_F_HASH);
+	for (j = 0; j < n; ++j) {
+		ents[j].k = alt[j].k = xel[j].kint = (int64_t)j * 7919 - 1000000;
+		cur[j] = &ents[j];
+	}
+
+	/* insert, remove either way, replace by a copy in the other array */
+	for (i = 0; i < 30000; ++i) {
+		j = hashint(i) % n;
+		if (in[j] && i % 3 == 0) {
+			e = cur[j] == &ents[j] ? &alt[j] : &ents[j];
+			if (CRITBIT_REPLACE_ENTRY(enttree, &tree, e) != cur[j])
 				abort();
+			/* a node left behind would be clobbered */
+			memset(&cur[j]->link, 0xa5, sizeof(cur[j]->link));
+			cur[j] = e;
+			continue;
 		}
-		for (j = 0; j < i; ++j) {
-			if (CRITBIT_GET(eltree, &tree, elems[j]) == NULL)
+		if (in[j]) {
+			if ((i & 1 ? CRITBIT_REMOVE(enttree, &tree, cur[j]->k) :
+			    CRITBIT_REMOVE_ENTRY(enttree, &tree, cur[j]->k)) !=
+			    cur[j])
+				abort();
+			memset(&cur[j]->link, 0xa5, sizeof(cur[j]->link));
+			if (CRITBIT_REMOVE(elinttree, &ref,
+			    xel[j].kint) != &xel[j])
+				abort();
+		} else {
+			if (CRITBIT_INSERT_ENTRY(enttree, &tree,
+			    cur[j]) != NULL)
+				abort();
+			if (CRITBIT_INSERT(elinttree, &ref,
+			    malloc(CRITBIT_NODE_SIZE(&ref)), &xel[j]) != NULL)
 				abort();
 		}
-		for (j = 0; j < i; ++j) {
-			el = CRITBIT_REMOVE(eltree, &tree, elems[j]);
-			if (el == NULL)
+		in[j] = !in[j];
+		if (i % 1000 != 999)
+			continue;
+		if (critbit_count(&tree.treehead) !=
+		    critbit_count(&ref.treehead))
+			abort();
+		critbit_int_diff(&tree.treehead, &ref.treehead, entry_diff,
+		    NULL);
+		el = CRITBIT_FIRST(elinttree, &ref, &rcursor);
+		CRITBIT_FOREACH(e, enttree, &tree, &cursor) {
+			if (el == NULL || e->k != el->kint ||
+			    e != cur[(e->k + 1000000) / 7919])
 				abort();
-			free(el);
+			el = CRITBIT_NEXT(elinttree, &rcursor);
 		}
-		for (j = 0; j < i; ++j) {
-			if (CRITBIT_GET(eltree, &tree, elems[j]) != NULL)
+		if (el != NULL)
+			abort();
+	}
+
+	/* inserting a present key leaves the new element's node unused */
+	for (j = 0; j < n && !in[j]; ++j)
+		;
+	e = malloc(sizeof(*e));
+	e->k = cur[j]->k;
+	if (CRITBIT_INSERT_ENTRY(enttree, &tree, e) != cur[j])
+		abort();
+	free(e);
+	if (CRITBIT_GET(enttree, &tree, cur[j]->k) != cur[j])
+		abort();
+
+	/* restructuring calls are refused, the trees stay as they were */
+	if (CRITBIT_BULK_LOAD(enttree, &tree, NULL, 0, NULL) != EINVAL)
+		abort();
+	e = malloc(sizeof(*e));
+	e->k = 1LL << 40;
+	critbit_cursor_init(&cursor);
+	if (CRITBIT_INSERT_FINGER(enttree, &tree, &cursor, NULL, e) != e ||
+	    CRITBIT_FIND_OR_PREPARE(enttree, &tree, e->k, &slot) != NULL)
+		abort();
+	CRITBIT_COMMIT(enttree, &slot, NULL, e);
+	CRITBIT_INIT_ENTRY(enttree, &left, CRITBIT_F_COUNT | CRITBIT_F_HASH);
+	CRITBIT_INIT_ENTRY(enttree, &right, CRITBIT_F_COUNT | CRITBIT_F_HASH);
+	if (CRITBIT_INSERT_ENTRY(enttree, &left, e) != NULL)
+		abort();
+	CRITBIT_MERGE(enttree, &tree, &left, NULL, entry_merge, NULL);
+	CRITBIT_DESTROY(enttree, &left, NULL, NULL);
+	CRITBIT_SPLIT(enttree, &tree, 0, &left, &right);
+	if (CRITBIT_GET(enttree, &tree, e->k) != NULL ||
+	    !critbit_empty(&left.treehead) ||
+	    !critbit_empty(&right.treehead) ||
+	    critbit_count(&tree.treehead) != critbit_count(&ref.treehead))
+		abort();
+	free(e);
+	critbit_int_diff(&tree.treehead, &ref.treehead, entry_diff, NULL);
+
+	CRITBIT_DESTROY(enttree, &tree, NULL, NULL);
+	CRITBIT_DESTROY(elinttree, &ref, NULL, NULL);
+	free(ents);
+	free(alt);
+	free(cur);
+	free(xel);
+	free(in);
+}
+
+struct ctree_walk {
+	int64_t last;
+	size_t n;
+};
+
+static int
+ctree_walk_cb(void *arg, void *key)
+{
+	struct ctree_walk *w = arg;
+	int64_t k = *(int64_t *)key;
+
+	if (w->n++ > 0 && k <= w->last)
+		abort();
+	w->last = k;
+	return (0);
+}
+
+/* compact tree against a presence map, then string keys */
+static void
+test_ctree(void)
+{
+	struct critbit_ctree t;
+	struct ctree_walk w;
+	int64_t *keys;
+	const char **strs;
+	void *k;
+	char *in;
+	int i, j, n = 1024;
+	size_t cnt = 0;
+
+	if (critbit_ctree_node_size() != 12)
+		abort();
+	keys = malloc(sizeof(*keys) * n);
+	in = calloc(n, 1);
+	critbit_ctree_init(&t, sizeof(int64_t));
+	for (j = 0; j < n; ++j)
+		keys[j] = (int64_t)(j - n / 2) * 1000003;
+	for (i = 0; i < 50000; ++i) {
+		j = hashint(i) % n;
+		if (in[j]) {
+			if (critbit_int_cremove(&t, &keys[j]) != &keys[j])
+				abort();
+			cnt--;
+		} else {
+			if (critbit_int_cinsert(&t, &keys[j], NULL) != 0)
+				abort();
+			cnt++;
+		}
+		in[j] = !in[j];
+		if (critbit_ctree_count(&t) != cnt)
+			abort();
+		if (i % 1000 != 999)
+			continue;
+		for (j = 0; j < n; ++j) {
+			k = critbit_int_cget(&t, &keys[j]);
+			if (k != (in[j] ? &keys[j] : NULL))
 				abort();
 		}
+		memset(&w, 0, sizeof(w));
+		critbit_ctree_foreach(&t, ctree_walk_cb, &w);
+		if (w.n != cnt)
+			abort();
+	}
+	for (j = 0; j < n && !in[j]; ++j)
+		;
+	k = NULL;
+	if (critbit_int_cinsert(&t, &keys[j], &k) != EEXIST || k != &keys[j])
+		abort();
+	critbit_ctree_destroy(&t);
+
+	/* a duplicate into a full tree doesn't grow it */
+	critbit_ctree_init(&t, sizeof(int64_t));
+	for (j = 0; j < 16; ++j) {
+		if (critbit_int_cinsert(&t, &keys[j], NULL) != 0)
+			abort();
+	}
+	if (t.cx_size != 16 ||
+	    critbit_int_cinsert(&t, &keys[3], NULL) != EEXIST ||
+	    t.cx_size != 16)
+		abort();
+	critbit_ctree_destroy(&t);
+
+	/* strings, some being prefixes of others */
+	strs = malloc(sizeof(*strs) * 8);
+	critbit_ctree_init(&t, 0);
+	for (i = 0; elems[i] != NULL; ++i) {
+		strs[i] = elems[i];
+		if (critbit_str_cinsert(&t, &strs[i], NULL) != 0)
+			abort();
+	}
+	for (i = 0; elems[i] != NULL; ++i) {
+		if (critbit_str_cget(&t, elems[i]) != &strs[i])
+			abort();
+	}
+	if (critbit_str_cget(&t, "abab") != NULL ||
+	    critbit_str_cremove(&t, "ab") != &strs[4] ||
+	    critbit_str_cget(&t, "ab") != NULL ||
+	    critbit_str_cget(&t, "aba") != &strs[6])
+		abort();
+	critbit_ctree_destroy(&t);
+	free(strs);
+	free(keys);
+	free(in);
+}
+
+/* frozen copy answers like the tree and lists keys in order */
+static void
+test_freeze(void)
+{
+	CRITBIT_HEAD(elinttree) tree;
+	CRITBIT_HEAD(eltree) stree;
+	struct critbit_frozen f;
+	struct critbit_cursor cursor;
+	struct element *xel, *el;
+	int64_t miss;
+	size_t i;
+	int j, n = 5000;
+
+	CRITBIT_INIT(elinttree, &tree, std_free, NULL);
+	if (critbit_freeze(&tree.treehead, &f) != 0 ||
+	    critbit_frozen_count(&f) != 0 ||
+	    critbit_int_fget(&f, &miss) != NULL)
+		abort();
+	critbit_frozen_free(&f);
+
+	xel = malloc(sizeof(*xel) * n);
+	for (j = 0; j < n; ++j) {
+		xel[j].kint = (int64_t)hashint(j) * 2 - 0x80000000LL;
+		if (CRITBIT_INSERT(elinttree, &tree,
+		    malloc(critbit_node_size()), &xel[j]) != NULL)
+			abort();
+	}
+	if (critbit_freeze(&tree.treehead, &f) != 0 ||
+	    critbit_frozen_count(&f) != (size_t)n ||
+	    ((uintptr_t)f.cf_base & (CRITBIT_CACHE_LINE - 1)) != 0)
+		abort();
+	for (j = 0; j < n; ++j) {
+		if (critbit_int_fget(&f, &xel[j].kint) != &xel[j].kint)
+			abort();
+		miss = xel[j].kint + 1;
+		if (critbit_int_fget(&f, &miss) !=
+		    critbit_int_get(&tree.treehead, &miss))
+			abort();
+	}
+	i = 0;
+	CRITBIT_FOREACH(el, elinttree, &tree, &cursor) {
+		if (critbit_frozen_key(&f, i++) != &el->kint)
+			abort();
+	}
+	if (critbit_frozen_key(&f, i) != NULL)
+		abort();
+	critbit_frozen_free(&f);
+	CRITBIT_DESTROY(elinttree, &tree, NULL, NULL);
+	free(xel);
+
+	CRITBIT_INIT(eltree, &stree, std_free, NULL);
+	for (j = 0; elems[j] != NULL; ++j) {
+		el = el_alloc();
+		el->k = elems[j];
+		CRITBIT_INSERT(eltree, &stree, malloc(critbit_node_size()), el);
+	}
+	if (critbit_freeze(&stree.treehead, &f) != 0)
+		abort();
+	for (j = 0; elems[j] != NULL; ++j) {
+		el = CRITBIT_GET(eltree, &stree, elems[j]);
+		if (critbit_str_fget(&f, elems[j]) != &el->k)
+			abort();
+	}
+	if (critbit_str_fget(&f, "abab") != NULL ||
+	    critbit_str_fget(&f, "") != NULL)
+		abort();
+	critbit_frozen_free(&f);
+}
+
+struct mmap_walk {
+	const void *keys[16];
+	int n;
+};
+
+static int
+mmap_walk_cb(void *arg, void *key)
+{
+	struct mmap_walk *w = arg;
+
+	if (w->n == 16)
+		return (1);
+	w->keys[w->n++] = key;
+	return (0);
+}
+
+static int
+mmap_count_cb(void *arg, void *key __unused)
+{
+	(*(size_t *)arg)++;
+	return (0);
+}
+
+/* mapped tree answers like the tree it was written from */
+static void
+test_serialize(void)
+{
+	CRITBIT_HEAD(elinttree) tree;
+	CRITBIT_HEAD(eltree) stree;
+	struct critbit_mapped m;
+	struct critbit_cursor cursor;
+	struct mmap_walk w;
+	struct element *xel, *el;
+	char path[] = "/tmp/critbit-test.XXXXXX";
+	int64_t lo, hi;
+	size_t i, cnt;
+	uint32_t bad;
+	int fd, j, n = 3000;
+
+	xel = malloc(sizeof(*xel) * n);
+	CRITBIT_INIT_FLAGS(elinttree, &tree, std_free, NULL, CRITBIT_F_COUNT);
+	for (j = 0; j < n; ++j) {
+		xel[j].kint = (int64_t)hashint(j) - 0x80000000LL;
+		if (CRITBIT_INSERT(elinttree, &tree,
+		    malloc(CRITBIT_NODE_SIZE(&tree)), &xel[j]) != NULL)
+			abort();
+	}
+	fd = mkstemp(path);
+	if (fd < 0 || critbit_int_serialize(&tree.treehead, fd) != 0)
+		abort();
+	close(fd);
+	if (critbit_mmap_open(&m, path) != 0 ||
+	    critbit_mmap_count(&m) != (size_t)n)
+		abort();
+	unlink(path);
+
+	for (j = 0; j < n; ++j) {
+		if (memcmp(critbit_mmap_get(&m, &xel[j].kint, 8),
+		    &xel[j].kint, 8) != 0)
+			abort();
+		lo = xel[j].kint + 1;
+		if ((critbit_mmap_get(&m, &lo, 8) == NULL) !=
+		    (critbit_int_get(&tree.treehead, &lo) == NULL))
+			abort();
+	}
+	i = 0;
+	CRITBIT_FOREACH(el, elinttree, &tree, &cursor) {
+		if (memcmp(critbit_mmap_key(&m, i++), &el->kint, 8) != 0)
+			abort();
+	}
+
+	/* ranges between and around keys */
+	for (j = 0; j < 200; ++j) {
+		lo = xel[j].kint + (j % 3) - 1;
+		hi = lo + (int64_t)hashint(j + n) / 8;
+		cnt = 0;
+		critbit_mmap_range(&m, &lo, 8, &hi, 8, mmap_count_cb, &cnt);
+		if (cnt != critbit_int_count_range(&tree.treehead, &lo, &hi))
+			abort();
+	}
+	cnt = 0;
+	critbit_mmap_range(&m, NULL, 0, &lo, 8, mmap_count_cb, &cnt);
+	if (cnt != critbit_int_rank(&tree.treehead, &lo))
+		abort();
+	critbit_mmap_close(&m);
+	CRITBIT_DESTROY(elinttree, &tree, NULL, NULL);
+	free(xel);
+
+	/* strings come back NUL terminated, in order */
+	CRITBIT_INIT(eltree, &stree, std_free, NULL);
+	for (j = 0; elems[j] != NULL; ++j) {
+		el = el_alloc();
+		el->k = elems[j];
+		CRITBIT_INSERT(eltree, &stree, malloc(critbit_node_size()), el);
+	}
+	strcpy(path + strlen(path) - 6, "XXXXXX");
+	fd = mkstemp(path);
+	if (fd < 0 || critbit_str_serialize(&stree.treehead, fd) != 0)
+		abort();
+	close(fd);
+	if (critbit_mmap_open(&m, path) != 0)
+		abort();
+	unlink(path);
+	for (j = 0; elems[j] != NULL; ++j) {
+		if (strcmp(critbit_mmap_get(&m, elems[j], strlen(elems[j])),
+		    elems[j]) != 0)
+			abort();
+	}
+	if (critbit_mmap_get(&m, "abab", 4) != NULL ||
+	    critbit_mmap_get(&m, "ab", 1) == NULL)
+		abort();
+	memset(&w, 0, sizeof(w));
+	critbit_mmap_prefix(&m, "ab", 2, mmap_walk_cb, &w);
+	if (w.n != 2 || strcmp(w.keys[0], "ab") != 0 ||
+	    strcmp(w.keys[1], "aba") != 0)
+		abort();
+	memset(&w, 0, sizeof(w));
+	critbit_mmap_range(&m, "aa", 2, "b", 1, mmap_walk_cb, &w);
+	if (w.n != 3 || strcmp(w.keys[0], "aa") != 0 ||
+	    strcmp(w.keys[2], "aba") != 0)
+		abort();
+	memset(&w, 0, sizeof(w));
+	critbit_mmap_range(&m, "abb", 3, NULL, 0, mmap_walk_cb, &w);
+	if (w.n != 4 || strcmp(w.keys[0], "b") != 0)
+		abort();
+	critbit_mmap_close(&m);
+
+	/* damaged files are refused */
+	strcpy(path + strlen(path) - 6, "XXXXXX");
+	fd = mkstemp(path);
+	if (fd < 0 || critbit_str_serialize(&stree.treehead, fd) != 0 ||
+	    pread(fd, &lo, 8, 32) != 8 || pread(fd, &hi, 4, 64) != 4)
+		abort();
+	bad = 0xffffffff;
+	if (pwrite(fd, &bad, 4, 64) != 4 ||
+	    critbit_mmap_open(&m, path) != EINVAL ||
+	    pwrite(fd, &hi, 4, 64) != 4)
+		abort();
+	if (critbit_mmap_open(&m, path) != 0)
+		abort();
+	critbit_mmap_close(&m);
+	bad = 0x7fffffff;
+	if (pwrite(fd, &bad, 4, 64 + lo + 8) != 4 ||
+	    critbit_mmap_open(&m, path) != EINVAL)
+		abort();
+	close(fd);
+	unlink(path);
+}
+
+static int
+snapshot_reloc(void *arg, struct element *el)
+{
+	size_t *n = arg;
+
+	/* links of other containers are stale */
+	memset(&el->rbentry, 0, sizeof(el->rbentry));
+	el->pad = 1;
+	++*n;
+	return (0);
+}
+
+static void
+test_snapshot(void)
+{
+	CRITBIT_HEAD(elinttree) tree, copy;
+	struct critbit_node_pool pool;
+	struct critbit_cursor cursor, ccursor;
+	struct hash_diff hd;
+	struct element *xel, *rel, *el, *cel;
+	char path[] = "/tmp/critbit-test.XXXXXX";
+	size_t relocated = 0;
+	uint64_t nodesize, keylen;
+	uintptr_t child;
+	uint32_t byte, bad;
+	int fd, j, n = 3000;
+
+	xel = malloc(sizeof(*xel) * (n + 1));
+	CRITBIT_INIT_FLAGS(elinttree, &tree, std_free, NULL,
+	    CRITBIT_F_COUNT | CRITBIT_F_HASH);
+	for (j = 0; j < n; ++j) {
+		xel[j].kint = (int64_t)hashint(j) - 0x80000000LL;
+		xel[j].pad = 0;
+		if (CRITBIT_INSERT(elinttree, &tree,
+		    malloc(CRITBIT_NODE_SIZE(&tree)), &xel[j]) != NULL)
+			abort();
+	}
+	fd = mkstemp(path);
+	if (fd < 0 || CRITBIT_SNAPSHOT(elinttree, &tree, fd) != 0 ||
+	    lseek(fd, 0, SEEK_SET) != 0)
+		abort();
+	if (CRITBIT_RESTORE(elinttree, &copy, &pool, fd, &rel,
+	    snapshot_reloc, &relocated) != 0 || relocated != (size_t)n ||
+	    critbit_count(&copy.treehead) != (size_t)n)
+		abort();
+
+	/* same keys in the same order, hashes intact */
+	el = CRITBIT_FIRST(elinttree, &tree, &cursor);
+	CRITBIT_FOREACH(cel, elinttree, &copy, &ccursor) {
+		if (cel < rel || cel >= rel + n || cel->pad != 1 ||
+		    cel->kint != el->kint)
+			abort();
+		el = CRITBIT_NEXT(elinttree, &cursor);
+	}
+	if (el != NULL)
+		abort();
+	hd.n = 0;
+	if (CRITBIT_DIFF(elinttree, &tree, &copy, hash_diff_collect,
+	    &hd) != 0 || hd.n != 0)
+		abort();
+
+	/* restored tree is mutable, nodes come from the pool */
+	for (j = 0; j < n; j += 2) {
+		if (CRITBIT_REMOVE(elinttree, &copy, xel[j].kint) == NULL)
+			abort();
+	}
+	xel[n].kint = 1LL << 40;
+	if (CRITBIT_INSERT(elinttree, &copy, critbit_node_pool_alloc(&pool),
+	    &xel[n]) != NULL ||
+	    critbit_count(&copy.treehead) != (size_t)n / 2 + 1)
+		abort();
+	for (j = 0; j < n; ++j) {
+		el = CRITBIT_GET(elinttree, &copy, xel[j].kint);
+		if ((el == NULL) != (j % 2 == 0))
+			abort();
 	}
+	CRITBIT_DESTROY(elinttree, &copy, NULL, NULL);
+	critbit_node_pool_destroy(&pool);
+	free(rel);
+
+	/* element layout must match, truncated files are refused */
+	if (lseek(fd, 0, SEEK_SET) != 0 ||
+	    critbit_restore(&copy.treehead, &pool, fd, sizeof(*xel) + 8,
+	    offsetof(struct element, kint), 1, (void **)&rel, NULL, NULL) !=
+	    EINVAL || rel != NULL || !critbit_empty(&copy.treehead))
+		abort();
+	critbit_node_pool_destroy(&pool);
+
+	/* keys longer than the element, critical bytes past the key */
+	keylen = 4096;
+	if (pwrite(fd, &keylen, 8, 16) != 8 || lseek(fd, 0, SEEK_SET) != 0 ||
+	    CRITBIT_RESTORE(elinttree, &copy, &pool, fd, &rel, NULL,
+	    NULL) != EINVAL || rel != NULL || !critbit_empty(&copy.treehead))
+		abort();
+	critbit_node_pool_destroy(&pool);
+	keylen = 8;
+	if (pwrite(fd, &keylen, 8, 16) != 8 ||
+	    pread(fd, &nodesize, 8, 48) != 8 ||
+	    pread(fd, &byte, 4, 64 + nodesize + 2 * sizeof(child)) != 4)
+		abort();
+	bad = 8;
+	if (pwrite(fd, &bad, 4, 64 + nodesize + 2 * sizeof(child)) != 4 ||
+	    lseek(fd, 0, SEEK_SET) != 0 ||
+	    CRITBIT_RESTORE(elinttree, &copy, &pool, fd, &rel, NULL,
+	    NULL) != EINVAL || rel != NULL || !critbit_empty(&copy.treehead))
+		abort();
+	critbit_node_pool_destroy(&pool);
+	if (pwrite(fd, &byte, 4, 64 + nodesize + 2 * sizeof(child)) != 4 ||
+	    lseek(fd, 0, SEEK_SET) != 0 ||
+	    CRITBIT_RESTORE(elinttree, &copy, &pool, fd, &rel, NULL,
+	    NULL) != 0)
+		abort();
+	CRITBIT_DESTROY(elinttree, &copy, NULL, NULL);
+	critbit_node_pool_destroy(&pool);
+	free(rel);
+
+	/* a leaf shared by two nodes */
+	if (pread(fd, &child, sizeof(child), 64) != sizeof(child) ||
+	    pwrite(fd, &child, sizeof(child), 64 + nodesize) !=
+	    sizeof(child) || lseek(fd, 0, SEEK_SET) != 0 ||
+	    CRITBIT_RESTORE(elinttree, &copy, &pool, fd, &rel, NULL,
+	    NULL) != EINVAL || rel != NULL || !critbit_empty(&copy.treehead))
+		abort();
+	critbit_node_pool_destroy(&pool);
+	if (ftruncate(fd, 500) != 0 || lseek(fd, 0, SEEK_SET) != 0 ||
+	    CRITBIT_RESTORE(elinttree, &copy, &pool, fd, &rel, NULL,
+	    NULL) != EINVAL || rel != NULL || !critbit_empty(&copy.treehead))
+		abort();
+	critbit_node_pool_destroy(&pool);
+	close(fd);
+	unlink(path);
+
+	/* empty tree */
+	CRITBIT_DESTROY(elinttree, &tree, NULL, NULL);
+	strcpy(path + strlen(path) - 6, "XXXXXX");
+	fd = mkstemp(path);
+	if (fd < 0 || CRITBIT_SNAPSHOT(elinttree, &tree, fd) != 0 ||
+	    lseek(fd, 0, SEEK_SET) != 0 ||
+	    CRITBIT_RESTORE(elinttree, &copy, &pool, fd, &rel, NULL,
+	    NULL) != 0 || rel != NULL || !critbit_empty(&copy.treehead))
+		abort();
+	critbit_node_pool_destroy(&pool);
+	close(fd);
+	unlink(path);
+	free(xel);
 }
 
 const int loopcnt_init = 1000;
 const int loopcnt_int_init = 2000;
 
+/* keys of the large benchmarks, 24 bytes of nodes each */
+#ifndef BENCH_LARGE
+#define BENCH_LARGE		(1 << 23)
+#endif
+
+/* bare key so elements don't dominate memory of the large benchmarks */
+struct bigel {
+	int64_t k;
+};
+
+CRITBIT_HEAD_PROTOTYPE(bigtree);
+CRITBIT_GENERATE_STATIC(bigtree, bigel, int64, k);
+
 static void
 benchmark_result(const char *name, intmax_t n, struct timeval *tstart, struct timeval *tend)
 {
@@ -158,11 +2291,11 @@ static void
 test_benchmark_critbit_int(void)
 {
 	CRITBIT_HEAD(elinttree) tree;
+	struct critbit_node_pool pool;
 	struct element *el, *xel;
-	char *xnode, *xnode_saved;
-	int i, j, sz = critbit_node_size();
+	int i, j;
 
-	xnode_saved = xnode = malloc(sz * loopcnt_int_init);
+	critbit_node_pool_init(&pool, critbit_node_size());
 	xel = malloc(sizeof(*el) * loopcnt_int_init);
 
 	struct timeval tstart, tend;
@@ -170,15 +2303,14 @@ test_benchmark_critbit_int(void)
 
 	for (i = 1; i < loopcnt_int_init; ++i) {
 
-		CRITBIT_INIT(elinttree, &tree, no_free, NULL);
-		xnode = xnode_saved;
+		CRITBIT_INIT(elinttree, &tree, critbit_node_pool_free, &pool);
+		critbit_node_pool_reset(&pool);
 
 		for (j = 0; j < i; ++j) {
 			el = &xel[j];
 			el->kint = j;
 			el = CRITBIT_INSERT(elinttree, &tree,
-			    (struct critbit_node *)xnode, el);
-			xnode += sz;
+			    critbit_node_pool_alloc(&pool), el);
 			if (el != NULL)
 				abort();
 		}
@@ -197,18 +2329,138 @@ test_benchmark_critbit_int(void)
         gettimeofday(&tend, NULL);
 
 	benchmark_result("critbit int", loopcnt_int_init, &tstart, &tend);
+	critbit_node_pool_destroy(&pool);
 }
 
-static __inline uint32_t
-hashint(uintptr_t h)
+static void
+test_benchmark_critbit_int_finger(void)
 {
-	h = (~h) + (h << 18);
-	h = h ^ (h >> 31);
-	h = h * 21;
-	h = h ^ (h >> 11);
-	h = h + (h << 6);
-	h = h ^ (h >> 22);
-	return (h);
+	CRITBIT_HEAD(elinttree) tree;
+	struct critbit_cursor finger;
+	struct critbit_node_pool pool;
+	struct element *el, *xel;
+	int i, j;
+
+	critbit_node_pool_init(&pool, critbit_node_size());
+	xel = malloc(sizeof(*el) * loopcnt_int_init);
+
+	struct timeval tstart, tend;
+        gettimeofday(&tstart, NULL);
+
+	for (i = 1; i < loopcnt_int_init; ++i) {
+
+		CRITBIT_INIT(elinttree, &tree, critbit_node_pool_free, &pool);
+		critbit_node_pool_reset(&pool);
+		critbit_cursor_init(&finger);
+
+		for (j = 0; j < i; ++j) {
+			el = &xel[j];
+			el->kint = j;
+			el = CRITBIT_INSERT_FINGER(elinttree, &tree, &finger,
+			    critbit_node_pool_alloc(&pool), el);
+			if (el != NULL)
+				abort();
+		}
+	}
+
+        gettimeofday(&tend, NULL);
+
+	benchmark_result("critbit finger", loopcnt_int_init, &tstart, &tend);
+	critbit_node_pool_destroy(&pool);
+}
+
+/*
+ * Random inserts into a tree well past last level cache, 8M keys make
+ * 192MB of nodes.  Baseline is a lookup before each insert, which walks
+ * from the root twice like insert did before it spliced from its path.
+ */
+static void
+test_benchmark_critbit_int_large(void)
+{
+	CRITBIT_HEAD(bigtree) tree;
+	struct timeval tstart, tend;
+	struct bigel *xel;
+	struct critbit_node_pool pool;
+	int i, n;
+
+	n = BENCH_LARGE;
+	critbit_node_pool_init(&pool, critbit_node_size());
+	xel = malloc(sizeof(*xel) * n);
+	for (i = 0; i < n; ++i)
+		xel[i].k = (int64_t)(((uint64_t)hashint(i) << 32) |
+		    hashint(i + n));
+
+	CRITBIT_INIT(bigtree, &tree, critbit_node_pool_free, &pool);
+	gettimeofday(&tstart, NULL);
+	for (i = 0; i < n; ++i) {
+		if (CRITBIT_INSERT(bigtree, &tree,
+		    critbit_node_pool_alloc(&pool), &xel[i]) != NULL)
+			abort();
+	}
+	gettimeofday(&tend, NULL);
+	benchmark_result("critbit large", n, &tstart, &tend);
+
+	CRITBIT_INIT(bigtree, &tree, critbit_node_pool_free, &pool);
+	critbit_node_pool_reset(&pool);
+	gettimeofday(&tstart, NULL);
+	for (i = 0; i < n; ++i) {
+		if (CRITBIT_GET(bigtree, &tree, xel[i].k) != NULL ||
+		    CRITBIT_INSERT(bigtree, &tree,
+		    critbit_node_pool_alloc(&pool), &xel[i]) != NULL)
+			abort();
+	}
+	gettimeofday(&tend, NULL);
+	benchmark_result("critbit 2-walk", n, &tstart, &tend);
+
+	critbit_node_pool_destroy(&pool);
+	free(xel);
+}
+
+/* lookups in a tree larger than last level cache, pointer vs frozen */
+static void
+test_benchmark_critbit_frozen(void)
+{
+	CRITBIT_HEAD(elinttree) tree;
+	struct critbit_node_pool pool;
+	struct critbit_frozen f;
+	struct timeval tstart, tend;
+	struct element *xel;
+	int i, n;
+
+	n = 1 << 20;
+	critbit_node_pool_init(&pool, critbit_node_size());
+	xel = malloc(sizeof(*xel) * n);
+	CRITBIT_INIT(elinttree, &tree, critbit_node_pool_free, &pool);
+	for (i = 0; i < n; ++i) {
+		xel[i].kint = (int64_t)(((uint64_t)hashint(i) << 32) |
+		    hashint(i + n));
+		if (CRITBIT_INSERT(elinttree, &tree,
+		    critbit_node_pool_alloc(&pool), &xel[i]) != NULL)
+			abort();
+	}
+	if (critbit_freeze(&tree.treehead, &f) != 0)
+		abort();
+
+	gettimeofday(&tstart, NULL);
+	for (i = 0; i < n; ++i) {
+		if (CRITBIT_GET(elinttree, &tree,
+		    xel[hashint(i) % n].kint) == NULL)
+			abort();
+	}
+	gettimeofday(&tend, NULL);
+	benchmark_result("critbit get", n, &tstart, &tend);
+
+	gettimeofday(&tstart, NULL);
+	for (i = 0; i < n; ++i) {
+		if (critbit_int_fget(&f, &xel[hashint(i) % n].kint) == NULL)
+			abort();
+	}
+	gettimeofday(&tend, NULL);
+	benchmark_result("critbit frozen", n, &tstart, &tend);
+
+	critbit_frozen_free(&f);
+	critbit_node_pool_destroy(&pool);
+	free(xel);
 }
 
 static void
@@ -346,6 +2598,44 @@ test_benchmark_nrbtree_int(void)
 	benchmark_result("nrbtree int", loopcnt_int_init, &tstart, &tend);
 }
 
+/*
+ * String inserts of keys that differ early and share a long tail, the
+ * case where scanning whole keys to find their length would show.
+ */
+static void
+test_benchmark_critbit_str_insert(void)
+{
+	CRITBIT_HEAD(eltree) tree;
+	struct critbit_node_pool pool;
+	struct timeval tstart, tend;
+	struct element *xel;
+	char *keys, *k;
+	int i, n = 1 << 17;
+
+	critbit_node_pool_init(&pool, critbit_node_size());
+	xel = malloc(sizeof(*xel) * n);
+	keys = malloc((size_t)n * 256);
+	for (i = 0; i < n; ++i) {
+		k = keys + (size_t)i * 256;
+		snprintf(k, 256, "%08x", (unsigned int)hashint(i));
+		memset(k + 8, 'x', 247);
+		k[255] = '\0';
+		xel[i].k = k;
+	}
+
+	CRITBIT_INIT(eltree, &tree, critbit_node_pool_free, &pool);
+	gettimeofday(&tstart, NULL);
+	for (i = 0; i < n; ++i)
+		CRITBIT_INSERT(eltree, &tree, critbit_node_pool_alloc(&pool),
+		    &xel[i]);
+	gettimeofday(&tend, NULL);
+	benchmark_result("critbit str insert", n, &tstart, &tend);
+
+	critbit_node_pool_destroy(&pool);
+	free(keys);
+	free(xel);
+}
+
 static void
 test_benchmark_critbit(void)
 {
@@ -463,61 +2753,124 @@ again:
 	benchmark_result("rbtree", loopcnt_init, &tstart, &tend);
 }
 
-#if 0
+struct prefix_result {
+	int cnt;
+	int limit;
+	const char *seen[16];
+};
+
 static int
-allprefixed_cb(const char *elem, void *arg) {
-  set<string> *a = (set<string> *) arg;
-  a->insert(elem);
+prefix_cb(void *arg, struct element *el)
+{
+	struct prefix_result *r = arg;
 
-  return 1;
+	if (r->cnt >= r->limit)
+		return (1);
+	r->seen[r->cnt++] = el->k;
+	return (0);
 }
 
 static void
-test_allprefixed() {
-  critbit0_tree tree = {0};
-
-  static const char *elems[] = {"a", "aa", "aaz", "abz", "bba", "bbc", "bbd", NULL};
+test_prefix(void)
+{
+	CRITBIT_HEAD(eltree) tree;
+	struct prefix_result r;
+	struct element *el;
+	int i;
 
-  for (unsigned i = 0; elems[i]; ++i) critbit0_insert(&tree, elems[i]);
+	static const char *elems[] = {
+		"a", "aa", "aaz", "abz", "bba", "bbc", "bbd", NULL
+	};
 
-  set<string> a;
+	CRITBIT_INIT(eltree, &tree, std_free, NULL);
 
-  critbit0_allprefixed(&tree, "a", allprefixed_cb, &a);
-  if (a.size() != 4 ||
-      a.find("a") == a.end() ||
-      a.find("aa") == a.end() ||
-      a.find("aaz") == a.end() ||
-      a.find("abz") == a.end()) {
-    abort();
-  }
-  a.clear();
+	memset(&r, 0, sizeof(r));
+	r.limit = 16;
+	if (CRITBIT_PREFIX(eltree, &tree, "a", 1, prefix_cb, &r) != 0 ||
+	    r.cnt != 0)
+		abort();
 
-  critbit0_allprefixed(&tree, "aa", allprefixed_cb, &a);
-  if (a.size() != 2 ||
-      a.find("aa") == a.end() ||
-      a.find("aaz") == a.end()) {
-    abort();
-  }
-  a.clear();
+	for (i = 0; elems[i]; ++i) {
+		el = el_alloc();
+		el->k = elems[i];
+		CRITBIT_INSERT(eltree, &tree, malloc(critbit_node_size()), el);
+	}
 
-  critbit0_clear(&tree);
+	memset(&r, 0, sizeof(r));
+	r.limit = 16;
+	if (CRITBIT_PREFIX(eltree, &tree, "a", 1, prefix_cb, &r) != 0)
+		abort();
+	if (r.cnt != 4 || strcmp(r.seen[0], "a") != 0 ||
+	    strcmp(r.seen[1], "aa") != 0 || strcmp(r.seen[2], "aaz") != 0 ||
+	    strcmp(r.seen[3], "abz") != 0)
+		abort();
+
+	memset(&r, 0, sizeof(r));
+	r.limit = 16;
+	CRITBIT_PREFIX(eltree, &tree, "aa", 2, prefix_cb, &r);
+	if (r.cnt != 2 || strcmp(r.seen[0], "aa") != 0 ||
+	    strcmp(r.seen[1], "aaz") != 0)
+		abort();
+
+	memset(&r, 0, sizeof(r));
+	r.limit = 16;
+	CRITBIT_PREFIX(eltree, &tree, "bbcx", 4, prefix_cb, &r);
+	CRITBIT_PREFIX(eltree, &tree, "c", 1, prefix_cb, &r);
+	CRITBIT_PREFIX(eltree, &tree, "aaza", 4, prefix_cb, &r);
+	if (r.cnt != 0)
+		abort();
+
+	CRITBIT_PREFIX(eltree, &tree, "", 0, prefix_cb, &r);
+	if (r.cnt != 7)
+		abort();
+
+	/* early exit */
+	memset(&r, 0, sizeof(r));
+	r.limit = 2;
+	if (CRITBIT_PREFIX(eltree, &tree, "b", 1, prefix_cb, &r) != 1 ||
+	    r.cnt != 2 || strcmp(r.seen[1], "bbc") != 0)
+		abort();
 }
-#endif
 
 int
 main(void)
 {
 	test_contains();
 	test_delete();
+	test_iterate();
+	test_seek();
+	test_range();
+	test_destroy();
+	test_rank();
+	test_prefix_count();
+	test_bulk_load();
+	test_get_batch();
+	test_insert_finger();
+	test_merge();
+	test_setop();
+	test_split_join();
+	test_hash_diff();
+	test_replace();
+	test_prepare_commit();
+	test_long_keys();
+	test_lstr();
+	test_node_pool();
+	test_entry();
+	test_ctree();
+	test_freeze();
+	test_serialize();
+	test_snapshot();
+	test_prefix();
 	test_benchmark_critbit_int();
+	test_benchmark_critbit_int_finger();
+	test_benchmark_critbit_int_large();
+	test_benchmark_critbit_frozen();
 	test_benchmark_critbit_hash_int();
 	test_benchmark_rbtree_int();
 	test_benchmark_nrbtree_int();
+	test_benchmark_critbit_str_insert();
 	test_benchmark_critbit();
 	test_benchmark_rbtree();
-#if 0
-	// test_allprefixed();
-#endif
 
 	return 0;
 }
@@ -4,6 +4,8 @@
  */
 
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <assert.h>
 
@@ -11,38 +13,99 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "critbit.h"
 
+#if defined(__GNUC__) && defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #ifdef CRITBIT_DEBUG
 #define CRITBIT_ASSERT(a)		assert(a)
 #else
 #define CRITBIT_ASSERT(a)		(void)0
 #endif
 
+/* integer keys and the mismatch kernel depend on host byte order */
+#if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__)
+#define CRITBIT_LITTLE_ENDIAN	(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#elif defined(BYTE_ORDER) && defined(LITTLE_ENDIAN)
+#define CRITBIT_LITTLE_ENDIAN	(BYTE_ORDER == LITTLE_ENDIAN)
+#else
+#error "cannot determine host byte order"
+#endif
+
+#ifdef __GNUC__
+#define CRITBIT_PREFETCH(a)		__builtin_prefetch(a)
+#else
+#define CRITBIT_PREFETCH(a)		(void)0
+#endif
+
 struct critbit_node {
 	struct critbit_ref *child[2];
 	uint32_t	byte;
 	uint8_t		otherbits;
 };
 
-typedef size_t critbit_keylen_t(const uint8_t *a);
+typedef size_t critbit_keylen_t(struct critbit_tree *t, const uint8_t *a);
 
 typedef const uint8_t *critbit_keybuf_t(const struct critbit_key *key);
 
+typedef uint8_t critbit_keybyte_t(const uint8_t *a, size_t i, size_t alen);
+
 typedef int critbit_keycmp_t(const uint8_t *a, const uint8_t *b, size_t blen);
 
+typedef int critbit_keydiff_t(const uint8_t *a, const uint8_t *b, size_t blen,
+    uint32_t *byte, uint8_t *bits);
+
 size_t
 critbit_node_size(void)
 {
 	return (sizeof(struct critbit_node));
 }
 
+/*
+ * Nodes of trees with CRITBIT_F_COUNT carry number of keys in the subtree
+ * right after struct critbit_node, CRITBIT_F_HASH adds subtree hash after
+ * that.
+ */
+static __inline size_t
+critbit_node_hash_offset(struct critbit_tree *t)
+{
+	size_t off = sizeof(struct critbit_node);
+
+	if (t->ct_flags & CRITBIT_F_COUNT)
+		off += sizeof(size_t);
+	return ((off + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1));
+}
+
+size_t
+critbit_tree_node_size(struct critbit_tree *t)
+{
+	size_t sz = sizeof(struct critbit_node);
+
+	if (t->ct_flags & CRITBIT_F_COUNT)
+		sz += sizeof(size_t);
+	if (t->ct_flags & CRITBIT_F_HASH)
+		sz = critbit_node_hash_offset(t) + sizeof(uint64_t);
+	return (sz);
+}
+
+/* embedded entries must hold the largest node */
+typedef char critbit_entry_fits[sizeof(struct critbit_entry) >=
+    ((sizeof(struct critbit_node) + sizeof(size_t) + sizeof(uint64_t) - 1) &
+    ~(sizeof(uint64_t) - 1)) + sizeof(uint64_t) ? 1 : -1];
+
+/* intrusive trees have no nfree, their nodes belong to elements */
 static __inline void
 critbit_node_free(struct critbit_tree *t, struct critbit_node *node)
 {
-	CRITBIT_ASSERT(t->ct_node_free != NULL);
-	t->ct_node_free(t, node);
+	if (t->ct_node_free != NULL)
+		t->ct_node_free(t->ct_free_arg, node);
 }
 
 static __inline int
@@ -83,6 +146,114 @@ critbit_ref_get_key(struct critbit_ref *ref)
 	return (key);
 }
 
+static __inline size_t *
+critbit_node_count(struct critbit_node *node)
+{
+	return ((size_t *)(void *)(node + 1));
+}
+
+static __inline size_t
+critbit_ref_count(struct critbit_ref *ref)
+{
+	if (!critbit_ref_is_internal(ref))
+		return (1);
+	return (*critbit_node_count(critbit_ref_get_node(ref)));
+}
+
+static __inline uint64_t *
+critbit_node_hash(struct critbit_tree *t, struct critbit_node *node)
+{
+	return ((uint64_t *)(void *)((char *)node +
+	    critbit_node_hash_offset(t)));
+}
+
+/*
+ * Hash of a key, subtree hash is the sum of hashes of its keys, so it's
+ * kept up to date just like the count.  Bytes are hashed in tree order,
+ * so int keys hash the same regardless of host byte order.
+ */
+static __inline uint64_t
+critbit_key_hash(const uint8_t *k, size_t len, critbit_keybyte_t *keybyte)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for (i = 0; i < len; ++i) {
+		h ^= keybyte(k, i, len);
+		h *= 0x100000001b3ULL;
+	}
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return (h);
+}
+
+static __inline uint64_t
+critbit_ref_hash(struct critbit_tree *t, struct critbit_ref *ref,
+    critbit_keylen_t *keylenf, critbit_keybuf_t *keybuf,
+    critbit_keybyte_t *keybyte)
+{
+	const uint8_t *k;
+
+	if (critbit_ref_is_internal(ref))
+		return (*critbit_node_hash(t, critbit_ref_get_node(ref)));
+	k = keybuf(critbit_ref_get_key(ref));
+	return (critbit_key_hash(k, keylenf(t, k), keybyte));
+}
+
+/* recompute count and hash of node from its children */
+static __inline void
+critbit_node_update(struct critbit_tree *t, struct critbit_node *node,
+    critbit_keylen_t *keylenf, critbit_keybuf_t *keybuf,
+    critbit_keybyte_t *keybyte)
+{
+	if (t->ct_flags & CRITBIT_F_COUNT)
+		*critbit_node_count(node) = critbit_ref_count(node->child[0]) +
+		    critbit_ref_count(node->child[1]);
+	if (t->ct_flags & CRITBIT_F_HASH)
+		*critbit_node_hash(t, node) =
+		    critbit_ref_hash(t, node->child[0], keylenf, keybuf,
+		    keybyte) +
+		    critbit_ref_hash(t, node->child[1], keylenf, keybuf,
+		    keybyte);
+}
+
+/* position of critical bit, ordered from the most significant one */
+static __inline uint64_t
+critbit_ref_pos(struct critbit_ref *ref)
+{
+	struct critbit_node *node;
+
+	if (!critbit_ref_is_internal(ref))
+		return (UINT64_MAX);
+	node = critbit_ref_get_node(ref);
+	return (((uint64_t)node->byte << 8) | node->otherbits);
+}
+
+static __inline struct critbit_key *
+critbit_ref_leftmost(struct critbit_ref *ref)
+{
+	while (critbit_ref_is_internal(ref))
+		ref = critbit_ref_get_node(ref)->child[0];
+	return (critbit_ref_get_key(ref));
+}
+
+static __inline struct critbit_key *
+critbit_ref_rightmost(struct critbit_ref *ref)
+{
+	while (critbit_ref_is_internal(ref))
+		ref = critbit_ref_get_node(ref)->child[1];
+	return (critbit_ref_get_key(ref));
+}
+
+static __inline int
+critbit_node_direction(const struct critbit_node *node, uint8_t c)
+{
+	return ((1 + (node->otherbits | c)) >> 8);
+}
+
 static __inline const uint8_t *
 critbit_buf_keybuf(const struct critbit_key *key)
 {
@@ -95,6 +266,13 @@ critbit_str_keybuf(const struct critbit_key *key)
 	return (*(uint8_t **)(key));
 }
 
+/* length-aware strings are their own key buffer */
+static __inline const uint8_t *
+critbit_lstr_keybuf(const struct critbit_key *key)
+{
+	return ((const uint8_t *)(key));
+}
+
 static __inline size_t
 critbit_buf_keylen(struct critbit_tree *t, const uint8_t *a CRITBIT_UNUSED)
 {
@@ -107,6 +285,48 @@ critbit_str_keylen(struct critbit_tree *t CRITBIT_UNUSED, const uint8_t *a)
 	return (strlen((char *)a));
 }
 
+static __inline uint8_t
+critbit_buf_keybyte(const uint8_t *a, size_t i, size_t alen)
+{
+	return (i < alen ? a[i] : 0);
+}
+
+#define critbit_str_keybyte		critbit_buf_keybyte
+
+static __inline size_t
+critbit_lstr_keylen(struct critbit_tree *t CRITBIT_UNUSED, const uint8_t *a)
+{
+	return (((const struct critbit_lstr *)a)->cl_len);
+}
+
+static __inline uint8_t
+critbit_lstr_keybyte(const uint8_t *a, size_t i, size_t alen)
+{
+	const struct critbit_lstr *s = (const struct critbit_lstr *)a;
+
+	return (i < alen && i < s->cl_len ? (uint8_t)s->cl_str[i] : 0);
+}
+
+/*
+ * Integer keys are stored in host byte order.  Present them to the tree
+ * most significant byte first with the sign bit flipped, so that bitwise
+ * order of the tree matches numeric order of signed integers.
+ */
+static __inline uint8_t
+critbit_int_keybyte(const uint8_t *a, size_t i, size_t alen)
+{
+	uint8_t c;
+
+	if (i >= alen)
+		return (0);
+#if CRITBIT_LITTLE_ENDIAN
+	c = a[alen - 1 - i];
+#else
+	c = a[i];
+#endif
+	return (i == 0 ? c ^ 0x80 : c);
+}
+
 static __inline int
 critbit_buf_keycmp(const uint8_t *a, const uint8_t *b, size_t blen)
 {
@@ -126,24 +346,363 @@ critbit_str_keycmp(const uint8_t *a, const uint8_t *b, size_t blen)
 	return (memcmp(a, b, blen));
 }
 
+static __inline int
+critbit_lstr_keycmp(const uint8_t *a, const uint8_t *b,
+    size_t blen CRITBIT_UNUSED)
+{
+	const struct critbit_lstr *sa = (const struct critbit_lstr *)a;
+	const struct critbit_lstr *sb = (const struct critbit_lstr *)b;
+
+	if (sa->cl_len != sb->cl_len)
+		return (sa->cl_len < sb->cl_len ? -1 : 1);
+	return (memcmp(sa->cl_str, sb->cl_str, sa->cl_len));
+}
+
+/*
+ * Index of the first byte where a and b differ, or len.  Compares 32 or 16
+ * bytes at a time with AVX2 or SSE2, then 8 bytes at a time taking the
+ * first differing byte from trailing (leading on big endian) zeros of the
+ * xor, and finishes byte by byte.
+ */
+static __inline size_t
+critbit_mismatch(const uint8_t *a, const uint8_t *b, size_t len)
+{
+	size_t i = 0;
+
+#if defined(__GNUC__) && defined(__AVX2__)
+	for (; i + 32 <= len; i += 32) {
+		__m256i x, y;
+		uint32_t m;
+
+		x = _mm256_loadu_si256((const void *)(a + i));
+		y = _mm256_loadu_si256((const void *)(b + i));
+		m = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+		if (m != 0)
+			return (i + __builtin_ctz(m));
+	}
+#endif
+#if defined(__GNUC__) && (defined(__AVX2__) || defined(__SSE2__))
+	for (; i + 16 <= len; i += 16) {
+		__m128i x, y;
+		uint32_t m;
+
+		x = _mm_loadu_si128((const void *)(a + i));
+		y = _mm_loadu_si128((const void *)(b + i));
+		m = 0xffff ^ (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+		if (m != 0)
+			return (i + __builtin_ctz(m));
+	}
+#endif
+#ifdef __GNUC__
+	for (; i + 8 <= len; i += 8) {
+		uint64_t x, y;
+
+		memcpy(&x, a + i, 8);
+		memcpy(&y, b + i, 8);
+		x ^= y;
+		if (x != 0) {
+#if CRITBIT_LITTLE_ENDIAN
+			return (i + (__builtin_ctzll(x) >> 3));
+#else
+			return (i + (__builtin_clzll(x) >> 3));
+#endif
+		}
+	}
+#endif
+	for (; i < len; ++i) {
+		if (a[i] != b[i])
+			break;
+	}
+	return (i);
+}
+
+/*
+ * Find first byte (in tree order) where keys a and b differ.  Returns 0 if
+ * keys are equal, otherwise stores byte index and xor of differing bytes.
+ */
+static __inline int
+critbit_buf_keydiff(const uint8_t *a, const uint8_t *b, size_t blen,
+    uint32_t *byte, uint8_t *bits)
+{
+	size_t i;
+
+	i = critbit_mismatch(a, b, blen);
+	if (i == blen)
+		return (0);
+	*byte = i;
+	*bits = a[i] ^ b[i];
+	return (1);
+}
+
+/*
+ * Strings are compared byte by byte: the terminator of a shorter a differs
+ * from b, so the loop stops there, and neither key is read past its end
+ * or scanned twice.  Wide loads are left to keys of known length.
+ */
+static __inline int
+critbit_str_keydiff(const uint8_t *a, const uint8_t *b, size_t blen,
+    uint32_t *byte, uint8_t *bits)
+{
+	size_t i;
+
+	for (i = 0; i < blen; ++i) {
+		if (a[i] != b[i])
+			break;
+	}
+	if (i == blen && a[i] == 0)
+		return (0);
+	*byte = i;
+	*bits = a[i] ^ b[i];
+	return (1);
+}
+
+/*
+ * Length-aware strings never read past either length; the shorter key
+ * reads as zero beyond its end.
+ */
+static __inline int
+critbit_lstr_keydiff(const uint8_t *a, const uint8_t *b, size_t blen,
+    uint32_t *byte, uint8_t *bits)
+{
+	const struct critbit_lstr *sa = (const struct critbit_lstr *)a;
+	const struct critbit_lstr *sb = (const struct critbit_lstr *)b;
+	size_t i, n;
+
+	n = sa->cl_len < blen ? sa->cl_len : blen;
+	i = critbit_mismatch((const uint8_t *)sa->cl_str,
+	    (const uint8_t *)sb->cl_str, n);
+	if (i < n) {
+		*byte = i;
+		*bits = sa->cl_str[i] ^ sb->cl_str[i];
+		return (1);
+	}
+	if (sa->cl_len == blen)
+		return (0);
+	*byte = n;
+	*bits = n < blen ? sb->cl_str[n] : sa->cl_str[n];
+	return (1);
+}
+
+static __inline int
+critbit_int_keydiff(const uint8_t *a, const uint8_t *b, size_t blen,
+    uint32_t *byte, uint8_t *bits)
+{
+	size_t i;
+	uint8_t x;
+
+	for (i = 0; i < blen; ++i) {
+		x = critbit_int_keybyte(a, i, blen) ^
+		    critbit_int_keybyte(b, i, blen);
+		if (x != 0) {
+			*byte = i;
+			*bits = x;
+			return (1);
+		}
+	}
+	return (0);
+}
+
 void
 critbit_init(struct critbit_tree *t, critbit_node_free_t *nfree,
     void *freearg, size_t keylen)
+{
+	critbit_init_flags(t, nfree, freearg, keylen, 0);
+}
+
+void
+critbit_init_flags(struct critbit_tree *t, critbit_node_free_t *nfree,
+    void *freearg, size_t keylen, unsigned int flags)
 {
 	t->ct_root = NULL;
 	t->ct_keylen = keylen;
 	t->ct_node_free = nfree;
 	t->ct_free_arg = freearg;
+	t->ct_flags = flags;
+	t->ct_entryoff = 0;
+}
+
+void
+critbit_init_entry(struct critbit_tree *t, size_t keylen,
+    unsigned int flags, ptrdiff_t entryoff)
+{
+	critbit_init_flags(t, NULL, NULL, keylen, flags | CRITBIT_F_ENTRY);
+	t->ct_entryoff = entryoff;
+}
+
+int
+critbit_empty(struct critbit_tree *t)
+{
+	return (t->ct_root == NULL);
+}
+
+/*
+ * The node of an element may be on the path to any later leaf, so no
+ * element is freed before the tree is taken apart.  Done nodes are
+ * chained through child[0].  Each element owns one node but for the one
+ * left over, which is the xor of all keys and all owners.
+ */
+static void
+critbit_destroy_entry(struct critbit_tree *t, struct critbit_ref *ref,
+    critbit_node_free_t *efree, void *arg)
+{
+	struct critbit_node *node, *left, *done = NULL;
+	uintptr_t spare = 0;
+
+	while (critbit_ref_is_internal(ref)) {
+		node = critbit_ref_get_node(ref);
+		if (critbit_ref_is_internal(node->child[0])) {
+			left = critbit_ref_get_node(node->child[0]);
+			node->child[0] = left->child[1];
+			critbit_ref_set_node(&left->child[1], node);
+			critbit_ref_set_node(&ref, left);
+			continue;
+		}
+		spare ^= (uintptr_t)critbit_ref_get_key(node->child[0]) ^
+		    (uintptr_t)((char *)node - t->ct_entryoff);
+		ref = node->child[1];
+		node->child[0] = (struct critbit_ref *)(void *)done;
+		done = node;
+	}
+	spare ^= (uintptr_t)critbit_ref_get_key(ref);
+
+	while ((node = done) != NULL) {
+		done = (struct critbit_node *)(void *)node->child[0];
+		efree(arg, (char *)node - t->ct_entryoff);
+	}
+	efree(arg, (void *)spare);
+}
+
+/*
+ * Release all nodes in a single pass.  Left-leaning nodes are rotated
+ * right until the leftmost leaf hangs off the root, then the root is
+ * dropped.  Every rotation moves one node off the left spine for good, so
+ * the walk is linear and needs no stack.
+ */
+void
+critbit_destroy(struct critbit_tree *t, critbit_node_free_t *efree, void *arg)
+{
+	struct critbit_node *node, *left;
+	struct critbit_ref *ref;
+
+	ref = t->ct_root;
+	t->ct_root = NULL;
+	if (ref == NULL)
+		return;
+	if (t->ct_flags & CRITBIT_F_ENTRY) {
+		if (efree != NULL)
+			critbit_destroy_entry(t, ref, efree, arg);
+		return;
+	}
+
+	while (critbit_ref_is_internal(ref)) {
+		node = critbit_ref_get_node(ref);
+		if (critbit_ref_is_internal(node->child[0])) {
+			left = critbit_ref_get_node(node->child[0]);
+			node->child[0] = left->child[1];
+			critbit_ref_set_node(&left->child[1], node);
+			critbit_ref_set_node(&ref, left);
+			continue;
+		}
+		ref = node->child[1];
+		if (efree != NULL)
+			efree(arg, critbit_ref_get_key(node->child[0]));
+		critbit_node_free(t, node);
+	}
+
+	if (efree != NULL)
+		efree(arg, critbit_ref_get_key(ref));
+}
+
+/* slab header, padded to keep nodes off its cache line */
+struct critbit_slab {
+	struct critbit_slab	*sl_next;
+};
+
+void
+critbit_node_pool_init(struct critbit_node_pool *p, size_t nodesize)
+{
+	p->cp_slabs = p->cp_cur = NULL;
+	p->cp_free = NULL;
+	p->cp_next = NULL;
+	p->cp_left = 0;
+	/* free list links through the first word, hashes need 8 bytes */
+	p->cp_size = (nodesize + 7) & ~(size_t)7;
+	CRITBIT_ASSERT(p->cp_size <= CRITBIT_POOL_SLAB - CRITBIT_CACHE_LINE);
+}
+
+struct critbit_node *
+critbit_node_pool_alloc(struct critbit_node_pool *p)
+{
+	struct critbit_slab *slab;
+	void *node;
+
+	if (p->cp_free != NULL) {
+		node = p->cp_free;
+		p->cp_free = *(void **)node;
+		return (node);
+	}
+	if (p->cp_left < p->cp_size) {
+		slab = p->cp_cur == NULL ? p->cp_slabs : p->cp_cur->sl_next;
+		if (slab == NULL) {
+			if (posix_memalign(&node, CRITBIT_CACHE_LINE,
+			    CRITBIT_POOL_SLAB) != 0)
+				return (NULL);
+			slab = node;
+			slab->sl_next = NULL;
+			if (p->cp_cur == NULL)
+				p->cp_slabs = slab;
+			else
+				p->cp_cur->sl_next = slab;
+		}
+		p->cp_cur = slab;
+		p->cp_next = (char *)slab + CRITBIT_CACHE_LINE;
+		p->cp_left = CRITBIT_POOL_SLAB - CRITBIT_CACHE_LINE;
+	}
+	node = p->cp_next;
+	p->cp_next += p->cp_size;
+	p->cp_left -= p->cp_size;
+	return (node);
+}
+
+void
+critbit_node_pool_free(void *arg, void *node)
+{
+	struct critbit_node_pool *p = arg;
+
+	*(void **)node = p->cp_free;
+	p->cp_free = node;
+}
+
+/* slabs are kept and refilled from the first one */
+void
+critbit_node_pool_reset(struct critbit_node_pool *p)
+{
+	p->cp_cur = NULL;
+	p->cp_free = NULL;
+	p->cp_next = NULL;
+	p->cp_left = 0;
+}
+
+void
+critbit_node_pool_destroy(struct critbit_node_pool *p)
+{
+	struct critbit_slab *slab;
+
+	while ((slab = p->cp_slabs) != NULL) {
+		p->cp_slabs = slab->sl_next;
+		free(slab);
+	}
+	critbit_node_pool_reset(p);
 }
 
 static __inline struct critbit_key *
 critbit_get_impl(struct critbit_tree *t, const void *key, size_t keylen,
-    critbit_keycmp_t *keycmp, critbit_keybuf_t *keybuf)
+    critbit_keycmp_t *keycmp, critbit_keybuf_t *keybuf,
+    critbit_keybyte_t *keybyte)
 {
 	const uint8_t *ubytes = key;
 	struct critbit_node *node;
 	struct critbit_ref *ref;
-	uint8_t c;
 
 	ref = t->ct_root;
 	if (ref == NULL)
@@ -151,13 +710,8 @@ critbit_get_impl(struct critbit_tree *t, const void *key, size_t keylen,
 
 	while (critbit_ref_is_internal(ref)) {
 		node = critbit_ref_get_node(ref);
-
-		c = 0;
-		if (node->byte < keylen)
-			c = ubytes[node->byte];
-
-		const int direction = (1 + (node->otherbits | c)) >> 8;
-		ref = node->child[direction];
+		ref = node->child[critbit_node_direction(node,
+		    keybyte(ubytes, node->byte, keylen))];
 	}
 
 	if (keycmp(keybuf(critbit_ref_get_key(ref)), ubytes, keylen) == 0)
@@ -180,17 +734,54 @@ static __inline uint8_t ms1b8(uint8_t v) {
 #endif
 }
 
+/*
+ * Intrusive trees: the node embedded with a key may be in use on the
+ * path to it, above stop.  Move it to dst and relink it there.
+ */
+static __inline void
+critbit_entry_handoff(struct critbit_tree *t, const uint8_t *ubytes,
+    size_t keylen, struct critbit_node *own, struct critbit_node *dst,
+    struct critbit_ref **stop, critbit_keybyte_t *keybyte)
+{
+	struct critbit_ref **wherep = &t->ct_root;
+	struct critbit_node *node;
+
+	while (wherep != stop && critbit_ref_is_internal(*wherep)) {
+		node = critbit_ref_get_node(*wherep);
+		if (node == own) {
+			memcpy(dst, own, critbit_tree_node_size(t));
+			critbit_ref_set_node(wherep, dst);
+			return;
+		}
+		wherep = node->child + critbit_node_direction(node,
+		    keybyte(ubytes, node->byte, keylen));
+	}
+}
+
+/*
+ * Insert key, if equal key is already in the tree it's returned and,
+ * if replace is set, swapped for key in place.  Equal keys have equal
+ * hashes, so nothing above the leaf changes.  Descent records its path,
+ * new node is linked above the deepest node on it with a later critical
+ * bit.  Path holds the last CRITBIT_CURSOR_DEPTH references only, deeper
+ * trees are walked again from the root when it's not enough.
+ */
 static __inline struct critbit_key *
 critbit_insert_impl(struct critbit_tree *t, struct critbit_node *newnode,
-    const struct critbit_key *key, size_t keylen, critbit_keybuf_t *keybuf)
+    const struct critbit_key *key, int replace, size_t keylen,
+    critbit_keylen_t *keylenf, critbit_keybuf_t *keybuf,
+    critbit_keybyte_t *keybyte, critbit_keydiff_t *keydiff)
 {
 	const uint8_t *const ubytes = keybuf(key);
+	struct critbit_ref **path[CRITBIT_CURSOR_DEPTH];
+	struct critbit_ref **leafp, **wherep;
 	struct critbit_node *q;
+	struct critbit_key *old;
 	struct critbit_ref *p;
-	const uint8_t *pkey;
+	uint64_t h = 0;
 	uint32_t newbyte;
-	uint32_t newotherbits;
-	uint8_t c;
+	uint8_t newotherbits;
+	size_t depth, i;
 
 	p = t->ct_root;
 	if (p == NULL) {
@@ -199,92 +790,279 @@ critbit_insert_impl(struct critbit_tree *t, struct critbit_node *newnode,
 		return (NULL);
 	}
 
+	leafp = &t->ct_root;
+	depth = 0;
 	while (critbit_ref_is_internal(p)) {
+		path[depth++ % CRITBIT_CURSOR_DEPTH] = leafp;
 		q = critbit_ref_get_node(p);
+		leafp = &q->child[critbit_node_direction(q,
+		    keybyte(ubytes, q->byte, keylen))];
+		p = *leafp;
+	}
+
+	if (!keydiff(keybuf(critbit_ref_get_key(p)), ubytes, keylen,
+	    &newbyte, &newotherbits)) {
+		critbit_node_free(t, newnode);
+		old = critbit_ref_get_key(p);
+		if (!replace)
+			return (old);
+		critbit_ref_set_key(leafp, key);
+		if (t->ct_flags & CRITBIT_F_ENTRY)
+			critbit_entry_handoff(t, ubytes, keylen,
+			    (struct critbit_node *)(void *)
+			    ((char *)old + t->ct_entryoff),
+			    (struct critbit_node *)(void *)
+			    ((char *)key + t->ct_entryoff), NULL, keybyte);
+		return (old);
+	}
 
-		c = 0;
-		if (q->byte < keylen)
-			c = ubytes[q->byte];
+	if (t->ct_flags & CRITBIT_F_HASH)
+		h = critbit_key_hash(ubytes, keylen, keybyte);
+	newnode->byte = newbyte;
+	newnode->otherbits = ms1b8(newotherbits) ^ 255;
+	const int newdirection = critbit_node_direction(newnode,
+	    keybyte(ubytes, newbyte, keylen));
+	critbit_ref_set_key(&newnode->child[newdirection], key);
 
-		const int direction = (1 + (q->otherbits | c)) >> 8;
-		p = q->child[direction];
+	wherep = leafp;
+	for (i = depth; i > 0 && depth - i < CRITBIT_CURSOR_DEPTH; i--) {
+		q = critbit_ref_get_node(*path[(i - 1) % CRITBIT_CURSOR_DEPTH]);
+		if (q->byte < newbyte || (q->byte == newbyte &&
+		    q->otherbits < newnode->otherbits))
+			break;
+		wherep = path[(i - 1) % CRITBIT_CURSOR_DEPTH];
 	}
 
-	pkey = keybuf(critbit_ref_get_key(p));
-	for (newbyte = 0; newbyte < keylen; ++newbyte) {
-		if (pkey[newbyte] != ubytes[newbyte]) {
-			newotherbits = pkey[newbyte] ^ ubytes[newbyte];
-			goto different_byte_found;
+	if (depth - i == CRITBIT_CURSOR_DEPTH ||
+	    (depth > CRITBIT_CURSOR_DEPTH &&
+	    (t->ct_flags & (CRITBIT_F_COUNT | CRITBIT_F_HASH)))) {
+		wherep = &t->ct_root;
+		for (;;) {
+			p = *wherep;
+			if (!critbit_ref_is_internal(p))
+				break;
+			q = critbit_ref_get_node(p);
+			if (q->byte > newbyte)
+				break;
+			if (q->byte == newbyte &&
+			    q->otherbits > newnode->otherbits)
+				break;
+			if (t->ct_flags & CRITBIT_F_COUNT)
+				(*critbit_node_count(q))++;
+			if (t->ct_flags & CRITBIT_F_HASH)
+				*critbit_node_hash(t, q) += h;
+			wherep = q->child + critbit_node_direction(q,
+			    keybyte(ubytes, q->byte, keylen));
+		}
+	} else if (t->ct_flags & (CRITBIT_F_COUNT | CRITBIT_F_HASH)) {
+		while (i > 0) {
+			q = critbit_ref_get_node(*path[--i]);
+			if (t->ct_flags & CRITBIT_F_COUNT)
+				(*critbit_node_count(q))++;
+			if (t->ct_flags & CRITBIT_F_HASH)
+				*critbit_node_hash(t, q) += h;
 		}
 	}
 
-	if (pkey[newbyte] != 0) {
-		newotherbits = pkey[newbyte];
-		goto different_byte_found;
-	}
+	newnode->child[1 - newdirection] = *wherep;
+	if (t->ct_flags & CRITBIT_F_COUNT)
+		*critbit_node_count(newnode) = critbit_ref_count(*wherep) + 1;
+	if (t->ct_flags & CRITBIT_F_HASH)
+		*critbit_node_hash(t, newnode) = critbit_ref_hash(t, *wherep,
+		    keylenf, keybuf, keybyte) + h;
+	critbit_ref_set_node(wherep, newnode);
 
-	critbit_node_free(t, newnode);
-	return (critbit_ref_get_key(p));
-
-different_byte_found:
+	return (NULL);
+}
 
-	newotherbits = ms1b8(newotherbits) ^ 255;
-	const int newdirection = (1 + (newotherbits | pkey[newbyte])) >> 8;
+/*
+ * First half of insert: find key or the place where it would be linked.
+ * Returns the key found, or NULL with slot prepared for commit.  Like
+ * insert, the descent records its path in the slot and the place is
+ * picked from it, trees deeper than the ring are walked again.
+ */
+static __inline struct critbit_key *
+critbit_prepare_impl(struct critbit_tree *t, const void *key, size_t keylen,
+    struct critbit_slot *slot, critbit_keybuf_t *keybuf,
+    critbit_keybyte_t *keybyte, critbit_keydiff_t *keydiff)
+{
+	const uint8_t *ubytes = key;
+	struct critbit_ref **leafp, **wherep;
+	struct critbit_node *q;
+	struct critbit_ref *p;
+	uint32_t newbyte;
+	uint8_t newotherbits;
+	size_t depth, i;
 
-	newnode->byte = newbyte;
-	newnode->otherbits = newotherbits;
-	critbit_ref_set_key(&newnode->child[1 - newdirection], key);
+	slot->cs_tree = t;
+	slot->cs_where = &t->ct_root;
+	slot->cs_depth = 0;
+	slot->cs_empty = 1;
+	slot->cs_deep = 0;
+	p = t->ct_root;
+	if (p == NULL)
+		return (NULL);
 
-	struct critbit_ref **wherep = &t->ct_root;
-	for (;;) {
-		p = *wherep;
-		if (!critbit_ref_is_internal(p))
-			break;
+	leafp = &t->ct_root;
+	depth = 0;
+	while (critbit_ref_is_internal(p)) {
+		slot->cs_path[depth++ % CRITBIT_CURSOR_DEPTH] = leafp;
 		q = critbit_ref_get_node(p);
-		if (q->byte > newbyte)
-			break;
-		if (q->byte == newbyte && q->otherbits > newotherbits)
+		leafp = &q->child[critbit_node_direction(q,
+		    keybyte(ubytes, q->byte, keylen))];
+		p = *leafp;
+	}
+
+	if (!keydiff(keybuf(critbit_ref_get_key(p)), ubytes, keylen,
+	    &newbyte, &newotherbits))
+		return (critbit_ref_get_key(p));
+	newotherbits = ms1b8(newotherbits) ^ 255;
+
+	wherep = leafp;
+	for (i = depth; i > 0 && depth - i < CRITBIT_CURSOR_DEPTH; i--) {
+		q = critbit_ref_get_node(
+		    *slot->cs_path[(i - 1) % CRITBIT_CURSOR_DEPTH]);
+		if (q->byte < newbyte || (q->byte == newbyte &&
+		    q->otherbits < newotherbits))
 			break;
-		c = 0;
-		if (q->byte < keylen)
-			c = ubytes[q->byte];
-		const int direction = (1 + (q->otherbits | c)) >> 8;
-		wherep = q->child + direction;
+		wherep = slot->cs_path[(i - 1) % CRITBIT_CURSOR_DEPTH];
 	}
 
-	newnode->child[newdirection] = *wherep;
-	critbit_ref_set_node(wherep, newnode);
+	if (depth - i == CRITBIT_CURSOR_DEPTH) {
+		wherep = &t->ct_root;
+		for (i = 0;; i++) {
+			p = *wherep;
+			if (!critbit_ref_is_internal(p))
+				break;
+			q = critbit_ref_get_node(p);
+			if (q->byte > newbyte)
+				break;
+			if (q->byte == newbyte && q->otherbits > newotherbits)
+				break;
+			wherep = q->child + critbit_node_direction(q,
+			    keybyte(ubytes, q->byte, keylen));
+		}
+	}
 
+	slot->cs_where = wherep;
+	slot->cs_depth = i;
+	slot->cs_deep = depth > CRITBIT_CURSOR_DEPTH;
+	slot->cs_byte = newbyte;
+	slot->cs_otherbits = newotherbits;
+	slot->cs_dir = (1 + (newotherbits |
+	    keybyte(ubytes, newbyte, keylen))) >> 8;
+	slot->cs_empty = 0;
 	return (NULL);
 }
 
+/*
+ * Second half of insert: link key at prepared slot.  Counts and hashes
+ * are updated along the recorded path, or walking down again when the
+ * path did not fit in the slot.
+ */
+static __inline void
+critbit_commit_impl(struct critbit_slot *slot, struct critbit_node *newnode,
+    const struct critbit_key *key, size_t keylen, critbit_keylen_t *keylenf,
+    critbit_keybuf_t *keybuf, critbit_keybyte_t *keybyte)
+{
+	struct critbit_tree *t = slot->cs_tree;
+	const uint8_t *ubytes = keybuf(key);
+	struct critbit_ref **wherep;
+	struct critbit_node *q;
+	uint64_t h = 0;
+	size_t i;
+
+	if (t->ct_flags & CRITBIT_F_ENTRY)
+		return;
+	if (slot->cs_empty) {
+		critbit_ref_set_key(&t->ct_root, key);
+		if (newnode != NULL)
+			critbit_node_free(t, newnode);
+		return;
+	}
+
+	if (t->ct_flags & (CRITBIT_F_COUNT | CRITBIT_F_HASH)) {
+		if (t->ct_flags & CRITBIT_F_HASH)
+			h = critbit_key_hash(ubytes, keylen, keybyte);
+		wherep = &t->ct_root;
+		for (i = 0; i < slot->cs_depth; i++) {
+			if (!slot->cs_deep)
+				wherep = slot->cs_path[i];
+			q = critbit_ref_get_node(*wherep);
+			if (t->ct_flags & CRITBIT_F_COUNT)
+				(*critbit_node_count(q))++;
+			if (t->ct_flags & CRITBIT_F_HASH)
+				*critbit_node_hash(t, q) += h;
+			if (slot->cs_deep)
+				wherep = q->child + critbit_node_direction(q,
+				    keybyte(ubytes, q->byte, keylen));
+		}
+	}
+
+	newnode->byte = slot->cs_byte;
+	newnode->otherbits = slot->cs_otherbits;
+	critbit_ref_set_key(&newnode->child[slot->cs_dir], key);
+	newnode->child[1 - slot->cs_dir] = *slot->cs_where;
+	critbit_node_update(t, newnode, keylenf, keybuf, keybyte);
+	critbit_ref_set_node(slot->cs_where, newnode);
+}
+
+/*
+ * With entry set, nodes are embedded in elements at entryoff from the key
+ * and the node of an element is always on the path to its leaf.  The
+ * parent of the removed leaf is not freed; if the node of the removed
+ * element is still in use, it is moved into the parent's memory.
+ */
 static __inline struct critbit_key *
 critbit_remove_impl(struct critbit_tree *t, const void *key, size_t keylen,
-    critbit_keycmp_t *keycmp, critbit_keybuf_t *keybuf)
+    int entry, ptrdiff_t entryoff, critbit_keycmp_t *keycmp,
+    critbit_keybuf_t *keybuf, critbit_keybyte_t *keybyte)
 {
 	const uint8_t *ubytes = key;
 	struct critbit_ref *p = t->ct_root;
 	struct critbit_node *q = NULL;
 	struct critbit_ref **wherep = &t->ct_root;
 	struct critbit_ref **whereq = NULL;
+	struct critbit_node *own, *node;
+	unsigned int aug = t->ct_flags & (CRITBIT_F_COUNT | CRITBIT_F_HASH);
+	uint64_t h = 0;
 	int direction = 0;
 
 	if (p == NULL)
 		return (NULL);
+	if (t->ct_flags & CRITBIT_F_ENTRY) {
+		entry = 1;
+		entryoff = t->ct_entryoff;
+	}
 
+	/* counts and hashes are taken on the way down, restored on a miss */
+	if (t->ct_flags & CRITBIT_F_HASH)
+		h = critbit_key_hash(ubytes, keylen, keybyte);
 	while (critbit_ref_is_internal(p)) {
 		whereq = wherep;
 		q = critbit_ref_get_node(p);
-		uint8_t c = 0;
-		if (q->byte < keylen)
-			c = ubytes[q->byte];
-		direction = (1 + (q->otherbits | c)) >> 8;
+		if (t->ct_flags & CRITBIT_F_COUNT)
+			(*critbit_node_count(q))--;
+		if (t->ct_flags & CRITBIT_F_HASH)
+			*critbit_node_hash(t, q) -= h;
+		direction = critbit_node_direction(q,
+		    keybyte(ubytes, q->byte, keylen));
 		wherep = q->child + direction;
 		p = *wherep;
 	}
 
-	if (keycmp(keybuf(critbit_ref_get_key(p)), ubytes, keylen) != 0)
+	if (keycmp(keybuf(critbit_ref_get_key(p)), ubytes, keylen) != 0) {
+		for (p = t->ct_root; aug && critbit_ref_is_internal(p);) {
+			node = critbit_ref_get_node(p);
+			if (t->ct_flags & CRITBIT_F_COUNT)
+				(*critbit_node_count(node))++;
+			if (t->ct_flags & CRITBIT_F_HASH)
+				*critbit_node_hash(t, node) += h;
+			p = node->child[critbit_node_direction(node,
+			    keybyte(ubytes, node->byte, keylen))];
+		}
 		return (NULL);
+	}
 
 	/* Remove p */
 
@@ -294,133 +1072,3773 @@ critbit_remove_impl(struct critbit_tree *t, const void *key, size_t keylen,
 	}
 
 	*whereq = q->child[1 - direction];
-	critbit_node_free(t, q);
+	if (!entry) {
+		critbit_node_free(t, q);
+		return (critbit_ref_get_key(p));
+	}
+
+	own = (struct critbit_node *)(void *)
+	    ((char *)critbit_ref_get_key(p) + entryoff);
+	if (own != q)
+		critbit_entry_handoff(t, ubytes, keylen, own, q, whereq,
+		    keybyte);
 
 	return (critbit_ref_get_key(p));
 }
 
-void *
-critbit_buf_get(struct critbit_tree *t, const void *key)
+static __inline void
+critbit_cursor_push(struct critbit_cursor *c, struct critbit_node *node,
+    int direction)
 {
-	return (critbit_get_impl(t, key, critbit_buf_keylen(t, key),
-	    critbit_buf_keycmp, critbit_buf_keybuf));
+	size_t i = c->cc_depth % CRITBIT_CURSOR_DEPTH;
+
+	c->cc_path[i] = node;
+	c->cc_dir[i] = direction;
+	c->cc_depth++;
+	if (c->cc_depth - c->cc_base > CRITBIT_CURSOR_DEPTH)
+		c->cc_base++;
 }
 
-void *
-critbit_buf_insert(struct critbit_tree *t,
-    struct critbit_node *newnode, const void *key)
+static struct critbit_key *
+critbit_cursor_descend(struct critbit_cursor *c, struct critbit_ref *ref,
+    int direction)
 {
-	return (critbit_insert_impl(t, newnode, (const struct critbit_key *)key,
-	    critbit_buf_keylen(t, NULL), critbit_buf_keybuf));
+	struct critbit_node *node;
+
+	while (critbit_ref_is_internal(ref)) {
+		node = critbit_ref_get_node(ref);
+		critbit_cursor_push(c, node, direction);
+		ref = node->child[direction];
+	}
+	c->cc_leaf = ref;
+
+	return (critbit_ref_get_key(ref));
 }
 
-void *
-critbit_buf_remove(struct critbit_tree *t, const void *key)
+/*
+ * Cursor path is kept in a ring of CRITBIT_CURSOR_DEPTH entries, only the
+ * deepest part of a longer path is retained.  Recover ancestors lost to
+ * the ring by descending from the root along the current key.
+ */
+static void
+critbit_cursor_rebuild(struct critbit_cursor *c, critbit_keylen_t *keylenf,
+    critbit_keybuf_t *keybuf, critbit_keybyte_t *keybyte)
 {
-	return (critbit_remove_impl(t, key, critbit_buf_keylen(t, key),
-	    critbit_buf_keycmp, critbit_buf_keybuf));
+	const uint8_t *ubytes = keybuf(critbit_ref_get_key(c->cc_leaf));
+	size_t keylen = keylenf(c->cc_tree, ubytes);
+	struct critbit_node *node;
+	struct critbit_ref *ref;
+	size_t depth;
+	int direction;
+
+	depth = c->cc_depth;
+	c->cc_depth = c->cc_base = 0;
+	ref = c->cc_tree->ct_root;
+	while (c->cc_depth < depth) {
+		node = critbit_ref_get_node(ref);
+		direction = critbit_node_direction(node,
+		    keybyte(ubytes, node->byte, keylen));
+		critbit_cursor_push(c, node, direction);
+		ref = node->child[direction];
+	}
 }
 
-void *
-critbit_str_get(struct critbit_tree *t, const char *key)
+/*
+ * Insert using finger, a cursor left at the previously inserted key.  The
+ * new key shares all bits before its critical bit against the finger key,
+ * so the finger path is valid above that bit: climb the path to the last
+ * node above the critical bit and insert right below it.  If that node
+ * tests the critical bit itself, the key belongs to its other subtree
+ * and is inserted there as usual.  For sorted input climbing is amortized
+ * O(1).  Subtree counts, if kept, are updated walking from the root.
+ */
+static __inline struct critbit_key *
+critbit_insert_finger_impl(struct critbit_tree *t, struct critbit_cursor *c,
+    struct critbit_node *newnode, const struct critbit_key *key,
+    size_t keylen, critbit_keylen_t *keylenf, critbit_keybuf_t *keybuf,
+    critbit_keybyte_t *keybyte, critbit_keydiff_t *keydiff)
 {
-	return (critbit_get_impl(t, key,
-	    critbit_str_keylen(t, (const uint8_t *)key),
-	    critbit_str_keycmp, critbit_str_keybuf));
+	const uint8_t *const ubytes = keybuf(key);
+	struct critbit_ref **wherep;
+	struct critbit_node *q;
+	struct critbit_ref *p;
+	uint32_t newbyte;
+	uint8_t newotherbits;
+	size_t i;
+	int d;
+
+	if (t->ct_flags & CRITBIT_F_ENTRY)
+		return ((struct critbit_key *)key);
+	if (t->ct_root == NULL) {
+		critbit_ref_set_key(&t->ct_root, key);
+		critbit_node_free(t, newnode);
+		c->cc_tree = t;
+		c->cc_depth = c->cc_base = 0;
+		c->cc_leaf = t->ct_root;
+		return (NULL);
+	}
+
+	wherep = &t->ct_root;
+	if (c->cc_tree != t || c->cc_leaf == NULL) {
+		c->cc_tree = t;
+		c->cc_depth = c->cc_base = 0;
+		goto descend;
+	}
+
+	if (!keydiff(keybuf(critbit_ref_get_key(c->cc_leaf)), ubytes, keylen,
+	    &newbyte, &newotherbits)) {
+		critbit_node_free(t, newnode);
+		return (critbit_ref_get_key(c->cc_leaf));
+	}
+	newotherbits = ms1b8(newotherbits) ^ 255;
+
+	while (c->cc_depth > 0) {
+		if (c->cc_depth == c->cc_base)
+			critbit_cursor_rebuild(c, keylenf, keybuf, keybyte);
+		i = (c->cc_depth - 1) % CRITBIT_CURSOR_DEPTH;
+		q = c->cc_path[i];
+		if (q->byte < newbyte ||
+		    (q->byte == newbyte && q->otherbits <= newotherbits))
+			break;
+		c->cc_depth--;
+	}
+
+	if (c->cc_depth > 0) {
+		i = (c->cc_depth - 1) % CRITBIT_CURSOR_DEPTH;
+		q = c->cc_path[i];
+		if (q->byte == newbyte && q->otherbits == newotherbits) {
+			d = critbit_node_direction(q,
+			    keybyte(ubytes, q->byte, keylen));
+			c->cc_dir[i] = d;
+			wherep = &q->child[d];
+			goto descend;
+		}
+		wherep = &q->child[c->cc_dir[i]];
+	}
+	goto link;
+
+descend:
+	p = *wherep;
+	while (critbit_ref_is_internal(p)) {
+		q = critbit_ref_get_node(p);
+		p = q->child[critbit_node_direction(q,
+		    keybyte(ubytes, q->byte, keylen))];
+	}
+
+	if (!keydiff(keybuf(critbit_ref_get_key(p)), ubytes, keylen,
+	    &newbyte, &newotherbits)) {
+		critbit_node_free(t, newnode);
+		c->cc_leaf = NULL;
+		return (critbit_ref_get_key(p));
+	}
+	newotherbits = ms1b8(newotherbits) ^ 255;
+
+	for (;;) {
+		p = *wherep;
+		if (!critbit_ref_is_internal(p))
+			break;
+		q = critbit_ref_get_node(p);
+		if (q->byte > newbyte)
+			break;
+		if (q->byte == newbyte && q->otherbits > newotherbits)
+			break;
+		d = critbit_node_direction(q,
+		    keybyte(ubytes, q->byte, keylen));
+		critbit_cursor_push(c, q, d);
+		wherep = q->child + d;
+	}
+
+link:
+	newnode->byte = newbyte;
+	newnode->otherbits = newotherbits;
+	d = critbit_node_direction(newnode,
+	    keybyte(ubytes, newbyte, keylen));
+	critbit_ref_set_key(&newnode->child[d], key);
+	newnode->child[1 - d] = *wherep;
+	critbit_node_update(t, newnode, keylenf, keybuf, keybyte);
+	critbit_ref_set_node(wherep, newnode);
+
+	critbit_cursor_push(c, newnode, d);
+	c->cc_leaf = newnode->child[d];
+
+	if (t->ct_flags & (CRITBIT_F_COUNT | CRITBIT_F_HASH)) {
+		uint64_t h = 0;
+
+		if (t->ct_flags & CRITBIT_F_HASH)
+			h = critbit_key_hash(ubytes, keylen, keybyte);
+		p = t->ct_root;
+		while ((q = critbit_ref_get_node(p)) != newnode) {
+			if (t->ct_flags & CRITBIT_F_COUNT)
+				(*critbit_node_count(q))++;
+			if (t->ct_flags & CRITBIT_F_HASH)
+				*critbit_node_hash(t, q) += h;
+			p = q->child[critbit_node_direction(q,
+			    keybyte(ubytes, q->byte, keylen))];
+		}
+	}
+
+	return (NULL);
 }
 
-void *
-critbit_str_insert(struct critbit_tree *t,
-    struct critbit_node *newnode, const char **key)
+static __inline struct critbit_key *
+critbit_cursor_start(struct critbit_tree *t, struct critbit_cursor *c,
+    int direction)
 {
-	return (critbit_insert_impl(t, newnode, (const struct critbit_key *)key,
-	    critbit_str_keylen(t, (const uint8_t *)*key), critbit_str_keybuf));
+	c->cc_tree = t;
+	c->cc_leaf = NULL;
+	c->cc_depth = c->cc_base = 0;
+
+	if (t->ct_root == NULL)
+		return (NULL);
+
+	return (critbit_cursor_descend(c, t->ct_root, direction));
 }
 
-void *
-critbit_str_remove(struct critbit_tree *t, const char *key)
+static __inline struct critbit_key *
+critbit_cursor_step_impl(struct critbit_cursor *c, int direction,
+    size_t floor, critbit_keylen_t *keylenf, critbit_keybuf_t *keybuf,
+    critbit_keybyte_t *keybyte)
 {
-	return (critbit_remove_impl(t, key,
-	    critbit_str_keylen(t, (const uint8_t *)key),
-	    critbit_str_keycmp, critbit_str_keybuf));
+	struct critbit_node *node;
+	size_t i;
+
+	if (c->cc_leaf == NULL)
+		return (NULL);
+
+	while (c->cc_depth > floor) {
+		if (c->cc_depth == c->cc_base)
+			critbit_cursor_rebuild(c, keylenf, keybuf, keybyte);
+		i = (c->cc_depth - 1) % CRITBIT_CURSOR_DEPTH;
+		node = c->cc_path[i];
+		if (c->cc_dir[i] != direction) {
+			c->cc_dir[i] = direction;
+			return (critbit_cursor_descend(c, node->child[direction],
+			    1 - direction));
+		}
+		c->cc_depth--;
+	}
+
+	c->cc_leaf = NULL;
+	return (NULL);
 }
 
-#if 0
-static void
-traverse(void *top)
+/*
+ * Position cursor at the nearest key above or below the given one.  The
+ * first descent reaches a leaf sharing the longest prefix with the key
+ * that any leaf could share; their first differing bit is where the key
+ * would be inserted.  The second descent stops at that point and the
+ * answer is either an extreme leaf of the subtree found or its neighbour.
+ */
+static __inline struct critbit_key *
+critbit_seek_impl(struct critbit_tree *t, struct critbit_cursor *c,
+    const void *key, size_t keylen, int how, critbit_keylen_t *keylenf,
+    critbit_keybuf_t *keybuf, critbit_keybyte_t *keybyte,
+    critbit_keydiff_t *keydiff)
 {
-	uint8_t *p = top;
+	const uint8_t *ubytes = key;
+	const int direction = how & 1;
+	struct critbit_node *node;
+	struct critbit_ref *ref;
+	struct critbit_key *k;
+	uint32_t byte;
+	uint8_t bits;
+	int d, kdir;
 
-	if (1 & (intptr_t)p) {
-		struct critbit_node *q = (void *)(p - 1);
-		traverse(q->child[0]);
-		traverse(q->child[1]);
-		free(q);
-	} else {
-		free(p);
+	c->cc_tree = t;
+	c->cc_leaf = NULL;
+	c->cc_depth = c->cc_base = 0;
+
+	ref = t->ct_root;
+	if (ref == NULL)
+		return (NULL);
+
+	while (critbit_ref_is_internal(ref)) {
+		node = critbit_ref_get_node(ref);
+		d = critbit_node_direction(node,
+		    keybyte(ubytes, node->byte, keylen));
+		critbit_cursor_push(c, node, d);
+		ref = node->child[d];
+	}
+	c->cc_leaf = ref;
+	k = critbit_ref_get_key(ref);
+
+	if (!keydiff(keybuf(k), ubytes, keylen, &byte, &bits)) {
+		if (how & CRITBIT_SEEK_EQ)
+			return (k);
+		return (critbit_cursor_step_impl(c, direction, 0, keylenf,
+		    keybuf, keybyte));
+	}
+
+	bits = ms1b8(bits) ^ 255;
+	kdir = (1 + (bits | keybyte(ubytes, byte, keylen))) >> 8;
+
+	c->cc_depth = c->cc_base = 0;
+	ref = t->ct_root;
+	while (critbit_ref_is_internal(ref)) {
+		node = critbit_ref_get_node(ref);
+		if (node->byte > byte)
+			break;
+		if (node->byte == byte && node->otherbits > bits)
+			break;
+		d = critbit_node_direction(node,
+		    keybyte(ubytes, node->byte, keylen));
+		critbit_cursor_push(c, node, d);
+		ref = node->child[d];
 	}
 
+	if (kdir == direction)
+		return (critbit_cursor_step_impl(c, direction, 0, keylenf,
+		    keybuf, keybyte));
+	return (critbit_cursor_descend(c, ref, 1 - direction));
 }
 
-void
-critbit0_clear(struct critbit_tree *t)
+/*
+ * Count keys less than the given one.  Same two descents as in seek, sum
+ * sizes of left subtrees passed on the way right.
+ */
+static __inline size_t
+critbit_rank_impl(struct critbit_tree *t, const void *key, size_t keylen,
+    critbit_keybuf_t *keybuf, critbit_keybyte_t *keybyte,
+    critbit_keydiff_t *keydiff)
 {
-	if (t->ct_root)
-		traverse(t->ct_root);
-	t->ct_root = NULL;
-}
+	const uint8_t *ubytes = key;
+	struct critbit_node *node;
+	struct critbit_ref *ref;
+	uint32_t byte;
+	uint8_t bits;
+	size_t rank;
+	int d, exact;
 
-static int
-allprefixed_traverse(uint8_t *top,
-    int(*handle)(const char *, void *), void *arg)
-{
-	if (1 & (intptr_t)top) {
-		struct critbit_node *q = (void *)(top - 1);
-		for (int direction = 0; direction < 2; ++direction)
-			switch (allprefixed_traverse(q->child[direction], handle, arg)) {
-			case 1:
-				break;
-			case 0:
-				return 0;
-			default:
-				return -1;
-			}
-		return 1;
+	CRITBIT_ASSERT(t->ct_flags & CRITBIT_F_COUNT);
+
+	ref = t->ct_root;
+	if (ref == NULL)
+		return (0);
+
+	while (critbit_ref_is_internal(ref)) {
+		node = critbit_ref_get_node(ref);
+		ref = node->child[critbit_node_direction(node,
+		    keybyte(ubytes, node->byte, keylen))];
+	}
+
+	exact = !keydiff(keybuf(critbit_ref_get_key(ref)), ubytes, keylen,
+	    &byte, &bits);
+	if (!exact)
+		bits = ms1b8(bits) ^ 255;
+
+	rank = 0;
+	ref = t->ct_root;
+	while (critbit_ref_is_internal(ref)) {
+		node = critbit_ref_get_node(ref);
+		if (!exact && (node->byte > byte ||
+		    (node->byte == byte && node->otherbits > bits)))
+			break;
+		d = critbit_node_direction(node,
+		    keybyte(ubytes, node->byte, keylen));
+		if (d == 1)
+			rank += critbit_ref_count(node->child[0]);
+		ref = node->child[d];
 	}
 
-	return handle((const char *)top, arg);
+	if (!exact && ((1 + (bits | keybyte(ubytes, byte, keylen))) >> 8))
+		rank += critbit_ref_count(ref);
+
+	return (rank);
 }
 
-int
-critbit0_allprefixed(struct critbit_tree *t, const char *prefix,
-    int(*handle)(const char *, void *), void *arg)
+size_t
+critbit_count(struct critbit_tree *t)
 {
-	const uint8_t *ubytes = (const void *)prefix;
-	const size_t keylen = strlen(prefix);
-	struct critbit_node *q;
-	uint8_t *p = t->ct_root;
-	uint8_t *top = p;
+	CRITBIT_ASSERT(t->ct_flags & CRITBIT_F_COUNT);
 
-	if (p == NULL)
-		return 1;
+	if (t->ct_root == NULL)
+		return (0);
+	return (critbit_ref_count(t->ct_root));
+}
+
+/*
+ * Find i-th smallest key (counting from zero), optionally leaving cursor
+ * positioned at it.
+ */
+void *
+critbit_select(struct critbit_tree *t, struct critbit_cursor *c, size_t i)
+{
+	struct critbit_cursor tmp;
+	struct critbit_node *node;
+	struct critbit_ref *ref;
+	size_t lcount;
+	int d;
+
+	CRITBIT_ASSERT(t->ct_flags & CRITBIT_F_COUNT);
+
+	if (c == NULL)
+		c = &tmp;
+	c->cc_tree = t;
+	c->cc_leaf = NULL;
+	c->cc_depth = c->cc_base = 0;
+
+	ref = t->ct_root;
+	if (ref == NULL || i >= critbit_ref_count(ref))
+		return (NULL);
+
+	while (critbit_ref_is_internal(ref)) {
+		node = critbit_ref_get_node(ref);
+		lcount = critbit_ref_count(node->child[0]);
+		d = i >= lcount;
+		if (d)
+			i -= lcount;
+		critbit_cursor_push(c, node, d);
+		ref = node->child[d];
+	}
+	c->cc_leaf = ref;
+
+	return (critbit_ref_get_key(ref));
+}
+
+/*
+ * Visit keys in range [lo, hi), NULL bound is unlimited.  Both ends are
+ * located by seek, the walk in between touches only subtrees lying in the
+ * range and stops on reaching the leaf found for hi, no keys are compared.
+ */
+static __inline int
+critbit_range_impl(struct critbit_tree *t, const void *lo, size_t lolen,
+    const void *hi, size_t hilen, critbit_visit_t *visit, void *arg,
+    critbit_keylen_t *keylenf, critbit_keybuf_t *keybuf,
+    critbit_keybyte_t *keybyte, critbit_keydiff_t *keydiff)
+{
+	struct critbit_cursor c;
+	struct critbit_key *k, *end;
+	uint32_t byte;
+	uint8_t bits;
+	int rv;
 
-	while (1 & (intptr_t)p) {
-		struct critbit_node *q = (void *)(p - 1);
-		uint8_t c = 0;
-		if (q->byte < keylen)
-			c = ubytes[q->byte];
-		const int direction = (1 + (q->otherbits | c)) >> 8;
-		p = q->child[direction];
-		if (q->byte < keylen)
-			top = p;
+	end = NULL;
+	if (hi != NULL) {
+		if (lo != NULL) {
+			if (!keydiff(lo, hi, hilen, &byte, &bits))
+				return (0);
+			if ((keybyte(lo, byte, lolen) & ms1b8(bits)) != 0)
+				return (0);
+		}
+		end = critbit_seek_impl(t, &c, hi, hilen, CRITBIT_SEEK_GE,
+		    keylenf, keybuf, keybyte, keydiff);
 	}
 
-	for (size_t i = 0; i < keylen; ++i) {
-		if (p[i] != ubytes[i])
-			return 1;
+	if (lo != NULL)
+		k = critbit_seek_impl(t, &c, lo, lolen, CRITBIT_SEEK_GE,
+		    keylenf, keybuf, keybyte, keydiff);
+	else
+		k = critbit_cursor_start(t, &c, 0);
+
+	while (k != NULL && k != end) {
+		rv = visit(arg, k);
+		if (rv != 0)
+			return (rv);
+		k = critbit_cursor_step_impl(&c, 1, 0, keylenf, keybuf,
+		    keybyte);
 	}
 
+	return (0);
+}
 
-	return allprefixed_traverse(top, handle, arg);
+void
+critbit_cursor_init(struct critbit_cursor *c)
+{
+	c->cc_tree = NULL;
+	c->cc_leaf = NULL;
+	c->cc_depth = c->cc_base = 0;
 }
-#endif
+
+void *
+critbit_first(struct critbit_tree *t, struct critbit_cursor *c)
+{
+	return (critbit_cursor_start(t, c, 0));
+}
+
+void *
+critbit_last(struct critbit_tree *t, struct critbit_cursor *c)
+{
+	return (critbit_cursor_start(t, c, 1));
+}
+
+/*
+ * Visit all keys starting with prefix.  Subtree holding the keys is found
+ * in a single descent and then walked using cursor path as a stack.
+ * Returns first non-zero value returned by visit, or 0.
+ */
+static __inline int
+critbit_prefix_impl(struct critbit_tree *t, const void *prefix, size_t plen,
+    size_t keylen, critbit_visit_t *visit, void *arg,
+    critbit_keylen_t *keylenf, critbit_keybuf_t *keybuf,
+    critbit_keybyte_t *keybyte)
+{
+	const uint8_t *ubytes = prefix;
+	const uint8_t *pkey;
+	struct critbit_cursor c;
+	struct critbit_node *node;
+	struct critbit_ref *ref;
+	struct critbit_key *k;
+	size_t i, top;
+	int direction, rv;
+
+	c.cc_tree = t;
+	c.cc_depth = c.cc_base = 0;
+
+	ref = t->ct_root;
+	if (ref == NULL)
+		return (0);
+
+	while (critbit_ref_is_internal(ref)) {
+		node = critbit_ref_get_node(ref);
+		if (node->byte >= plen)
+			break;
+		direction = critbit_node_direction(node,
+		    keybyte(ubytes, node->byte, keylen));
+		critbit_cursor_push(&c, node, direction);
+		ref = node->child[direction];
+	}
+
+	top = c.cc_depth;
+	k = critbit_cursor_descend(&c, ref, 0);
+
+	pkey = keybuf(k);
+	for (i = 0; i < plen; ++i) {
+		if (keybyte(pkey, i, keylen) != keybyte(ubytes, i, keylen))
+			return (0);
+	}
+
+	do {
+		rv = visit(arg, k);
+		if (rv != 0)
+			return (rv);
+		k = critbit_cursor_step_impl(&c, 1, top, keylenf, keybuf,
+		    keybyte);
+	} while (k != NULL);
+
+	return (0);
+}
+
+static int
+critbit_count_visit(void *arg, void *key CRITBIT_UNUSED)
+{
+	(*(size_t *)arg)++;
+	return (0);
+}
+
+/*
+ * Count keys starting with prefix.  With CRITBIT_F_COUNT it's the count of
+ * the subtree top found by a single descent, otherwise keys are walked.
+ */
+static __inline size_t
+critbit_prefix_count_impl(struct critbit_tree *t, const void *prefix,
+    size_t plen, size_t keylen, critbit_keylen_t *keylenf,
+    critbit_keybuf_t *keybuf, critbit_keybyte_t *keybyte)
+{
+	const uint8_t *ubytes = prefix;
+	const uint8_t *pkey;
+	struct critbit_node *node;
+	struct critbit_ref *ref, *top;
+	size_t i, cnt;
+
+	if (!(t->ct_flags & CRITBIT_F_COUNT)) {
+		cnt = 0;
+		critbit_prefix_impl(t, prefix, plen, keylen,
+		    critbit_count_visit, &cnt, keylenf, keybuf, keybyte);
+		return (cnt);
+	}
+
+	ref = t->ct_root;
+	if (ref == NULL)
+		return (0);
+
+	while (critbit_ref_is_internal(ref)) {
+		node = critbit_ref_get_node(ref);
+		if (node->byte >= plen)
+			break;
+		ref = node->child[critbit_node_direction(node,
+		    keybyte(ubytes, node->byte, keylen))];
+	}
+
+	top = ref;
+	while (critbit_ref_is_internal(ref))
+		ref = critbit_ref_get_node(ref)->child[0];
+
+	pkey = keybuf(critbit_ref_get_key(ref));
+	for (i = 0; i < plen; ++i) {
+		if (keybyte(pkey, i, keylen) != keybyte(ubytes, i, keylen))
+			return (0);
+	}
+
+	return (critbit_ref_count(top));
+}
+
+static __inline const struct critbit_key *
+critbit_elem_key(void *const *elems, size_t i, size_t offset)
+{
+	return ((const struct critbit_key *)(const void *)
+	    ((const char *)elems[i] + offset));
+}
+
+/*
+ * Finish the lowest node of the right spine: restore its right child from
+ * the parent link kept there and return the parent.
+ */
+static __inline struct critbit_node *
+critbit_bulk_pop(struct critbit_tree *t, struct critbit_node *top,
+    struct critbit_ref **below, critbit_keylen_t *keylenf,
+    critbit_keybuf_t *keybuf, critbit_keybyte_t *keybyte)
+{
+	struct critbit_node *parent = NULL;
+
+	if (top->child[1] != NULL)
+		parent = critbit_ref_get_node(top->child[1]);
+	top->child[1] = *below;
+	critbit_node_update(t, top, keylenf, keybuf, keybyte);
+	critbit_ref_set_node(below, top);
+
+	return (parent);
+}
+
+/*
+ * Build tree from keys sorted in tree order.  The tree is a Cartesian tree
+ * of critical bits of adjacent keys, built left to right keeping its right
+ * spine.  Spine nodes temporarily point to their parents in child[1], so
+ * no stack is needed.  Returns EINVAL if keys are not strictly ascending,
+ * tree is left untouched in that case.
+ */
+static __inline int
+critbit_bulk_load_impl(struct critbit_tree *t, void *const *elems, size_t n,
+    size_t offset, struct critbit_node **nodes, critbit_keylen_t *keylenf,
+    critbit_keybuf_t *keybuf, critbit_keybyte_t *keybyte,
+    critbit_keydiff_t *keydiff)
+{
+	struct critbit_node *node, *top;
+	struct critbit_ref *below;
+	const uint8_t *prev, *ubytes;
+	uint32_t byte;
+	uint8_t bits;
+	size_t i, keylen;
+
+	if (t->ct_root != NULL || (t->ct_flags & CRITBIT_F_ENTRY))
+		return (EINVAL);
+	if (n == 0)
+		return (0);
+
+	top = NULL;
+	prev = keybuf(critbit_elem_key(elems, 0, offset));
+	for (i = 1; i < n; ++i) {
+		ubytes = keybuf(critbit_elem_key(elems, i, offset));
+		keylen = keylenf(t, ubytes);
+		if (!keydiff(prev, ubytes, keylen, &byte, &bits))
+			return (EINVAL);
+		node = nodes[i - 1];
+		node->byte = byte;
+		node->otherbits = ms1b8(bits) ^ 255;
+		if (critbit_node_direction(node,
+		    keybyte(ubytes, byte, keylen)) != 1)
+			return (EINVAL);
+
+		critbit_ref_set_key(&below, critbit_elem_key(elems, i - 1,
+		    offset));
+		while (top != NULL && (top->byte > node->byte ||
+		    (top->byte == node->byte &&
+		    top->otherbits > node->otherbits)))
+			top = critbit_bulk_pop(t, top, &below, keylenf,
+			    keybuf, keybyte);
+
+		node->child[0] = below;
+		node->child[1] = NULL;
+		if (top != NULL)
+			critbit_ref_set_node(&node->child[1], top);
+		top = node;
+		prev = ubytes;
+	}
+
+	critbit_ref_set_key(&below, critbit_elem_key(elems, n - 1, offset));
+	while (top != NULL)
+		top = critbit_bulk_pop(t, top, &below, keylenf, keybuf,
+		    keybyte);
+	t->ct_root = below;
+
+	return (0);
+}
+
+/*
+ * Look up a group of keys descending all of them in lockstep.  The next
+ * node of every lookup is prefetched a full round before it's read, so
+ * cache misses of independent lookups overlap.
+ */
+static __inline void
+critbit_get_batch_impl(struct critbit_tree *t, const void *const *keys,
+    size_t n, void **out, critbit_keylen_t *keylenf,
+    critbit_keycmp_t *keycmp, critbit_keybuf_t *keybuf,
+    critbit_keybyte_t *keybyte)
+{
+	struct critbit_ref *ref[CRITBIT_BATCH];
+	size_t keylen[CRITBIT_BATCH];
+	struct critbit_node *node;
+	const uint8_t *ubytes;
+	size_t i, j, m;
+	int active, d;
+
+	for (i = 0; i < n; i += m) {
+		m = n - i < CRITBIT_BATCH ? n - i : CRITBIT_BATCH;
+		if (t->ct_root == NULL) {
+			for (j = 0; j < m; ++j)
+				out[i + j] = NULL;
+			continue;
+		}
+
+		for (j = 0; j < m; ++j) {
+			ref[j] = t->ct_root;
+			keylen[j] = keylenf(t, keys[i + j]);
+		}
+
+		do {
+			active = 0;
+			for (j = 0; j < m; ++j) {
+				if (!critbit_ref_is_internal(ref[j]))
+					continue;
+				node = critbit_ref_get_node(ref[j]);
+				ubytes = keys[i + j];
+				d = critbit_node_direction(node,
+				    keybyte(ubytes, node->byte, keylen[j]));
+				ref[j] = node->child[d];
+				if (critbit_ref_is_internal(ref[j]))
+					node = critbit_ref_get_node(ref[j]);
+				else
+					node = (void *)ref[j];
+				CRITBIT_PREFETCH(node);
+				active = 1;
+			}
+		} while (active);
+
+		for (j = 0; j < m; ++j)
+			CRITBIT_PREFETCH(keybuf(critbit_ref_get_key(ref[j])));
+
+		for (j = 0; j < m; ++j) {
+			out[i + j] = NULL;
+			if (keycmp(keybuf(critbit_ref_get_key(ref[j])),
+			    keys[i + j], keylen[j]) == 0)
+				out[i + j] = critbit_ref_get_key(ref[j]);
+		}
+	}
+}
+
+/*
+ * Remember node whose subtree changed.  Counts and hashes of such nodes
+ * are recomputed afterwards, list is linked through the space they take.
+ * Nodes must be added top-down, so children are fixed before parents.
+ */
+static __inline struct critbit_node **
+critbit_touch_link(struct critbit_node *node)
+{
+	return ((struct critbit_node **)(void *)(node + 1));
+}
+
+static __inline void
+critbit_touch(struct critbit_tree *t, struct critbit_node **list,
+    struct critbit_node *node)
+{
+	if (!(t->ct_flags & (CRITBIT_F_COUNT | CRITBIT_F_HASH)))
+		return;
+	*critbit_touch_link(node) = *list;
+	*list = node;
+}
+
+static __inline void
+critbit_touch_fix(struct critbit_tree *t, struct critbit_node *list,
+    struct critbit_node *skip, critbit_keylen_t *keylenf,
+    critbit_keybuf_t *keybuf, critbit_keybyte_t *keybyte)
+{
+	struct critbit_node *node;
+
+	while ((node = list) != NULL) {
+		list = *critbit_touch_link(node);
+		if (node != skip)
+			critbit_node_update(t, node, keylenf, keybuf, keybyte);
+	}
+}
+
+struct critbit_merge_ctx {
+	struct critbit_tree	*t;
+	struct critbit_node	*pool;
+	struct critbit_node	*touched;
+	critbit_merge_t		*conflict;
+	void			*arg;
+};
+
+struct critbit_merge_item {
+	struct critbit_ref	**wherep;
+	struct critbit_ref	*a;
+	struct critbit_ref	*b;
+	struct critbit_key	*la;
+	struct critbit_key	*lb;
+};
+
+static __inline void
+critbit_merge_touch(struct critbit_merge_ctx *ctx, struct critbit_node *node)
+{
+	critbit_touch(ctx->t, &ctx->touched, node);
+}
+
+/*
+ * Merge subtrees a (from dst) and b (from src) into *wherep, la and lb are
+ * their leftmost keys.  Depending on where the first bit differing
+ * between la and lb lies relative to the critical bits of a and b, the
+ * subtrees are either joined by a new node, or one is pushed down into
+ * the side of the other it belongs to, or both split on the same bit and
+ * are merged side by side.  Only nodes where the key sets interleave are
+ * visited.  New nodes come from the pool of src nodes freed by side by
+ * side merges, plus one spare node.
+ */
+static void
+critbit_merge_impl(struct critbit_merge_ctx *ctx, struct critbit_ref **wherep,
+    struct critbit_ref *a, struct critbit_ref *b, struct critbit_key *la,
+    struct critbit_key *lb, critbit_keylen_t *keylenf,
+    critbit_keybuf_t *keybuf, critbit_keybyte_t *keybyte,
+    critbit_keydiff_t *keydiff)
+{
+	struct critbit_merge_item stack[CRITBIT_CURSOR_DEPTH];
+	struct critbit_node *anode, *bnode, *node;
+	struct critbit_ref *a1, *b1;
+	const uint8_t *ka, *kb;
+	uint64_t pa, pb, pd;
+	uint32_t byte;
+	uint8_t bits;
+	size_t kalen, kblen, sp;
+	int d;
+
+	sp = 0;
+	for (;;) {
+		pa = critbit_ref_pos(a);
+		pb = critbit_ref_pos(b);
+		ka = keybuf(la);
+		kb = keybuf(lb);
+		kalen = keylenf(ctx->t, ka);
+		kblen = keylenf(ctx->t, kb);
+		pd = UINT64_MAX;
+		if (keydiff(ka, kb, kblen, &byte, &bits)) {
+			bits = ms1b8(bits) ^ 255;
+			pd = ((uint64_t)byte << 8) | bits;
+		}
+
+		if (pd == UINT64_MAX && pa == UINT64_MAX && pb == UINT64_MAX) {
+			la = ctx->conflict(ctx->arg, la, lb);
+			critbit_ref_set_key(wherep, la);
+			goto next;
+		}
+
+		if (pd < pa && pd < pb) {
+			node = ctx->pool;
+			CRITBIT_ASSERT(node != NULL);
+			ctx->pool = (void *)node->child[0];
+			node->byte = byte;
+			node->otherbits = bits;
+			d = critbit_node_direction(node,
+			    keybyte(ka, byte, kalen));
+			node->child[d] = a;
+			node->child[1 - d] = b;
+			critbit_ref_set_node(wherep, node);
+			critbit_merge_touch(ctx, node);
+			goto next;
+		}
+
+		if (pa == pb) {
+			anode = critbit_ref_get_node(a);
+			bnode = critbit_ref_get_node(b);
+			critbit_ref_set_node(wherep, anode);
+			critbit_merge_touch(ctx, anode);
+			a1 = anode->child[1];
+			b1 = bnode->child[1];
+			if (sp < CRITBIT_CURSOR_DEPTH) {
+				stack[sp].wherep = &anode->child[1];
+				stack[sp].a = a1;
+				stack[sp].b = b1;
+				stack[sp].la = critbit_ref_leftmost(a1);
+				stack[sp].lb = critbit_ref_leftmost(b1);
+				sp++;
+			} else {
+				critbit_merge_impl(ctx, &anode->child[1], a1,
+				    b1, critbit_ref_leftmost(a1),
+				    critbit_ref_leftmost(b1), keylenf, keybuf,
+				    keybyte, keydiff);
+			}
+			wherep = &anode->child[0];
+			a = anode->child[0];
+			b = bnode->child[0];
+			bnode->child[0] = (void *)ctx->pool;
+			ctx->pool = bnode;
+		} else if (pa < pb) {
+			anode = critbit_ref_get_node(a);
+			d = critbit_node_direction(anode,
+			    keybyte(kb, anode->byte, kblen));
+			critbit_ref_set_node(wherep, anode);
+			critbit_merge_touch(ctx, anode);
+			wherep = &anode->child[d];
+			a = anode->child[d];
+			if (d == 1)
+				la = critbit_ref_leftmost(a);
+		} else {
+			bnode = critbit_ref_get_node(b);
+			d = critbit_node_direction(bnode,
+			    keybyte(ka, bnode->byte, kalen));
+			critbit_ref_set_node(wherep, bnode);
+			critbit_merge_touch(ctx, bnode);
+			wherep = &bnode->child[d];
+			b = bnode->child[d];
+			if (d == 1)
+				lb = critbit_ref_leftmost(b);
+		}
+		continue;
+
+next:
+		if (sp == 0)
+			break;
+		sp--;
+		wherep = stack[sp].wherep;
+		a = stack[sp].a;
+		b = stack[sp].b;
+		la = stack[sp].la;
+		lb = stack[sp].lb;
+	}
+}
+
+static __inline void
+critbit_merge_trees(struct critbit_tree *dst, struct critbit_tree *src,
+    struct critbit_node *spare, critbit_merge_t *conflict, void *arg,
+    critbit_keylen_t *keylenf, critbit_keybuf_t *keybuf,
+    critbit_keybyte_t *keybyte, critbit_keydiff_t *keydiff)
+{
+	struct critbit_merge_ctx ctx;
+	struct critbit_node *node;
+
+	CRITBIT_ASSERT(dst->ct_keylen == src->ct_keylen);
+	CRITBIT_ASSERT(dst->ct_flags == src->ct_flags);
+	CRITBIT_ASSERT(conflict != NULL);
+	if (dst->ct_flags & CRITBIT_F_ENTRY)
+		return;
+
+	if (src->ct_root == NULL || dst->ct_root == NULL) {
+		if (dst->ct_root == NULL)
+			dst->ct_root = src->ct_root;
+		src->ct_root = NULL;
+		if (spare != NULL)
+			critbit_node_free(dst, spare);
+		return;
+	}
+
+	ctx.t = dst;
+	ctx.pool = spare;
+	if (spare != NULL)
+		spare->child[0] = NULL;
+	ctx.touched = NULL;
+	ctx.conflict = conflict;
+	ctx.arg = arg;
+
+	critbit_merge_impl(&ctx, &dst->ct_root, dst->ct_root, src->ct_root,
+	    critbit_ref_leftmost(dst->ct_root),
+	    critbit_ref_leftmost(src->ct_root),
+	    keylenf, keybuf, keybyte, keydiff);
+	src->ct_root = NULL;
+
+	critbit_touch_fix(dst, ctx.touched, NULL, keylenf, keybuf, keybyte);
+
+	while ((node = ctx.pool) != NULL) {
+		ctx.pool = (void *)node->child[0];
+		critbit_node_free(dst, node);
+	}
+}
+
+struct critbit_setop_item {
+	struct critbit_ref	*a;
+	struct critbit_ref	*b;
+	struct critbit_key	*la;
+	struct critbit_key	*lb;
+};
+
+/*
+ * Walk subtrees a and b together, visiting in order keys of a that are
+ * (diff == 0) or are not (diff != 0) in b, la and lb are their leftmost
+ * keys.  Subtrees are compared the same way as in merge, parts of a that
+ * can't hold any key of b are skipped or visited without looking at b.
+ * Item with b == NULL visits whole subtree a.
+ */
+static int
+critbit_setop_impl(struct critbit_tree *t, struct critbit_setop_item it,
+    int diff, critbit_visit_t *visit, void *arg, critbit_keylen_t *keylenf,
+    critbit_keybuf_t *keybuf, critbit_keybyte_t *keybyte,
+    critbit_keydiff_t *keydiff)
+{
+	struct critbit_setop_item stack[CRITBIT_CURSOR_DEPTH];
+	struct critbit_setop_item later;
+	struct critbit_node *anode, *bnode;
+	const uint8_t *ka, *kb;
+	uint64_t pa, pb, pd;
+	uint32_t byte;
+	uint8_t bits;
+	size_t sp;
+	int d, rv;
+
+	sp = 0;
+	for (;;) {
+		if (it.b == NULL) {
+			if (!critbit_ref_is_internal(it.a)) {
+				rv = visit(arg, critbit_ref_get_key(it.a));
+				if (rv != 0)
+					return (rv);
+				goto next;
+			}
+			anode = critbit_ref_get_node(it.a);
+			it.a = anode->child[0];
+			later.a = anode->child[1];
+			later.b = NULL;
+			goto split;
+		}
+
+		pa = critbit_ref_pos(it.a);
+		pb = critbit_ref_pos(it.b);
+		ka = keybuf(it.la);
+		kb = keybuf(it.lb);
+		pd = UINT64_MAX;
+		if (keydiff(ka, kb, keylenf(t, kb), &byte, &bits)) {
+			bits = ms1b8(bits) ^ 255;
+			pd = ((uint64_t)byte << 8) | bits;
+		}
+
+		if (pd < pa && pd < pb) {
+			/* disjoint */
+			if (!diff)
+				goto next;
+			it.b = NULL;
+			continue;
+		}
+
+		if (pa == UINT64_MAX && pb == UINT64_MAX) {
+			/* equal keys */
+			if (!diff) {
+				rv = visit(arg, it.la);
+				if (rv != 0)
+					return (rv);
+			}
+			goto next;
+		}
+
+		if (pa == pb) {
+			anode = critbit_ref_get_node(it.a);
+			bnode = critbit_ref_get_node(it.b);
+			later.a = anode->child[1];
+			later.b = bnode->child[1];
+			later.la = critbit_ref_leftmost(later.a);
+			later.lb = critbit_ref_leftmost(later.b);
+			it.a = anode->child[0];
+			it.b = bnode->child[0];
+			goto split;
+		}
+
+		if (pb < pa) {
+			/* all of a is on one side of b */
+			bnode = critbit_ref_get_node(it.b);
+			d = critbit_node_direction(bnode,
+			    keybyte(ka, bnode->byte, keylenf(t, ka)));
+			it.b = bnode->child[d];
+			if (d == 1)
+				it.lb = critbit_ref_leftmost(it.b);
+			continue;
+		}
+
+		/* all of b is on one side of a */
+		anode = critbit_ref_get_node(it.a);
+		d = critbit_node_direction(anode,
+		    keybyte(kb, anode->byte, keylenf(t, kb)));
+		if (!diff) {
+			it.a = anode->child[d];
+			if (d == 1)
+				it.la = critbit_ref_leftmost(it.a);
+			continue;
+		}
+		if (d == 0) {
+			it.a = anode->child[0];
+			later.a = anode->child[1];
+			later.b = NULL;
+		} else {
+			later.a = anode->child[1];
+			later.b = it.b;
+			later.la = critbit_ref_leftmost(later.a);
+			later.lb = it.lb;
+			it.a = anode->child[0];
+			it.b = NULL;
+		}
+
+split:
+		/* it is walked now, later after it */
+		if (sp < CRITBIT_CURSOR_DEPTH) {
+			stack[sp++] = later;
+			continue;
+		}
+		rv = critbit_setop_impl(t, it, diff, visit, arg, keylenf,
+		    keybuf, keybyte, keydiff);
+		if (rv != 0)
+			return (rv);
+		it = later;
+		continue;
+
+next:
+		if (sp == 0)
+			break;
+		it = stack[--sp];
+	}
+
+	return (0);
+}
+
+static __inline int
+critbit_setop(struct critbit_tree *a, struct critbit_tree *b, int diff,
+    critbit_visit_t *visit, void *arg, critbit_keylen_t *keylenf,
+    critbit_keybuf_t *keybuf, critbit_keybyte_t *keybyte,
+    critbit_keydiff_t *keydiff)
+{
+	struct critbit_setop_item it;
+
+	CRITBIT_ASSERT(a->ct_keylen == b->ct_keylen);
+
+	if (a->ct_root == NULL || (b->ct_root == NULL && !diff))
+		return (0);
+
+	it.a = a->ct_root;
+	it.b = b->ct_root;
+	it.la = critbit_ref_leftmost(it.a);
+	it.lb = it.b != NULL ? critbit_ref_leftmost(it.b) : NULL;
+	return (critbit_setop_impl(a, it, diff, visit, arg, keylenf, keybuf,
+	    keybyte, keydiff));
+}
+
+/*
+ * Visit keys that are in only one of subtrees a and b, in order.  Either
+ * subtree may be NULL, the other one is then visited whole.  Critbit tree
+ * shape depends only on the set of keys, so subtrees of a and b splitting
+ * on the same bit and having the same hash are taken as equal and skipped.
+ */
+static int
+critbit_hashdiff_impl(struct critbit_tree *ta, struct critbit_tree *tb,
+    struct critbit_setop_item it, critbit_diff_t *visit, void *arg,
+    critbit_keylen_t *keylenf, critbit_keybuf_t *keybuf,
+    critbit_keybyte_t *keybyte, critbit_keydiff_t *keydiff)
+{
+	struct critbit_setop_item stack[CRITBIT_CURSOR_DEPTH];
+	struct critbit_setop_item later;
+	struct critbit_node *anode, *bnode, *node;
+	struct critbit_ref *ref;
+	struct critbit_key *k;
+	const uint8_t *ka, *kb;
+	uint64_t pa, pb, pd;
+	uint32_t byte;
+	uint8_t bits;
+	size_t sp;
+	int d, hashed, rv;
+
+	hashed = (ta->ct_flags & tb->ct_flags & CRITBIT_F_HASH) != 0;
+	sp = 0;
+	later.la = later.lb = NULL;
+	for (;;) {
+		if (it.a == NULL || it.b == NULL) {
+			ref = it.a != NULL ? it.a : it.b;
+			if (!critbit_ref_is_internal(ref)) {
+				k = critbit_ref_get_key(ref);
+				rv = it.a != NULL ? visit(arg, k, NULL) :
+				    visit(arg, NULL, k);
+				if (rv != 0)
+					return (rv);
+				goto next;
+			}
+			node = critbit_ref_get_node(ref);
+			later = it;
+			if (it.a != NULL) {
+				it.a = node->child[0];
+				later.a = node->child[1];
+			} else {
+				it.b = node->child[0];
+				later.b = node->child[1];
+			}
+			goto split;
+		}
+
+		pa = critbit_ref_pos(it.a);
+		pb = critbit_ref_pos(it.b);
+		ka = keybuf(it.la);
+		kb = keybuf(it.lb);
+		pd = UINT64_MAX;
+		if (keydiff(ka, kb, keylenf(ta, kb), &byte, &bits)) {
+			bits = ms1b8(bits) ^ 255;
+			pd = ((uint64_t)byte << 8) | bits;
+		}
+
+		if (pd < pa && pd < pb) {
+			/* disjoint, smaller one goes first */
+			d = (1 + (bits |
+			    keybyte(ka, byte, keylenf(ta, ka)))) >> 8;
+			later = it;
+			if (d == 0) {
+				it.b = NULL;
+				later.a = NULL;
+			} else {
+				it.a = NULL;
+				later.b = NULL;
+			}
+			goto split;
+		}
+
+		if (pa == UINT64_MAX && pb == UINT64_MAX)
+			goto next;
+
+		if (pa == pb) {
+			anode = critbit_ref_get_node(it.a);
+			bnode = critbit_ref_get_node(it.b);
+			if (hashed && *critbit_node_hash(ta, anode) ==
+			    *critbit_node_hash(tb, bnode))
+				goto next;
+			later.a = anode->child[1];
+			later.b = bnode->child[1];
+			later.la = critbit_ref_leftmost(later.a);
+			later.lb = critbit_ref_leftmost(later.b);
+			it.a = anode->child[0];
+			it.b = bnode->child[0];
+			goto split;
+		}
+
+		if (pa < pb) {
+			/* all of b is on one side of a */
+			anode = critbit_ref_get_node(it.a);
+			d = critbit_node_direction(anode,
+			    keybyte(kb, anode->byte, keylenf(ta, kb)));
+			later.a = anode->child[1];
+			later.la = critbit_ref_leftmost(later.a);
+			later.b = d == 1 ? it.b : NULL;
+			later.lb = it.lb;
+			it.a = anode->child[0];
+			if (d == 1)
+				it.b = NULL;
+		} else {
+			/* all of a is on one side of b */
+			bnode = critbit_ref_get_node(it.b);
+			d = critbit_node_direction(bnode,
+			    keybyte(ka, bnode->byte, keylenf(ta, ka)));
+			later.b = bnode->child[1];
+			later.lb = critbit_ref_leftmost(later.b);
+			later.a = d == 1 ? it.a : NULL;
+			later.la = it.la;
+			it.b = bnode->child[0];
+			if (d == 1)
+				it.a = NULL;
+		}
+
+split:
+		/* it is walked now, later after it */
+		if (sp < CRITBIT_CURSOR_DEPTH) {
+			stack[sp++] = later;
+			continue;
+		}
+		rv = critbit_hashdiff_impl(ta, tb, it, visit, arg, keylenf,
+		    keybuf, keybyte, keydiff);
+		if (rv != 0)
+			return (rv);
+		it = later;
+		continue;
+
+next:
+		if (sp == 0)
+			break;
+		it = stack[--sp];
+	}
+
+	return (0);
+}
+
+static __inline int
+critbit_hashdiff(struct critbit_tree *a, struct critbit_tree *b,
+    critbit_diff_t *visit, void *arg, critbit_keylen_t *keylenf,
+    critbit_keybuf_t *keybuf, critbit_keybyte_t *keybyte,
+    critbit_keydiff_t *keydiff)
+{
+	struct critbit_setop_item it;
+
+	CRITBIT_ASSERT(a->ct_keylen == b->ct_keylen);
+
+	if (a->ct_root == NULL && b->ct_root == NULL)
+		return (0);
+
+	it.a = a->ct_root;
+	it.b = b->ct_root;
+	it.la = it.a != NULL ? critbit_ref_leftmost(it.a) : NULL;
+	it.lb = it.b != NULL ? critbit_ref_leftmost(it.b) : NULL;
+	return (critbit_hashdiff_impl(a, b, it, visit, arg, keylenf, keybuf,
+	    keybyte, keydiff));
+}
+
+/*
+ * Move keys less than key to left and the rest to right.  Path of key
+ * through the tree is cut in two chains: nodes where the path turns right
+ * keep their left subtree and go to left, the other ones go to right.
+ * Subtree where key leaves the path ends one chain, the last node of
+ * the other chain is dropped.
+ */
+static __inline void
+critbit_split_impl(struct critbit_tree *t, const void *key, size_t keylen,
+    struct critbit_tree *left, struct critbit_tree *right,
+    critbit_keylen_t *keylenf, critbit_keybuf_t *keybuf,
+    critbit_keybyte_t *keybyte, critbit_keydiff_t *keydiff)
+{
+	const uint8_t *ubytes = key;
+	struct critbit_ref *ref, *p, *lroot, *rroot;
+	struct critbit_ref **lwhere, **rwhere, **lprev, **rprev;
+	struct critbit_ref **where, **prev;
+	struct critbit_node *node, *dead, *touched;
+	uint64_t pd;
+	uint32_t byte;
+	uint8_t bits;
+	int d, side;
+
+	CRITBIT_ASSERT(left->ct_keylen == t->ct_keylen);
+	CRITBIT_ASSERT(right->ct_keylen == t->ct_keylen);
+	CRITBIT_ASSERT(left->ct_root == NULL && right->ct_root == NULL);
+	if (t->ct_flags & CRITBIT_F_ENTRY)
+		return;
+
+	ref = t->ct_root;
+	t->ct_root = NULL;
+	if (ref == NULL)
+		return;
+
+	p = ref;
+	while (critbit_ref_is_internal(p)) {
+		node = critbit_ref_get_node(p);
+		p = node->child[critbit_node_direction(node,
+		    keybyte(ubytes, node->byte, keylen))];
+	}
+
+	/* side 1: subtree where key leaves the path is less than key */
+	pd = UINT64_MAX;
+	side = 0;
+	if (keydiff(keybuf(critbit_ref_get_key(p)), ubytes, keylen,
+	    &byte, &bits)) {
+		bits = ms1b8(bits) ^ 255;
+		pd = ((uint64_t)byte << 8) | bits;
+		side = (1 + (bits | keybyte(ubytes, byte, keylen))) >> 8;
+	}
+
+	lroot = rroot = NULL;
+	lwhere = &lroot;
+	rwhere = &rroot;
+	lprev = rprev = NULL;
+	touched = NULL;
+	while (critbit_ref_pos(ref) < pd) {
+		node = critbit_ref_get_node(ref);
+		d = critbit_node_direction(node,
+		    keybyte(ubytes, node->byte, keylen));
+		if (d == 1) {
+			lprev = lwhere;
+			critbit_ref_set_node(lwhere, node);
+			lwhere = &node->child[1];
+		} else {
+			rprev = rwhere;
+			critbit_ref_set_node(rwhere, node);
+			rwhere = &node->child[0];
+		}
+		critbit_touch(t, &touched, node);
+		ref = node->child[d];
+	}
+
+	if (side) {
+		*lwhere = ref;
+		where = rwhere;
+		prev = rprev;
+	} else {
+		*rwhere = ref;
+		where = lwhere;
+		prev = lprev;
+	}
+
+	dead = NULL;
+	if (prev != NULL) {
+		dead = critbit_ref_get_node(*prev);
+		*prev = dead->child[where == &dead->child[1] ? 0 : 1];
+	}
+
+	critbit_touch_fix(t, touched, dead, keylenf, keybuf, keybyte);
+	if (dead != NULL)
+		critbit_node_free(t, dead);
+
+	left->ct_root = lroot;
+	right->ct_root = rroot;
+}
+
+/*
+ * Append keys of right to left, all keys of left must be less than keys
+ * of right.  Right spine of left and left spine of right are zipped by
+ * critical bit down to the bit where the largest key of left and the
+ * smallest key of right differ, where node is inserted.
+ */
+static __inline int
+critbit_join_impl(struct critbit_tree *left, struct critbit_tree *right,
+    struct critbit_node *node, critbit_keylen_t *keylenf,
+    critbit_keybuf_t *keybuf, critbit_keybyte_t *keybyte,
+    critbit_keydiff_t *keydiff)
+{
+	struct critbit_ref **wherep, *a, *b;
+	struct critbit_node *n, *touched;
+	const uint8_t *kmin;
+	uint64_t pa, pb, pd;
+	size_t minlen;
+	uint32_t byte;
+	uint8_t bits;
+
+	CRITBIT_ASSERT(left->ct_keylen == right->ct_keylen);
+	CRITBIT_ASSERT(left->ct_flags == right->ct_flags);
+
+	if (left->ct_flags & CRITBIT_F_ENTRY)
+		goto bad;
+	if (left->ct_root == NULL || right->ct_root == NULL) {
+		if (left->ct_root == NULL)
+			left->ct_root = right->ct_root;
+		right->ct_root = NULL;
+		critbit_node_free(left, node);
+		return (0);
+	}
+
+	kmin = keybuf(critbit_ref_leftmost(right->ct_root));
+	minlen = keylenf(right, kmin);
+	if (!keydiff(keybuf(critbit_ref_rightmost(left->ct_root)), kmin,
+	    minlen, &byte, &bits))
+		goto bad;
+	bits = ms1b8(bits) ^ 255;
+	if (((1 + (bits | keybyte(kmin, byte, minlen))) >> 8) != 1)
+		goto bad;
+	pd = ((uint64_t)byte << 8) | bits;
+
+	wherep = &left->ct_root;
+	a = left->ct_root;
+	b = right->ct_root;
+	touched = NULL;
+	for (;;) {
+		pa = critbit_ref_pos(a);
+		pb = critbit_ref_pos(b);
+		if (pa < pd && pa < pb) {
+			n = critbit_ref_get_node(a);
+			critbit_ref_set_node(wherep, n);
+			wherep = &n->child[1];
+			a = n->child[1];
+		} else if (pb < pd) {
+			n = critbit_ref_get_node(b);
+			critbit_ref_set_node(wherep, n);
+			wherep = &n->child[0];
+			b = n->child[0];
+		} else
+			break;
+		critbit_touch(left, &touched, n);
+	}
+
+	node->byte = byte;
+	node->otherbits = bits;
+	node->child[0] = a;
+	node->child[1] = b;
+	critbit_ref_set_node(wherep, node);
+	critbit_touch(left, &touched, node);
+	critbit_touch_fix(left, touched, NULL, keylenf, keybuf, keybyte);
+
+	right->ct_root = NULL;
+	return (0);
+bad:
+	critbit_node_free(left, node);
+	return (EINVAL);
+}
+
+/*
+ * Compact trees.  Children are 32-bit references, slot index shifted left
+ * with the low bit set for internal nodes.  Slot i holds a key and the node
+ * inserted along with it; as with intrusive trees, that node stays on the
+ * path to the key, so removal frees exactly one slot.
+ */
+struct critbit_cnode {
+	uint32_t		child[2];
+	uint32_t		pos;	/* crit byte << 8 | otherbits */
+};
+
+#define CRITBIT_CNONE			UINT32_MAX
+#define CRITBIT_CMAXBYTE		0xffffff
+#define CRITBIT_CMAXSLOTS		((uint32_t)1 << 31)
+
+static __inline int
+critbit_cnode_direction(const struct critbit_cnode *node, uint8_t c)
+{
+	return ((1 + ((node->pos & 0xff) | c)) >> 8);
+}
+
+void
+critbit_ctree_init(struct critbit_ctree *t, size_t keylen)
+{
+	t->cx_nodes = NULL;
+	t->cx_keys = NULL;
+	t->cx_keylen = keylen;
+	t->cx_root = 0;
+	t->cx_count = t->cx_size = t->cx_used = 0;
+	t->cx_free = CRITBIT_CNONE;
+}
+
+/* keys are not touched */
+void
+critbit_ctree_destroy(struct critbit_ctree *t)
+{
+	free(t->cx_nodes);
+	free(t->cx_keys);
+	critbit_ctree_init(t, t->cx_keylen);
+}
+
+/* make room for n slots */
+int
+critbit_ctree_reserve(struct critbit_ctree *t, size_t n)
+{
+	struct critbit_cnode *nodes;
+	struct critbit_key **keys;
+
+	if (n <= t->cx_size)
+		return (0);
+	if (n > CRITBIT_CMAXSLOTS)
+		return (EINVAL);
+	if (n > SIZE_MAX / sizeof(*nodes) || n > SIZE_MAX / sizeof(*keys))
+		return (ENOMEM);
+	nodes = realloc(t->cx_nodes, n * sizeof(*nodes));
+	if (nodes == NULL)
+		return (ENOMEM);
+	t->cx_nodes = nodes;
+	keys = realloc(t->cx_keys, n * sizeof(*keys));
+	if (keys == NULL)
+		return (ENOMEM);
+	t->cx_keys = keys;
+	t->cx_size = n;
+	return (0);
+}
+
+size_t
+critbit_ctree_count(struct critbit_ctree *t)
+{
+	return (t->cx_count);
+}
+
+size_t
+critbit_ctree_node_size(void)
+{
+	return (sizeof(struct critbit_cnode));
+}
+
+static int
+critbit_cforeach(struct critbit_ctree *t, uint32_t ref,
+    critbit_visit_t *visit, void *arg)
+{
+	uint32_t stack[CRITBIT_CURSOR_DEPTH];
+	struct critbit_cnode *node;
+	size_t depth = 0;
+	int rv;
+
+	for (;;) {
+		while (ref & 1) {
+			node = &t->cx_nodes[ref >> 1];
+			if (depth == CRITBIT_CURSOR_DEPTH) {
+				rv = critbit_cforeach(t, node->child[0], visit,
+				    arg);
+				if (rv != 0)
+					return (rv);
+				ref = node->child[1];
+				continue;
+			}
+			stack[depth++] = node->child[1];
+			ref = node->child[0];
+		}
+		rv = visit(arg, t->cx_keys[ref >> 1]);
+		if (rv != 0)
+			return (rv);
+		if (depth == 0)
+			return (0);
+		ref = stack[--depth];
+	}
+}
+
+/* visit keys in order */
+int
+critbit_ctree_foreach(struct critbit_ctree *t, critbit_visit_t *visit,
+    void *arg)
+{
+	if (t->cx_count == 0)
+		return (0);
+	return (critbit_cforeach(t, t->cx_root, visit, arg));
+}
+
+static __inline struct critbit_key *
+critbit_cget_impl(struct critbit_ctree *t, const void *key, size_t keylen,
+    critbit_keycmp_t *keycmp, critbit_keybuf_t *keybuf,
+    critbit_keybyte_t *keybyte)
+{
+	const uint8_t *ubytes = key;
+	struct critbit_cnode *node;
+	struct critbit_key *k;
+	uint32_t ref;
+
+	if (t->cx_count == 0)
+		return (NULL);
+	ref = t->cx_root;
+	while (ref & 1) {
+		node = &t->cx_nodes[ref >> 1];
+		ref = node->child[critbit_cnode_direction(node,
+		    keybyte(ubytes, node->pos >> 8, keylen))];
+	}
+	k = t->cx_keys[ref >> 1];
+	if (keycmp(keybuf(k), ubytes, keylen) != 0)
+		return (NULL);
+	return (k);
+}
+
+/*
+ * Returns 0 once key is linked, EEXIST with *existing set if an equal key
+ * is present, ENOMEM or EINVAL if the tree or the keys are too large.
+ */
+static __inline int
+critbit_cinsert_impl(struct critbit_ctree *t, const struct critbit_key *key,
+    size_t keylen, void **existing, critbit_keybuf_t *keybuf,
+    critbit_keybyte_t *keybyte, critbit_keydiff_t *keydiff)
+{
+	const uint8_t *ubytes = keybuf(key);
+	struct critbit_cnode *node;
+	struct critbit_key *k;
+	uint32_t *wherep, ref, newbyte, pos = 0, slot;
+	uint8_t newotherbits;
+	int direction = 0, rv;
+
+	if (t->cx_count != 0) {
+		ref = t->cx_root;
+		while (ref & 1) {
+			node = &t->cx_nodes[ref >> 1];
+			ref = node->child[critbit_cnode_direction(node,
+			    keybyte(ubytes, node->pos >> 8, keylen))];
+		}
+		k = t->cx_keys[ref >> 1];
+		if (!keydiff(keybuf(k), ubytes, keylen, &newbyte,
+		    &newotherbits)) {
+			if (existing != NULL)
+				*existing = k;
+			return (EEXIST);
+		}
+		if (newbyte > CRITBIT_CMAXBYTE)
+			return (EINVAL);
+		newotherbits = ms1b8(newotherbits) ^ 255;
+		pos = newbyte << 8 | newotherbits;
+		direction = (1 + (newotherbits |
+		    keybyte(ubytes, newbyte, keylen))) >> 8;
+	}
+
+	/* grown only once the key is known to be new */
+	if (t->cx_free == CRITBIT_CNONE && t->cx_used == t->cx_size) {
+		rv = critbit_ctree_reserve(t, t->cx_size == 0 ? 16 :
+		    (size_t)t->cx_size * 2 > CRITBIT_CMAXSLOTS ?
+		    CRITBIT_CMAXSLOTS : (size_t)t->cx_size * 2);
+		if (rv == 0 && t->cx_used == t->cx_size)
+			rv = EINVAL;
+		if (rv != 0)
+			return (rv);
+	}
+	if ((slot = t->cx_free) != CRITBIT_CNONE)
+		t->cx_free = t->cx_nodes[slot].child[0];
+	else
+		slot = t->cx_used++;
+	t->cx_keys[slot] = (struct critbit_key *)key;
+
+	if (t->cx_count++ == 0) {
+		t->cx_root = slot << 1;
+		return (0);
+	}
+
+	wherep = &t->cx_root;
+	while (*wherep & 1) {
+		node = &t->cx_nodes[*wherep >> 1];
+		if (node->pos > pos)
+			break;
+		wherep = node->child + critbit_cnode_direction(node,
+		    keybyte(ubytes, node->pos >> 8, keylen));
+	}
+
+	node = &t->cx_nodes[slot];
+	node->pos = pos;
+	node->child[direction] = slot << 1;
+	node->child[1 - direction] = *wherep;
+	*wherep = slot << 1 | 1;
+	return (0);
+}
+
+static __inline struct critbit_key *
+critbit_cremove_impl(struct critbit_ctree *t, const void *key, size_t keylen,
+    critbit_keycmp_t *keycmp, critbit_keybuf_t *keybuf,
+    critbit_keybyte_t *keybyte)
+{
+	const uint8_t *ubytes = key;
+	struct critbit_cnode *q = NULL, *node;
+	struct critbit_key *k;
+	uint32_t *wherep, *whereq = NULL, p, qslot = 0, slot, s;
+	int direction = 0;
+
+	if (t->cx_count == 0)
+		return (NULL);
+
+	wherep = &t->cx_root;
+	p = *wherep;
+	while (p & 1) {
+		whereq = wherep;
+		qslot = p >> 1;
+		q = &t->cx_nodes[qslot];
+		direction = critbit_cnode_direction(q,
+		    keybyte(ubytes, q->pos >> 8, keylen));
+		wherep = q->child + direction;
+		p = *wherep;
+	}
+
+	slot = p >> 1;
+	k = t->cx_keys[slot];
+	if (keycmp(keybuf(k), ubytes, keylen) != 0)
+		return (NULL);
+
+	if (whereq != NULL) {
+		*whereq = q->child[1 - direction];
+		/* node of the freed slot may be in use above q */
+		wherep = &t->cx_root;
+		while (qslot != slot && wherep != whereq) {
+			s = *wherep >> 1;
+			if (s == slot) {
+				t->cx_nodes[qslot] = t->cx_nodes[slot];
+				*wherep = qslot << 1 | 1;
+				break;
+			}
+			node = &t->cx_nodes[s];
+			wherep = node->child + critbit_cnode_direction(node,
+			    keybyte(ubytes, node->pos >> 8, keylen));
+		}
+	}
+
+	t->cx_keys[slot] = NULL;
+	t->cx_nodes[slot].child[0] = t->cx_free;
+	t->cx_free = slot;
+	t->cx_count--;
+	return (k);
+}
+
+/*
+ * Frozen trees reuse compact nodes, grouped in blocks of one cache line
+ * each holding the top levels of a subtree.  Internal references are byte
+ * offsets of nodes with the low bit set, leaf references are key ranks.
+ */
+#define CRITBIT_FROZEN_BLOCK						\
+(CRITBIT_CACHE_LINE / sizeof(struct critbit_cnode))
+
+struct critbit_freezer {
+	char			*base;	/* NULL while sizing */
+	struct critbit_key	**keys;
+	size_t			nblocks;
+	size_t			nkeys;
+	int			error;
+};
+
+/* block being laid out, nodes breadth first */
+struct critbit_freeze_blk {
+	struct critbit_node	*bn[CRITBIT_FROZEN_BLOCK];
+	size_t			m;
+	size_t			block;
+};
+
+/* node waiting for the refs of its children */
+struct critbit_freeze_frame {
+	struct critbit_node	*node;
+	uint32_t		child[2];
+	uint32_t		off;
+	int			d;
+	int			first;	/* root of its block */
+};
+
+#define CRITBIT_FREEZE_DEPTH	(CRITBIT_CURSOR_DEPTH + CRITBIT_FROZEN_BLOCK)
+
+/* breadth first, so the block holds whole top levels */
+static void
+critbit_freeze_gather(struct critbit_freezer *z, struct critbit_freeze_blk *b,
+    struct critbit_node *node)
+{
+	struct critbit_ref *c;
+	size_t i;
+	int d;
+
+	b->bn[0] = node;
+	for (i = 0, b->m = 1; i < b->m; ++i) {
+		for (d = 0; d < 2 && b->m < CRITBIT_FROZEN_BLOCK; ++d) {
+			c = b->bn[i]->child[d];
+			if (critbit_ref_is_internal(c))
+				b->bn[b->m++] = critbit_ref_get_node(c);
+		}
+	}
+	b->block = z->nblocks++;
+}
+
+/*
+ * Lay out the subtree at ref depth first: blocks are numbered as they are
+ * entered, keys in order.  Frames are kept on a bounded stack, a block
+ * entered deeper than CRITBIT_CURSOR_DEPTH is laid out by recursion.
+ */
+static uint32_t
+critbit_freeze_walk(struct critbit_freezer *z, struct critbit_ref *ref)
+{
+	struct critbit_freeze_frame st[CRITBIT_FREEZE_DEPTH], *f;
+	struct critbit_freeze_blk blk[CRITBIT_FREEZE_DEPTH], *b;
+	struct critbit_node *node;
+	struct critbit_cnode *fn;
+	size_t sp = 0, nb = 0, j;
+	uint32_t r;
+
+	for (;;) {
+		if (!critbit_ref_is_internal(ref)) {
+			if (z->base != NULL)
+				z->keys[z->nkeys] = critbit_ref_get_key(ref);
+			r = (uint32_t)(z->nkeys++ << 1);
+		} else {
+			node = critbit_ref_get_node(ref);
+			j = 0;
+			if (nb > 0) {
+				b = &blk[nb - 1];
+				for (j = 1; j < b->m && b->bn[j] != node; ++j)
+					;
+				if (j == b->m)
+					j = 0;
+			}
+			if (j == 0 && sp >= CRITBIT_CURSOR_DEPTH)
+				r = critbit_freeze_walk(z, ref);
+			else {
+				if (j == 0)
+					critbit_freeze_gather(z, &blk[nb++],
+					    node);
+				f = &st[sp++];
+				f->node = node;
+				f->off = blk[nb - 1].block *
+				    CRITBIT_CACHE_LINE +
+				    j * sizeof(struct critbit_cnode);
+				f->d = 0;
+				f->first = j == 0;
+				ref = node->child[0];
+				continue;
+			}
+		}
+
+		/* r is the ref of a finished child, complete its parents */
+		for (;;) {
+			if (sp == 0)
+				return (r);
+			f = &st[sp - 1];
+			f->child[f->d++] = r;
+			if (f->d < 2)
+				break;
+			if (f->node->byte > CRITBIT_CMAXBYTE)
+				z->error = EINVAL;
+			if (z->base != NULL) {
+				fn = (struct critbit_cnode *)(void *)
+				    (z->base + f->off);
+				fn->child[0] = f->child[0];
+				fn->child[1] = f->child[1];
+				fn->pos = (uint32_t)f->node->byte << 8 |
+				    f->node->otherbits;
+			}
+			r = f->off | 1;
+			if (f->first)
+				nb--;
+			sp--;
+		}
+		ref = f->node->child[1];
+	}
+}
+
+int
+critbit_freeze(struct critbit_tree *t, struct critbit_frozen *f)
+{
+	struct critbit_freezer z;
+	size_t sz;
+	void *mem;
+
+	f->cf_base = NULL;
+	f->cf_keys = NULL;
+	f->cf_keylen = t->ct_keylen;
+	f->cf_count = 0;
+	f->cf_root = 0;
+	if (t->ct_root == NULL)
+		return (0);
+
+	memset(&z, 0, sizeof(z));
+	critbit_freeze_walk(&z, t->ct_root);
+	if (z.error != 0)
+		return (z.error);
+	if (z.nblocks > UINT32_MAX / CRITBIT_CACHE_LINE ||
+	    z.nkeys > CRITBIT_CMAXSLOTS)
+		return (EINVAL);
+
+	sz = z.nblocks * CRITBIT_CACHE_LINE;
+	if (posix_memalign(&mem, CRITBIT_CACHE_LINE,
+	    sz + z.nkeys * sizeof(*z.keys)) != 0)
+		return (ENOMEM);
+	memset(mem, 0, sz);
+	z.base = mem;
+	z.keys = (struct critbit_key **)(void *)(z.base + sz);
+	z.nblocks = z.nkeys = 0;
+	f->cf_root = critbit_freeze_walk(&z, t->ct_root);
+	f->cf_base = z.base;
+	f->cf_keys = z.keys;
+	f->cf_count = z.nkeys;
+	return (0);
+}
+
+void
+critbit_frozen_free(struct critbit_frozen *f)
+{
+	free(f->cf_base);
+	f->cf_base = NULL;
+	f->cf_keys = NULL;
+	f->cf_count = 0;
+}
+
+size_t
+critbit_frozen_count(const struct critbit_frozen *f)
+{
+	return (f->cf_count);
+}
+
+/* keys are kept in order, so this is select in O(1) */
+void *
+critbit_frozen_key(const struct critbit_frozen *f, size_t i)
+{
+	return (i < f->cf_count ? f->cf_keys[i] : NULL);
+}
+
+static __inline struct critbit_key *
+critbit_fget_impl(const struct critbit_frozen *f, const void *key,
+    size_t keylen, critbit_keycmp_t *keycmp, critbit_keybuf_t *keybuf,
+    critbit_keybyte_t *keybyte)
+{
+	const uint8_t *ubytes = key;
+	const struct critbit_cnode *node;
+	struct critbit_key *k;
+	uint32_t ref;
+
+	if (f->cf_count == 0)
+		return (NULL);
+	ref = f->cf_root;
+	while (ref & 1) {
+		node = (const struct critbit_cnode *)(const void *)
+		    (f->cf_base + (ref ^ 1));
+		ref = node->child[critbit_cnode_direction(node,
+		    keybyte(ubytes, node->pos >> 8, keylen))];
+	}
+	k = f->cf_keys[ref >> 1];
+	if (keycmp(keybuf(k), ubytes, keylen) != 0)
+		return (NULL);
+	return (k);
+}
+
+/*
+ * Serialized trees: a header, the node blocks of a frozen tree, count + 1
+ * key offsets and the key bytes, strings with their terminators.  Files
+ * are in host byte order and fully checked when opened.
+ */
+#define CRITBIT_MAGIC			"critbit1"
+#define CRITBIT_ORDER			0x01020304
+#define CRITBIT_M_INT			0x0001	/* integer key order */
+#define CRITBIT_M_STR			0x0002	/* NUL terminated keys */
+
+struct critbit_mhdr {
+	char			mh_magic[8];
+	uint32_t		mh_order;
+	uint32_t		mh_flags;
+	uint64_t		mh_keylen;
+	uint64_t		mh_count;
+	uint64_t		mh_nodes;	/* size of node blocks */
+	uint32_t		mh_root;
+	uint8_t			mh_pad[CRITBIT_CACHE_LINE - 44];
+};
+
+/* nodes start a cache line */
+typedef char critbit_mhdr_size[sizeof(struct critbit_mhdr) ==
+    CRITBIT_CACHE_LINE ? 1 : -1];
+
+struct critbit_writer {
+	int			fd;
+	int			error;
+	size_t			n;
+	uint8_t			buf[8192];
+};
+
+/* raw bytes of a stored key */
+typedef const uint8_t *critbit_keyraw_t(struct critbit_tree *t,
+    const struct critbit_key *k, size_t *len);
+
+static const uint8_t *
+critbit_buf_keyraw(struct critbit_tree *t, const struct critbit_key *k,
+    size_t *len)
+{
+	*len = t->ct_keylen;
+	return (critbit_buf_keybuf(k));
+}
+
+static const uint8_t *
+critbit_str_keyraw(struct critbit_tree *t, const struct critbit_key *k,
+    size_t *len)
+{
+	const uint8_t *a = critbit_str_keybuf(k);
+
+	*len = critbit_str_keylen(t, a);
+	return (a);
+}
+
+static const uint8_t *
+critbit_lstr_keyraw(struct critbit_tree *t CRITBIT_UNUSED,
+    const struct critbit_key *k, size_t *len)
+{
+	const struct critbit_lstr *s = (const struct critbit_lstr *)k;
+
+	*len = s->cl_len;
+	return ((const uint8_t *)s->cl_str);
+}
+
+static void
+critbit_flush(struct critbit_writer *w)
+{
+	size_t done = 0;
+	ssize_t r;
+
+	while (w->error == 0 && done < w->n) {
+		r = write(w->fd, w->buf + done, w->n - done);
+		if (r > 0)
+			done += r;
+		else if (r == 0)
+			w->error = EIO;
+		else if (errno != EINTR)
+			w->error = errno;
+	}
+	w->n = 0;
+}
+
+static void
+critbit_write(struct critbit_writer *w, const void *p, size_t len)
+{
+	const uint8_t *c = p;
+	size_t n;
+
+	while (len > 0) {
+		if (w->n == sizeof(w->buf))
+			critbit_flush(w);
+		n = sizeof(w->buf) - w->n;
+		if (n > len)
+			n = len;
+		memcpy(w->buf + w->n, c, n);
+		w->n += n;
+		c += n;
+		len -= n;
+	}
+}
+
+static int
+critbit_serialize_impl(struct critbit_tree *t, int fd, uint32_t flags,
+    critbit_keyraw_t *keyraw)
+{
+	struct critbit_frozen f;
+	struct critbit_mhdr h;
+	struct critbit_writer w;
+	const uint8_t *p;
+	uint64_t off;
+	size_t i, len, nsz;
+	int rv;
+
+	rv = critbit_freeze(t, &f);
+	if (rv != 0)
+		return (rv);
+	nsz = f.cf_count == 0 ? 0 : (size_t)((char *)f.cf_keys - f.cf_base);
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.mh_magic, CRITBIT_MAGIC, sizeof(h.mh_magic));
+	h.mh_order = CRITBIT_ORDER;
+	h.mh_flags = flags;
+	h.mh_keylen = flags & CRITBIT_M_STR ? 0 : t->ct_keylen;
+	h.mh_count = f.cf_count;
+	h.mh_nodes = nsz;
+	h.mh_root = f.cf_root;
+
+	w.fd = fd;
+	w.error = 0;
+	w.n = 0;
+	critbit_write(&w, &h, sizeof(h));
+	critbit_write(&w, f.cf_base, nsz);
+	for (i = 0, off = 0; i <= f.cf_count; ++i) {
+		critbit_write(&w, &off, sizeof(off));
+		if (i == f.cf_count)
+			break;
+		keyraw(t, f.cf_keys[i], &len);
+		off += len + (flags & CRITBIT_M_STR ? 1 : 0);
+	}
+	for (i = 0; i < f.cf_count; ++i) {
+		p = keyraw(t, f.cf_keys[i], &len);
+		critbit_write(&w, p, len);
+		if (flags & CRITBIT_M_STR)
+			critbit_write(&w, "", 1);
+	}
+	critbit_flush(&w);
+	critbit_frozen_free(&f);
+	return (w.error);
+}
+
+/* ref must be a key or a node slot at or after offset min */
+static int
+critbit_mmap_badref(const struct critbit_mhdr *h, uint64_t r, uint64_t min)
+{
+	if (!(r & 1))
+		return (r >> 1 >= h->mh_count);
+	r ^= 1;
+	return (r < min || r >= h->mh_nodes ||
+	    r % CRITBIT_CACHE_LINE % sizeof(struct critbit_cnode) != 0 ||
+	    r % CRITBIT_CACHE_LINE >=
+	    CRITBIT_FROZEN_BLOCK * sizeof(struct critbit_cnode));
+}
+
+/*
+ * Children must point forward, so walks are bounded.  Key offsets must
+ * ascend by the key length, strings must be terminated.
+ */
+static int
+critbit_mmap_check(const struct critbit_mhdr *h, const char *nodes,
+    const uint64_t *offs, const char *keys)
+{
+	const struct critbit_cnode *node;
+	uint64_t i, off, at;
+	int d;
+
+	if (h->mh_count > 0 && critbit_mmap_badref(h, h->mh_root, 0))
+		return (EINVAL);
+
+	for (off = 0; off < h->mh_nodes; off += CRITBIT_CACHE_LINE) {
+		for (i = 0; i < CRITBIT_FROZEN_BLOCK; ++i) {
+			at = off + i * sizeof(*node);
+			node = (const struct critbit_cnode *)(const void *)
+			    (nodes + at);
+			for (d = 0; d < 2; ++d) {
+				if (critbit_mmap_badref(h, node->child[d],
+				    at + 1))
+					return (EINVAL);
+			}
+		}
+	}
+	for (i = 0; i < h->mh_count; ++i) {
+		if (offs[i + 1] < offs[i] || offs[i + 1] > offs[h->mh_count])
+			return (EINVAL);
+		if (h->mh_flags & CRITBIT_M_STR ? offs[i + 1] == offs[i] ||
+		    keys[offs[i + 1] - 1] != '\0' :
+		    offs[i + 1] - offs[i] != h->mh_keylen)
+			return (EINVAL);
+	}
+	return (0);
+}
+
+int
+critbit_mmap_open(struct critbit_mapped *m, const char *path)
+{
+	const struct critbit_mhdr *h;
+	const uint64_t *offs;
+	struct stat st;
+	uint64_t avail;
+	void *map;
+	int fd, rv;
+
+	memset(m, 0, sizeof(*m));
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return (errno);
+	if (fstat(fd, &st) != 0) {
+		rv = errno;
+		close(fd);
+		return (rv);
+	}
+	if ((uint64_t)st.st_size < sizeof(*h)) {
+		close(fd);
+		return (EINVAL);
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	rv = map == MAP_FAILED ? errno : 0;
+	close(fd);
+	if (rv != 0)
+		return (rv);
+
+	h = map;
+	avail = st.st_size - sizeof(*h);
+	if (memcmp(h->mh_magic, CRITBIT_MAGIC, sizeof(h->mh_magic)) != 0 ||
+	    h->mh_order != CRITBIT_ORDER || h->mh_nodes > avail ||
+	    h->mh_nodes % CRITBIT_CACHE_LINE != 0 ||
+	    h->mh_count >= (avail - h->mh_nodes) / sizeof(*offs))
+		goto bad;
+	avail -= h->mh_nodes + (h->mh_count + 1) * sizeof(*offs);
+	offs = (const uint64_t *)(const void *)
+	    ((const char *)map + sizeof(*h) + h->mh_nodes);
+	if (offs[0] != 0 || offs[h->mh_count] > avail)
+		goto bad;
+	if (critbit_mmap_check(h, (const char *)map + sizeof(*h), offs,
+	    (const char *)(offs + h->mh_count + 1)) != 0)
+		goto bad;
+
+	m->cm_map = map;
+	m->cm_size = st.st_size;
+	m->cm_nodes = (const char *)map + sizeof(*h);
+	m->cm_offs = (const char *)offs;
+	m->cm_keys = (const char *)(offs + h->mh_count + 1);
+	m->cm_keylen = h->mh_keylen;
+	m->cm_count = h->mh_count;
+	m->cm_root = h->mh_root;
+	m->cm_flags = h->mh_flags;
+	return (0);
+bad:
+	munmap(map, st.st_size);
+	return (EINVAL);
+}
+
+void
+critbit_mmap_close(struct critbit_mapped *m)
+{
+	if (m->cm_map != NULL)
+		munmap(m->cm_map, m->cm_size);
+	memset(m, 0, sizeof(*m));
+}
+
+size_t
+critbit_mmap_count(const struct critbit_mapped *m)
+{
+	return (m->cm_count);
+}
+
+static __inline const uint8_t *
+critbit_mmap_keyat(const struct critbit_mapped *m, size_t i, size_t *len)
+{
+	const uint64_t *offs = (const uint64_t *)(const void *)m->cm_offs;
+
+	*len = offs[i + 1] - offs[i] - (m->cm_flags & CRITBIT_M_STR ? 1 : 0);
+	return ((const uint8_t *)m->cm_keys + offs[i]);
+}
+
+/* i-th key in order */
+const void *
+critbit_mmap_key(const struct critbit_mapped *m, size_t i)
+{
+	size_t len;
+
+	if (i >= m->cm_count)
+		return (NULL);
+	return (critbit_mmap_keyat(m, i, &len));
+}
+
+static __inline const struct critbit_cnode *
+critbit_mmap_node(const struct critbit_mapped *m, uint32_t ref)
+{
+	return ((const struct critbit_cnode *)(const void *)
+	    (m->cm_nodes + (ref ^ 1)));
+}
+
+/* rank of the leaf key is compared against */
+static __inline size_t
+critbit_mmap_leaf(const struct critbit_mapped *m, const uint8_t *key,
+    size_t len, critbit_keybyte_t *keybyte)
+{
+	const struct critbit_cnode *node;
+	uint32_t ref = m->cm_root;
+
+	while (ref & 1) {
+		node = critbit_mmap_node(m, ref);
+		ref = node->child[critbit_cnode_direction(node,
+		    keybyte(key, node->pos >> 8, len))];
+	}
+	return (ref >> 1);
+}
+
+static __inline size_t
+critbit_mmap_edge(const struct critbit_mapped *m, uint32_t ref, int dir)
+{
+	while (ref & 1)
+		ref = critbit_mmap_node(m, ref)->child[dir];
+	return (ref >> 1);
+}
+
+/* rank of the first key not less than key */
+static __inline size_t
+critbit_mmap_lower(const struct critbit_mapped *m, const uint8_t *key,
+    size_t len, critbit_keybyte_t *keybyte)
+{
+	const struct critbit_cnode *node;
+	const uint8_t *p;
+	size_t i, n, plen, r;
+	uint32_t ref, pos;
+	uint8_t bits;
+	int dir;
+
+	r = critbit_mmap_leaf(m, key, len, keybyte);
+	p = critbit_mmap_keyat(m, r, &plen);
+	n = len > plen ? len : plen;
+	i = keybyte == critbit_buf_keybyte ?
+	    critbit_mismatch(p, key, len < plen ? len : plen) : 0;
+	for (bits = 0; i < n; ++i) {
+		bits = keybyte(p, i, plen) ^ keybyte(key, i, len);
+		if (bits != 0)
+			break;
+	}
+	if (i == n)
+		return (r);
+
+	bits = ms1b8(bits) ^ 255;
+	pos = (uint32_t)i << 8 | bits;
+	dir = (1 + (bits | keybyte(key, i, len))) >> 8;
+	ref = m->cm_root;
+	while (ref & 1) {
+		node = critbit_mmap_node(m, ref);
+		if (node->pos > pos)
+			break;
+		ref = node->child[critbit_cnode_direction(node,
+		    keybyte(key, node->pos >> 8, len))];
+	}
+	return (dir ? critbit_mmap_edge(m, ref, 1) + 1 :
+	    critbit_mmap_edge(m, ref, 0));
+}
+
+static int
+critbit_mmap_visit(const struct critbit_mapped *m, size_t lo, size_t hi,
+    critbit_visit_t *visit, void *arg)
+{
+	size_t len;
+	int rv;
+
+	for (; lo < hi; ++lo) {
+		rv = visit(arg, (void *)(uintptr_t)critbit_mmap_keyat(m, lo,
+		    &len));
+		if (rv != 0)
+			return (rv);
+	}
+	return (0);
+}
+
+static __inline const void *
+critbit_mmap_get_impl(const struct critbit_mapped *m, const uint8_t *key,
+    size_t len, critbit_keybyte_t *keybyte)
+{
+	const uint8_t *p;
+	size_t plen;
+
+	if (m->cm_count == 0)
+		return (NULL);
+	p = critbit_mmap_keyat(m, critbit_mmap_leaf(m, key, len, keybyte),
+	    &plen);
+	if (plen != len || memcmp(p, key, len) != 0)
+		return (NULL);
+	return (p);
+}
+
+static __inline int
+critbit_mmap_prefix_impl(const struct critbit_mapped *m,
+    const uint8_t *prefix, size_t len, critbit_visit_t *visit, void *arg,
+    critbit_keybyte_t *keybyte)
+{
+	const struct critbit_cnode *node;
+	const uint8_t *p;
+	size_t i, lo, plen;
+	uint32_t ref;
+
+	if (m->cm_count == 0)
+		return (0);
+	ref = m->cm_root;
+	while (ref & 1) {
+		node = critbit_mmap_node(m, ref);
+		if (node->pos >> 8 >= len)
+			break;
+		ref = node->child[critbit_cnode_direction(node,
+		    keybyte(prefix, node->pos >> 8, len))];
+	}
+	lo = critbit_mmap_edge(m, ref, 0);
+	p = critbit_mmap_keyat(m, lo, &plen);
+	for (i = 0; i < len; ++i) {
+		if (keybyte(p, i, plen) != keybyte(prefix, i, len))
+			return (0);
+	}
+	return (critbit_mmap_visit(m, lo, critbit_mmap_edge(m, ref, 1) + 1,
+	    visit, arg));
+}
+
+static __inline int
+critbit_mmap_range_impl(const struct critbit_mapped *m, const uint8_t *lo,
+    size_t lolen, const uint8_t *hi, size_t hilen, critbit_visit_t *visit,
+    void *arg, critbit_keybyte_t *keybyte)
+{
+	size_t rlo, rhi;
+
+	if (m->cm_count == 0)
+		return (0);
+	rlo = lo == NULL ? 0 : critbit_mmap_lower(m, lo, lolen, keybyte);
+	rhi = hi == NULL ? m->cm_count :
+	    critbit_mmap_lower(m, hi, hilen, keybyte);
+	return (critbit_mmap_visit(m, rlo, rhi, visit, arg));
+}
+
+/* returns the mapped key */
+const void *
+critbit_mmap_get(const struct critbit_mapped *m, const void *key, size_t len)
+{
+	if (m->cm_flags & CRITBIT_M_INT)
+		return (critbit_mmap_get_impl(m, key, len,
+		    critbit_int_keybyte));
+	return (critbit_mmap_get_impl(m, key, len, critbit_buf_keybyte));
+}
+
+int
+critbit_mmap_prefix(const struct critbit_mapped *m, const void *prefix,
+    size_t len, critbit_visit_t *visit, void *arg)
+{
+	if (m->cm_flags & CRITBIT_M_INT)
+		return (critbit_mmap_prefix_impl(m, prefix, len, visit, arg,
+		    critbit_int_keybyte));
+	return (critbit_mmap_prefix_impl(m, prefix, len, visit, arg,
+	    critbit_buf_keybyte));
+}
+
+int
+critbit_mmap_range(const struct critbit_mapped *m, const void *lo,
+    size_t lolen, const void *hi, size_t hilen, critbit_visit_t *visit,
+    void *arg)
+{
+	if (m->cm_flags & CRITBIT_M_INT)
+		return (critbit_mmap_range_impl(m, lo, lolen, hi, hilen, visit,
+		    arg, critbit_int_keybyte));
+	return (critbit_mmap_range_impl(m, lo, lolen, hi, hilen, visit, arg,
+	    critbit_buf_keybyte));
+}
+
+/*
+ * Snapshots: a header, the nodes in post-order with children as indices,
+ * i << 1 | 1 for node i and i << 1 for leaf i, then the elements in key
+ * order.  Node records are padded to the pool stride so restore can read
+ * them straight into slabs.
+ */
+#define CRITBIT_SNAP_MAGIC		"critsnp1"
+#define CRITBIT_SNAP_COUNT		0
+#define CRITBIT_SNAP_NODES		1
+#define CRITBIT_SNAP_ELEMS		2
+
+struct critbit_shdr {
+	char			sh_magic[8];
+	uint32_t		sh_order;
+	uint32_t		sh_flags;
+	uint64_t		sh_keylen;
+	uint64_t		sh_count;
+	uint64_t		sh_elemsize;
+	uint64_t		sh_keyoff;
+	uint64_t		sh_nodesize;	/* record size */
+	uint64_t		sh_root;
+};
+
+struct critbit_snapper {
+	struct critbit_writer	w;
+	size_t			nodesize;	/* in the tree */
+	size_t			recsize;	/* in the file */
+	size_t			elemsize;
+	size_t			keyoff;
+	size_t			nodes;
+	size_t			leaves;
+};
+
+struct critbit_snap_frame {
+	struct critbit_node	*node;
+	uint64_t		c0;
+	int			right;	/* walking child[1] */
+};
+
+/* node whose children were numbered c0 and c1 */
+static uint64_t
+critbit_snapshot_node(struct critbit_snapper *z, struct critbit_node *node,
+    uint64_t c0, uint64_t c1, int pass)
+{
+	struct critbit_entry rec;
+
+	if (pass == CRITBIT_SNAP_NODES) {
+		memset(&rec, 0, sizeof(rec));
+		memcpy(&rec, node, z->nodesize);
+		node = (struct critbit_node *)(void *)&rec;
+		node->child[0] = (struct critbit_ref *)(uintptr_t)c0;
+		node->child[1] = (struct critbit_ref *)(uintptr_t)c1;
+		critbit_write(&z->w, &rec, z->recsize);
+	}
+	return ((uint64_t)z->nodes++ << 1 | 1);
+}
+
+/*
+ * Returns the index ref of ref, numbering nodes and leaves in post-order
+ * as it goes.  Subtrees entered deeper than CRITBIT_CURSOR_DEPTH are
+ * walked by recursion.
+ */
+static uint64_t
+critbit_snapshot_walk(struct critbit_snapper *z, struct critbit_ref *ref,
+    int pass)
+{
+	struct critbit_snap_frame stack[CRITBIT_CURSOR_DEPTH];
+	struct critbit_node *node;
+	size_t sp = 0;
+	uint64_t r;
+
+	for (;;) {
+		if (critbit_ref_is_internal(ref) && sp < CRITBIT_CURSOR_DEPTH) {
+			node = critbit_ref_get_node(ref);
+			stack[sp].node = node;
+			stack[sp++].right = 0;
+			ref = node->child[0];
+			continue;
+		}
+		if (critbit_ref_is_internal(ref))
+			r = critbit_snapshot_walk(z, ref, pass);
+		else {
+			if (pass == CRITBIT_SNAP_ELEMS)
+				critbit_write(&z->w,
+				    (char *)critbit_ref_get_key(ref) -
+				    z->keyoff, z->elemsize);
+			r = (uint64_t)z->leaves++ << 1;
+		}
+
+		/* r numbers the subtree just walked */
+		while (sp > 0 && stack[sp - 1].right) {
+			sp--;
+			r = critbit_snapshot_node(z, stack[sp].node,
+			    stack[sp].c0, r, pass);
+		}
+		if (sp == 0)
+			return (r);
+		stack[sp - 1].c0 = r;
+		stack[sp - 1].right = 1;
+		ref = stack[sp - 1].node->child[1];
+	}
+}
+
+int
+critbit_snapshot(struct critbit_tree *t, int fd, size_t elemsize,
+    size_t keyoff)
+{
+	struct critbit_snapper z;
+	struct critbit_shdr h;
+
+	z.w.fd = fd;
+	z.w.error = 0;
+	z.w.n = 0;
+	z.nodesize = critbit_tree_node_size(t);
+	z.recsize = (z.nodesize + 7) & ~(size_t)7;
+	z.elemsize = elemsize;
+	z.keyoff = keyoff;
+	z.nodes = z.leaves = 0;
+	if (t->ct_root != NULL)
+		critbit_snapshot_walk(&z, t->ct_root, CRITBIT_SNAP_COUNT);
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.sh_magic, CRITBIT_SNAP_MAGIC, sizeof(h.sh_magic));
+	h.sh_order = CRITBIT_ORDER;
+	h.sh_flags = t->ct_flags & (CRITBIT_F_COUNT | CRITBIT_F_HASH);
+	h.sh_keylen = t->ct_keylen;
+	h.sh_count = z.leaves;
+	h.sh_elemsize = elemsize;
+	h.sh_keyoff = keyoff;
+	h.sh_nodesize = z.recsize;
+	/* root comes last in post-order */
+	h.sh_root = z.nodes == 0 ? 0 : (uint64_t)(z.nodes - 1) << 1 | 1;
+	critbit_write(&z.w, &h, sizeof(h));
+
+	if (t->ct_root != NULL) {
+		z.nodes = z.leaves = 0;
+		critbit_snapshot_walk(&z, t->ct_root, CRITBIT_SNAP_NODES);
+		z.nodes = z.leaves = 0;
+		critbit_snapshot_walk(&z, t->ct_root, CRITBIT_SNAP_ELEMS);
+	}
+	critbit_flush(&z.w);
+	return (z.w.error);
+}
+
+static int
+critbit_read_full(int fd, void *p, size_t len)
+{
+	uint8_t *c = p;
+	ssize_t r;
+
+	while (len > 0) {
+		r = read(fd, c, len);
+		if (r > 0) {
+			c += r;
+			len -= r;
+		} else if (r == 0)
+			return (EINVAL);	/* truncated */
+		else if (errno != EINTR)
+			return (errno);
+	}
+	return (0);
+}
+
+/* up to *n fresh nodes contiguous in one slab */
+static char *
+critbit_node_pool_run(struct critbit_node_pool *p, size_t *n)
+{
+	char *run;
+	size_t max;
+
+	CRITBIT_ASSERT(p->cp_free == NULL);
+	if (p->cp_left < p->cp_size) {
+		if (critbit_node_pool_alloc(p) == NULL)
+			return (NULL);
+		p->cp_next -= p->cp_size;
+		p->cp_left += p->cp_size;
+	}
+	max = p->cp_left / p->cp_size;
+	if (*n > max)
+		*n = max;
+	run = p->cp_next;
+	p->cp_next += *n * p->cp_size;
+	p->cp_left -= *n * p->cp_size;
+	return (run);
+}
+
+struct critbit_restorer {
+	struct critbit_node	**tab;
+	char			*elems;
+	uint8_t			*seen;	/* nodes, then leaves */
+	size_t			nodes;
+	size_t			count;
+	size_t			elemsize;
+	size_t			keyoff;
+};
+
+/*
+ * Children of node i have lower indices, so stored refs cannot loop.
+ * There are as many refs as nodes and leaves, so once none is taken
+ * twice each is taken exactly once and the refs form one tree.
+ */
+static int
+critbit_restore_ref(struct critbit_restorer *z, struct critbit_ref **ref,
+    uint64_t r, size_t i)
+{
+	size_t bit;
+
+	if (r & 1) {
+		if (r >> 1 >= i)
+			return (EINVAL);
+		bit = r >> 1;
+	} else {
+		if (r >> 1 >= z->count)
+			return (EINVAL);
+		bit = z->nodes + (r >> 1);
+	}
+	if (z->seen[bit / 8] & (1 << bit % 8))
+		return (EINVAL);
+	z->seen[bit / 8] |= 1 << bit % 8;
+	if (r & 1)
+		critbit_ref_set_node(ref, z->tab[r >> 1]);
+	else
+		critbit_ref_set_key(ref, (struct critbit_key *)(void *)
+		    (z->elems + (r >> 1) * z->elemsize + z->keyoff));
+	return (0);
+}
+
+/*
+ * Nodes are read run by run into the slabs of the pool and the elements
+ * into one array, then a single pass turns indices back into pointers.
+ * Fixed length keys must fit in the element and every critical byte in
+ * the key.
+ */
+int
+critbit_restore(struct critbit_tree *t, struct critbit_node_pool *pool,
+    int fd, size_t elemsize, size_t keyoff, int fixed, void **elems,
+    critbit_relocate_t *reloc, void *arg)
+{
+	struct critbit_restorer z;
+	struct critbit_shdr h;
+	struct critbit_node *node;
+	struct critbit_ref *root;
+	size_t i, j, n, nodes;
+	char *run;
+	int rv;
+
+	*elems = NULL;
+	rv = critbit_read_full(fd, &h, sizeof(h));
+	if (rv == 0 && (memcmp(h.sh_magic, CRITBIT_SNAP_MAGIC,
+	    sizeof(h.sh_magic)) != 0 || h.sh_order != CRITBIT_ORDER ||
+	    (h.sh_flags & ~(CRITBIT_F_COUNT | CRITBIT_F_HASH)) != 0 ||
+	    h.sh_elemsize != elemsize || h.sh_keyoff != keyoff ||
+	    (fixed && (keyoff > elemsize ||
+	    h.sh_keylen > elemsize - keyoff)) ||
+	    (elemsize > 0 && h.sh_count > SIZE_MAX / elemsize) ||
+	    h.sh_count > SIZE_MAX / sizeof(*z.tab)))
+		rv = EINVAL;
+	/* pool and tree are valid on every return */
+	critbit_init_flags(t, critbit_node_pool_free, pool,
+	    rv == 0 ? h.sh_keylen : 0, rv == 0 ? h.sh_flags : 0);
+	critbit_node_pool_init(pool, critbit_tree_node_size(t));
+	if (rv != 0)
+		return (rv);
+	if (h.sh_nodesize != pool->cp_size)
+		return (EINVAL);
+	if (h.sh_count == 0)
+		return (0);
+
+	nodes = h.sh_count - 1;
+	z.nodes = nodes;
+	z.count = h.sh_count;
+	z.elemsize = elemsize;
+	z.keyoff = keyoff;
+	z.tab = malloc((nodes + 1) * sizeof(*z.tab));
+	z.elems = malloc(z.count * elemsize + 1);
+	z.seen = calloc((nodes + z.count + 7) / 8, 1);
+	if (z.tab == NULL || z.elems == NULL || z.seen == NULL) {
+		rv = ENOMEM;
+		goto fail;
+	}
+	for (i = 0; i < nodes; i += n) {
+		n = nodes - i;
+		run = critbit_node_pool_run(pool, &n);
+		if (run == NULL) {
+			rv = ENOMEM;
+			goto fail;
+		}
+		rv = critbit_read_full(fd, run, n * pool->cp_size);
+		if (rv != 0)
+			goto fail;
+		for (j = 0; j < n; ++j)
+			z.tab[i + j] = (struct critbit_node *)(void *)
+			    (run + j * pool->cp_size);
+	}
+	rv = critbit_read_full(fd, z.elems, z.count * elemsize);
+	if (rv != 0)
+		goto fail;
+	for (i = 0; reloc != NULL && i < z.count; ++i) {
+		rv = reloc(arg, z.elems + i * elemsize);
+		if (rv != 0)
+			goto fail;
+	}
+
+	for (i = 0; i < nodes; ++i) {
+		node = z.tab[i];
+		if (fixed && node->byte >= t->ct_keylen)
+			goto fail;
+		for (j = 0; j < 2; ++j) {
+			rv = critbit_restore_ref(&z, &node->child[j],
+			    (uintptr_t)node->child[j], i);
+			if (rv != 0)
+				goto fail;
+		}
+	}
+	rv = critbit_restore_ref(&z, &root, h.sh_root, nodes);
+	if (rv != 0 || (nodes > 0 && h.sh_root != ((nodes - 1) << 1 | 1)))
+		goto fail;
+	t->ct_root = root;
+	free(z.tab);
+	free(z.seen);
+	*elems = z.elems;
+	return (0);
+fail:
+	critbit_node_pool_destroy(pool);
+	free(z.tab);
+	free(z.seen);
+	free(z.elems);
+	t->ct_root = NULL;
+	return (rv == 0 ? EINVAL : rv);
+}
+
+void *
+critbit_buf_get(struct critbit_tree *t, const void *key)
+{
+	return (critbit_get_impl(t, key, critbit_buf_keylen(t, key),
+	    critbit_buf_keycmp, critbit_buf_keybuf, critbit_buf_keybyte));
+}
+
+void
+critbit_buf_get_batch(struct critbit_tree *t, const void *const *keys, size_t n,
+    void **out)
+{
+	critbit_get_batch_impl(t, (const void *const *)keys, n, out,
+	    critbit_buf_keylen, critbit_buf_keycmp, critbit_buf_keybuf,
+	    critbit_buf_keybyte);
+}
+
+void *
+critbit_buf_insert(struct critbit_tree *t,
+    struct critbit_node *newnode, const void *key)
+{
+	return (critbit_insert_impl(t, newnode, (const struct critbit_key *)key,
+	    0, critbit_buf_keylen(t, NULL), critbit_buf_keylen,
+	    critbit_buf_keybuf, critbit_buf_keybyte, critbit_buf_keydiff));
+}
+
+void *
+critbit_buf_replace(struct critbit_tree *t,
+    struct critbit_node *newnode, const void *key)
+{
+	return (critbit_insert_impl(t, newnode, (const struct critbit_key *)key,
+	    1, critbit_buf_keylen(t, NULL), critbit_buf_keylen,
+	    critbit_buf_keybuf, critbit_buf_keybyte, critbit_buf_keydiff));
+}
+
+void *
+critbit_buf_find_or_prepare(struct critbit_tree *t, const void *key,
+    struct critbit_slot *slot)
+{
+	return (critbit_prepare_impl(t, key, critbit_buf_keylen(t, key), slot,
+	    critbit_buf_keybuf, critbit_buf_keybyte, critbit_buf_keydiff));
+}
+
+void
+critbit_buf_commit(struct critbit_slot *slot, struct critbit_node *newnode,
+    const void *key)
+{
+	critbit_commit_impl(slot, newnode, (const struct critbit_key *)key,
+	    critbit_buf_keylen(slot->cs_tree, NULL), critbit_buf_keylen,
+	    critbit_buf_keybuf, critbit_buf_keybyte);
+}
+
+void *
+critbit_buf_insert_finger(struct critbit_tree *t, struct critbit_cursor *finger,
+    struct critbit_node *newnode, const void *key)
+{
+	return (critbit_insert_finger_impl(t, finger, newnode,
+	    (const struct critbit_key *)key,
+	    critbit_buf_keylen(t, NULL), critbit_buf_keylen,
+	    critbit_buf_keybuf, critbit_buf_keybyte, critbit_buf_keydiff));
+}
+
+void *
+critbit_buf_remove(struct critbit_tree *t, const void *key)
+{
+	return (critbit_remove_impl(t, key, critbit_buf_keylen(t, key), 0, 0,
+	    critbit_buf_keycmp, critbit_buf_keybuf, critbit_buf_keybyte));
+}
+
+void *
+critbit_buf_remove_entry(struct critbit_tree *t, const void *key,
+    ptrdiff_t entryoff)
+{
+	return (critbit_remove_impl(t, key, critbit_buf_keylen(t, key), 1,
+	    entryoff, critbit_buf_keycmp, critbit_buf_keybuf,
+	    critbit_buf_keybyte));
+}
+
+int
+critbit_buf_bulk_load(struct critbit_tree *t, void *const *elems, size_t n,
+    size_t offset, struct critbit_node **nodes)
+{
+	return (critbit_bulk_load_impl(t, elems, n, offset, nodes,
+	    critbit_buf_keylen, critbit_buf_keybuf, critbit_buf_keybyte,
+	    critbit_buf_keydiff));
+}
+
+void
+critbit_buf_merge(struct critbit_tree *dst, struct critbit_tree *src,
+    struct critbit_node *spare, critbit_merge_t *conflict, void *arg)
+{
+	critbit_merge_trees(dst, src, spare, conflict, arg,
+	    critbit_buf_keylen, critbit_buf_keybuf, critbit_buf_keybyte,
+	    critbit_buf_keydiff);
+}
+
+void
+critbit_buf_split(struct critbit_tree *t, const void *key,
+    struct critbit_tree *left, struct critbit_tree *right)
+{
+	critbit_split_impl(t, key, critbit_buf_keylen(t, key), left, right,
+	    critbit_buf_keylen, critbit_buf_keybuf, critbit_buf_keybyte,
+	    critbit_buf_keydiff);
+}
+
+int
+critbit_buf_join(struct critbit_tree *left, struct critbit_tree *right,
+    struct critbit_node *node)
+{
+	return (critbit_join_impl(left, right, node, critbit_buf_keylen,
+	    critbit_buf_keybuf, critbit_buf_keybyte, critbit_buf_keydiff));
+}
+
+void *
+critbit_buf_next(struct critbit_cursor *c)
+{
+	return (critbit_cursor_step_impl(c, 1, 0, critbit_buf_keylen,
+	    critbit_buf_keybuf, critbit_buf_keybyte));
+}
+
+void *
+critbit_buf_prev(struct critbit_cursor *c)
+{
+	return (critbit_cursor_step_impl(c, 0, 0, critbit_buf_keylen,
+	    critbit_buf_keybuf, critbit_buf_keybyte));
+}
+
+size_t
+critbit_buf_rank(struct critbit_tree *t, const void *key)
+{
+	return (critbit_rank_impl(t, key, t->ct_keylen,
+	    critbit_buf_keybuf, critbit_buf_keybyte, critbit_buf_keydiff));
+}
+
+size_t
+critbit_buf_count_range(struct critbit_tree *t, const void *lo,
+    const void *hi)
+{
+	size_t rlo, rhi;
+
+	rlo = lo == NULL ? 0 : critbit_buf_rank(t, lo);
+	rhi = hi == NULL ? critbit_count(t) : critbit_buf_rank(t, hi);
+	return (rhi > rlo ? rhi - rlo : 0);
+}
+
+void *
+critbit_buf_seek(struct critbit_tree *t, struct critbit_cursor *c,
+    const void *key, int how)
+{
+	struct critbit_cursor tmp;
+
+	if (c == NULL)
+		c = &tmp;
+	return (critbit_seek_impl(t, c, key,
+	    critbit_buf_keylen(t, key), how,
+	    critbit_buf_keylen, critbit_buf_keybuf, critbit_buf_keybyte,
+	    critbit_buf_keydiff));
+}
+
+int
+critbit_buf_range(struct critbit_tree *t, const void *lo, const void *hi,
+    critbit_visit_t *visit, void *arg)
+{
+	return (critbit_range_impl(t, lo, t->ct_keylen, hi, t->ct_keylen,
+	    visit, arg, critbit_buf_keylen, critbit_buf_keybuf,
+	    critbit_buf_keybyte, critbit_buf_keydiff));
+}
+
+int
+critbit_buf_prefix(struct critbit_tree *t, const void *prefix, size_t len,
+    critbit_visit_t *visit, void *arg)
+{
+	if (len > t->ct_keylen)
+		return (0);
+	return (critbit_prefix_impl(t, prefix, len, len, visit, arg,
+	    critbit_buf_keylen, critbit_buf_keybuf, critbit_buf_keybyte));
+}
+
+size_t
+critbit_buf_prefix_count(struct critbit_tree *t, const void *prefix, size_t len)
+{
+	if (len > t->ct_keylen)
+		return (0);
+	return (critbit_prefix_count_impl(t, prefix, len, len,
+	    critbit_buf_keylen, critbit_buf_keybuf, critbit_buf_keybyte));
+}
+
+int
+critbit_buf_intersect_foreach(struct critbit_tree *a, struct critbit_tree *b,
+    critbit_visit_t *visit, void *arg)
+{
+	return (critbit_setop(a, b, 0, visit, arg, critbit_buf_keylen,
+	    critbit_buf_keybuf, critbit_buf_keybyte, critbit_buf_keydiff));
+}
+
+int
+critbit_buf_diff_foreach(struct critbit_tree *a, struct critbit_tree *b,
+    critbit_visit_t *visit, void *arg)
+{
+	return (critbit_setop(a, b, 1, visit, arg, critbit_buf_keylen,
+	    critbit_buf_keybuf, critbit_buf_keybyte, critbit_buf_keydiff));
+}
+
+int
+critbit_buf_diff(struct critbit_tree *a, struct critbit_tree *b,
+    critbit_diff_t *visit, void *arg)
+{
+	return (critbit_hashdiff(a, b, visit, arg, critbit_buf_keylen,
+	    critbit_buf_keybuf, critbit_buf_keybyte, critbit_buf_keydiff));
+}
+
+void *
+critbit_buf_cget(struct critbit_ctree *t, const void *key)
+{
+	return (critbit_cget_impl(t, key, t->cx_keylen,
+	    critbit_buf_keycmp, critbit_buf_keybuf, critbit_buf_keybyte));
+}
+
+int
+critbit_buf_cinsert(struct critbit_ctree *t, const void *key, void **existing)
+{
+	return (critbit_cinsert_impl(t, (const struct critbit_key *)key,
+	    t->cx_keylen, existing, critbit_buf_keybuf, critbit_buf_keybyte,
+	    critbit_buf_keydiff));
+}
+
+void *
+critbit_buf_cremove(struct critbit_ctree *t, const void *key)
+{
+	return (critbit_cremove_impl(t, key, t->cx_keylen,
+	    critbit_buf_keycmp, critbit_buf_keybuf, critbit_buf_keybyte));
+}
+
+void *
+critbit_buf_fget(const struct critbit_frozen *f, const void *key)
+{
+	return (critbit_fget_impl(f, key, f->cf_keylen,
+	    critbit_buf_keycmp, critbit_buf_keybuf, critbit_buf_keybyte));
+}
+
+int
+critbit_buf_serialize(struct critbit_tree *t, int fd)
+{
+	return (critbit_serialize_impl(t, fd, 0, critbit_buf_keyraw));
+}
+
+void *
+critbit_int_get(struct critbit_tree *t, const void *key)
+{
+	return (critbit_get_impl(t, key, critbit_buf_keylen(t, key),
+	    critbit_buf_keycmp, critbit_buf_keybuf, critbit_int_keybyte));
+}
+
+void
+critbit_int_get_batch(struct critbit_tree *t, const void *const *keys, size_t n,
+    void **out)
+{
+	critbit_get_batch_impl(t, (const void *const *)keys, n, out,
+	    critbit_buf_keylen, critbit_buf_keycmp, critbit_buf_keybuf,
+	    critbit_int_keybyte);
+}
+
+void *
+critbit_int_insert(struct critbit_tree *t,
+    struct critbit_node *newnode, const void *key)
+{
+	return (critbit_insert_impl(t, newnode, (const struct critbit_key *)key,
+	    0, critbit_buf_keylen(t, NULL), critbit_buf_keylen,
+	    critbit_buf_keybuf, critbit_int_keybyte, critbit_int_keydiff));
+}
+
+void *
+critbit_int_replace(struct critbit_tree *t,
+    struct critbit_node *newnode, const void *key)
+{
+	return (critbit_insert_impl(t, newnode, (const struct critbit_key *)key,
+	    1, critbit_buf_keylen(t, NULL), critbit_buf_keylen,
+	    critbit_buf_keybuf, critbit_int_keybyte, critbit_int_keydiff));
+}
+
+void *
+critbit_int_find_or_prepare(struct critbit_tree *t, const void *key,
+    struct critbit_slot *slot)
+{
+	return (critbit_prepare_impl(t, key, critbit_buf_keylen(t, key), slot,
+	    critbit_buf_keybuf, critbit_int_keybyte, critbit_int_keydiff));
+}
+
+void
+critbit_int_commit(struct critbit_slot *slot, struct critbit_node *newnode,
+    const void *key)
+{
+	critbit_commit_impl(slot, newnode, (const struct critbit_key *)key,
+	    critbit_buf_keylen(slot->cs_tree, NULL), critbit_buf_keylen,
+	    critbit_buf_keybuf, critbit_int_keybyte);
+}
+
+void *
+critbit_int_insert_finger(struct critbit_tree *t, struct critbit_cursor *finger,
+    struct critbit_node *newnode, const void *key)
+{
+	return (critbit_insert_finger_impl(t, finger, newnode,
+	    (const struct critbit_key *)key,
+	    critbit_buf_keylen(t, NULL), critbit_buf_keylen,
+	    critbit_buf_keybuf, critbit_int_keybyte, critbit_int_keydiff));
+}
+
+void *
+critbit_int_remove(struct critbit_tree *t, const void *key)
+{
+	return (critbit_remove_impl(t, key, critbit_buf_keylen(t, key), 0, 0,
+	    critbit_buf_keycmp, critbit_buf_keybuf, critbit_int_keybyte));
+}
+
+void *
+critbit_int_remove_entry(struct critbit_tree *t, const void *key,
+    ptrdiff_t entryoff)
+{
+	return (critbit_remove_impl(t, key, critbit_buf_keylen(t, key), 1,
+	    entryoff, critbit_buf_keycmp, critbit_buf_keybuf,
+	    critbit_int_keybyte));
+}
+
+int
+critbit_int_bulk_load(struct critbit_tree *t, void *const *elems, size_t n,
+    size_t offset, struct critbit_node **nodes)
+{
+	return (critbit_bulk_load_impl(t, elems, n, offset, nodes,
+	    critbit_buf_keylen, critbit_buf_keybuf, critbit_int_keybyte,
+	    critbit_int_keydiff));
+}
+
+void
+critbit_int_merge(struct critbit_tree *dst, struct critbit_tree *src,
+    struct critbit_node *spare, critbit_merge_t *conflict, void *arg)
+{
+	critbit_merge_trees(dst, src, spare, conflict, arg,
+	    critbit_buf_keylen, critbit_buf_keybuf, critbit_int_keybyte,
+	    critbit_int_keydiff);
+}
+
+void
+critbit_int_split(struct critbit_tree *t, const void *key,
+    struct critbit_tree *left, struct critbit_tree *right)
+{
+	critbit_split_impl(t, key, critbit_buf_keylen(t, key), left, right,
+	    critbit_buf_keylen, critbit_buf_keybuf, critbit_int_keybyte,
+	    critbit_int_keydiff);
+}
+
+int
+critbit_int_join(struct critbit_tree *left, struct critbit_tree *right,
+    struct critbit_node *node)
+{
+	return (critbit_join_impl(left, right, node, critbit_buf_keylen,
+	    critbit_buf_keybuf, critbit_int_keybyte, critbit_int_keydiff));
+}
+
+void *
+critbit_int_next(struct critbit_cursor *c)
+{
+	return (critbit_cursor_step_impl(c, 1, 0, critbit_buf_keylen,
+	    critbit_buf_keybuf, critbit_int_keybyte));
+}
+
+void *
+critbit_int_prev(struct critbit_cursor *c)
+{
+	return (critbit_cursor_step_impl(c, 0, 0, critbit_buf_keylen,
+	    critbit_buf_keybuf, critbit_int_keybyte));
+}
+
+size_t
+critbit_int_rank(struct critbit_tree *t, const void *key)
+{
+	return (critbit_rank_impl(t, key, t->ct_keylen,
+	    critbit_buf_keybuf, critbit_int_keybyte, critbit_int_keydiff));
+}
+
+size_t
+critbit_int_count_range(struct critbit_tree *t, const void *lo,
+    const void *hi)
+{
+	size_t rlo, rhi;
+
+	rlo = lo == NULL ? 0 : critbit_int_rank(t, lo);
+	rhi = hi == NULL ? critbit_count(t) : critbit_int_rank(t, hi);
+	return (rhi > rlo ? rhi - rlo : 0);
+}
+
+void *
+critbit_int_seek(struct critbit_tree *t, struct critbit_cursor *c,
+    const void *key, int how)
+{
+	struct critbit_cursor tmp;
+
+	if (c == NULL)
+		c = &tmp;
+	return (critbit_seek_impl(t, c, key,
+	    critbit_buf_keylen(t, key), how,
+	    critbit_buf_keylen, critbit_buf_keybuf, critbit_int_keybyte,
+	    critbit_int_keydiff));
+}
+
+int
+critbit_int_range(struct critbit_tree *t, const void *lo, const void *hi,
+    critbit_visit_t *visit, void *arg)
+{
+	return (critbit_range_impl(t, lo, t->ct_keylen, hi, t->ct_keylen,
+	    visit, arg, critbit_buf_keylen, critbit_buf_keybuf,
+	    critbit_int_keybyte, critbit_int_keydiff));
+}
+
+int
+critbit_int_prefix(struct critbit_tree *t, const void *prefix, size_t len,
+    critbit_visit_t *visit, void *arg)
+{
+	if (len > t->ct_keylen)
+		return (0);
+	return (critbit_prefix_impl(t, prefix, len, t->ct_keylen, visit, arg,
+	    critbit_buf_keylen, critbit_buf_keybuf, critbit_int_keybyte));
+}
+
+size_t
+critbit_int_prefix_count(struct critbit_tree *t, const void *prefix, size_t len)
+{
+	if (len > t->ct_keylen)
+		return (0);
+	return (critbit_prefix_count_impl(t, prefix, len, t->ct_keylen,
+	    critbit_buf_keylen, critbit_buf_keybuf, critbit_int_keybyte));
+}
+
+int
+critbit_int_intersect_foreach(struct critbit_tree *a, struct critbit_tree *b,
+    critbit_visit_t *visit, void *arg)
+{
+	return (critbit_setop(a, b, 0, visit, arg, critbit_buf_keylen,
+	    critbit_buf_keybuf, critbit_int_keybyte, critbit_int_keydiff));
+}
+
+int
+critbit_int_diff_foreach(struct critbit_tree *a, struct critbit_tree *b,
+    critbit_visit_t *visit, void *arg)
+{
+	return (critbit_setop(a, b, 1, visit, arg, critbit_buf_keylen,
+	    critbit_buf_keybuf, critbit_int_keybyte, critbit_int_keydiff));
+}
+
+int
+critbit_int_diff(struct critbit_tree *a, struct critbit_tree *b,
+    critbit_diff_t *visit, void *arg)
+{
+	return (critbit_hashdiff(a, b, visit, arg, critbit_buf_keylen,
+	    critbit_buf_keybuf, critbit_int_keybyte, critbit_int_keydiff));
+}
+
+void *
+critbit_int_cget(struct critbit_ctree *t, const void *key)
+{
+	return (critbit_cget_impl(t, key, t->cx_keylen,
+	    critbit_buf_keycmp, critbit_buf_keybuf, critbit_int_keybyte));
+}
+
+int
+critbit_int_cinsert(struct critbit_ctree *t, const void *key, void **existing)
+{
+	return (critbit_cinsert_impl(t, (const struct critbit_key *)key,
+	    t->cx_keylen, existing, critbit_buf_keybuf, critbit_int_keybyte,
+	    critbit_int_keydiff));
+}
+
+void *
+critbit_int_cremove(struct critbit_ctree *t, const void *key)
+{
+	return (critbit_cremove_impl(t, key, t->cx_keylen,
+	    critbit_buf_keycmp, critbit_buf_keybuf, critbit_int_keybyte));
+}
+
+void *
+critbit_int_fget(const struct critbit_frozen *f, const void *key)
+{
+	return (critbit_fget_impl(f, key, f->cf_keylen,
+	    critbit_buf_keycmp, critbit_buf_keybuf, critbit_int_keybyte));
+}
+
+int
+critbit_int_serialize(struct critbit_tree *t, int fd)
+{
+	return (critbit_serialize_impl(t, fd, CRITBIT_M_INT,
+	    critbit_buf_keyraw));
+}
+
+void *
+critbit_str_get(struct critbit_tree *t, const char *key)
+{
+	return (critbit_get_impl(t, key,
+	    critbit_str_keylen(t, (const uint8_t *)key),
+	    critbit_str_keycmp, critbit_str_keybuf, critbit_str_keybyte));
+}
+
+void
+critbit_str_get_batch(struct critbit_tree *t, const char *const *keys, size_t n,
+    void **out)
+{
+	critbit_get_batch_impl(t, (const void *const *)keys, n, out,
+	    critbit_str_keylen, critbit_str_keycmp, critbit_str_keybuf,
+	    critbit_str_keybyte);
+}
+
+void *
+critbit_str_insert(struct critbit_tree *t,
+    struct critbit_node *newnode, const char **key)
+{
+	return (critbit_insert_impl(t, newnode, (const struct critbit_key *)key,
+	    0, critbit_str_keylen(t, (const uint8_t *)*key), critbit_str_keylen,
+	    critbit_str_keybuf, critbit_str_keybyte, critbit_str_keydiff));
+}
+
+void *
+critbit_str_replace(struct critbit_tree *t,
+    struct critbit_node *newnode, const char **key)
+{
+	return (critbit_insert_impl(t, newnode, (const struct critbit_key *)key,
+	    1, critbit_str_keylen(t, (const uint8_t *)*key), critbit_str_keylen,
+	    critbit_str_keybuf, critbit_str_keybyte, critbit_str_keydiff));
+}
+
+void *
+critbit_str_find_or_prepare(struct critbit_tree *t, const char *key,
+    struct critbit_slot *slot)
+{
+	return (critbit_prepare_impl(t, key,
+	    critbit_str_keylen(t, (const uint8_t *)key), slot,
+	    critbit_str_keybuf, critbit_str_keybyte, critbit_str_keydiff));
+}
+
+void
+critbit_str_commit(struct critbit_slot *slot, struct critbit_node *newnode,
+    const char **key)
+{
+	critbit_commit_impl(slot, newnode, (const struct critbit_key *)key,
+	    critbit_str_keylen(slot->cs_tree, (const uint8_t *)*key),
+	    critbit_str_keylen, critbit_str_keybuf, critbit_str_keybyte);
+}
+
+void *
+critbit_str_insert_finger(struct critbit_tree *t, struct critbit_cursor *finger,
+    struct critbit_node *newnode, const char **key)
+{
+	return (critbit_insert_finger_impl(t, finger, newnode,
+	    (const struct critbit_key *)key,
+	    critbit_str_keylen(t, (const uint8_t *)*key), critbit_str_keylen,
+	    critbit_str_keybuf, critbit_str_keybyte, critbit_str_keydiff));
+}
+
+void *
+critbit_str_remove(struct critbit_tree *t, const char *key)
+{
+	return (critbit_remove_impl(t, key,
+	    critbit_str_keylen(t, (const uint8_t *)key), 0, 0,
+	    critbit_str_keycmp, critbit_str_keybuf, critbit_str_keybyte));
+}
+
+void *
+critbit_str_remove_entry(struct critbit_tree *t, const char *key,
+    ptrdiff_t entryoff)
+{
+	return (critbit_remove_impl(t, key,
+	    critbit_str_keylen(t, (const uint8_t *)key), 1, entryoff,
+	    critbit_str_keycmp, critbit_str_keybuf, critbit_str_keybyte));
+}
+
+int
+critbit_str_bulk_load(struct critbit_tree *t, void *const *elems, size_t n,
+    size_t offset, struct critbit_node **nodes)
+{
+	return (critbit_bulk_load_impl(t, elems, n, offset, nodes,
+	    critbit_str_keylen, critbit_str_keybuf, critbit_str_keybyte,
+	    critbit_str_keydiff));
+}
+
+void
+critbit_str_merge(struct critbit_tree *dst, struct critbit_tree *src,
+    struct critbit_node *spare, critbit_merge_t *conflict, void *arg)
+{
+	critbit_merge_trees(dst, src, spare, conflict, arg,
+	    critbit_str_keylen, critbit_str_keybuf, critbit_str_keybyte,
+	    critbit_str_keydiff);
+}
+
+void
+critbit_str_split(struct critbit_tree *t, const char *key,
+    struct critbit_tree *left, struct critbit_tree *right)
+{
+	critbit_split_impl(t, key, critbit_str_keylen(t, (const uint8_t *)key),
+	    left, right, critbit_str_keylen, critbit_str_keybuf,
+	    critbit_str_keybyte, critbit_str_keydiff);
+}
+
+int
+critbit_str_join(struct critbit_tree *left, struct critbit_tree *right,
+    struct critbit_node *node)
+{
+	return (critbit_join_impl(left, right, node, critbit_str_keylen,
+	    critbit_str_keybuf, critbit_str_keybyte, critbit_str_keydiff));
+}
+
+void *
+critbit_str_next(struct critbit_cursor *c)
+{
+	return (critbit_cursor_step_impl(c, 1, 0, critbit_str_keylen,
+	    critbit_str_keybuf, critbit_str_keybyte));
+}
+
+void *
+critbit_str_prev(struct critbit_cursor *c)
+{
+	return (critbit_cursor_step_impl(c, 0, 0, critbit_str_keylen,
+	    critbit_str_keybuf, critbit_str_keybyte));
+}
+
+size_t
+critbit_str_rank(struct critbit_tree *t, const char *key)
+{
+	return (critbit_rank_impl(t, key,
+	    critbit_str_keylen(t, (const uint8_t *)key),
+	    critbit_str_keybuf, critbit_str_keybyte, critbit_str_keydiff));
+}
+
+size_t
+critbit_str_count_range(struct critbit_tree *t, const char *lo,
+    const char *hi)
+{
+	size_t rlo, rhi;
+
+	rlo = lo == NULL ? 0 : critbit_str_rank(t, lo);
+	rhi = hi == NULL ? critbit_count(t) : critbit_str_rank(t, hi);
+	return (rhi > rlo ? rhi - rlo : 0);
+}
+
+void *
+critbit_str_seek(struct critbit_tree *t, struct critbit_cursor *c,
+    const char *key, int how)
+{
+	struct critbit_cursor tmp;
+
+	if (c == NULL)
+		c = &tmp;
+	return (critbit_seek_impl(t, c, key,
+	    critbit_str_keylen(t, (const uint8_t *)key), how,
+	    critbit_str_keylen, critbit_str_keybuf, critbit_str_keybyte,
+	    critbit_str_keydiff));
+}
+
+int
+critbit_str_range(struct critbit_tree *t, const char *lo, const char *hi,
+    critbit_visit_t *visit, void *arg)
+{
+	return (critbit_range_impl(t, lo,
+	    lo == NULL ? 0 : critbit_str_keylen(t, (const uint8_t *)lo),
+	    hi, hi == NULL ? 0 : critbit_str_keylen(t, (const uint8_t *)hi),
+	    visit, arg, critbit_str_keylen, critbit_str_keybuf,
+	    critbit_str_keybyte, critbit_str_keydiff));
+}
+
+int
+critbit_str_prefix(struct critbit_tree *t, const char *prefix, size_t len,
+    critbit_visit_t *visit, void *arg)
+{
+	return (critbit_prefix_impl(t, prefix, len, len, visit, arg,
+	    critbit_str_keylen, critbit_str_keybuf, critbit_str_keybyte));
+}
+
+size_t
+critbit_str_prefix_count(struct critbit_tree *t, const char *prefix, size_t len)
+{
+	return (critbit_prefix_count_impl(t, prefix, len, len,
+	    critbit_str_keylen, critbit_str_keybuf, critbit_str_keybyte));
+}
+
+int
+critbit_str_intersect_foreach(struct critbit_tree *a, struct critbit_tree *b,
+    critbit_visit_t *visit, void *arg)
+{
+	return (critbit_setop(a, b, 0, visit, arg, critbit_str_keylen,
+	    critbit_str_keybuf, critbit_str_keybyte, critbit_str_keydiff));
+}
+
+int
+critbit_str_diff_foreach(struct critbit_tree *a, struct critbit_tree *b,
+    critbit_visit_t *visit, void *arg)
+{
+	return (critbit_setop(a, b, 1, visit, arg, critbit_str_keylen,
+	    critbit_str_keybuf, critbit_str_keybyte, critbit_str_keydiff));
+}
+
+int
+critbit_str_diff(struct critbit_tree *a, struct critbit_tree *b,
+    critbit_diff_t *visit, void *arg)
+{
+	return (critbit_hashdiff(a, b, visit, arg, critbit_str_keylen,
+	    critbit_str_keybuf, critbit_str_keybyte, critbit_str_keydiff));
+}
+
+void *
+critbit_str_cget(struct critbit_ctree *t, const char *key)
+{
+	return (critbit_cget_impl(t, key, strlen(key),
+	    critbit_str_keycmp, critbit_str_keybuf, critbit_str_keybyte));
+}
+
+int
+critbit_str_cinsert(struct critbit_ctree *t, const char **key, void **existing)
+{
+	return (critbit_cinsert_impl(t, (const struct critbit_key *)key,
+	    strlen(*key), existing, critbit_str_keybuf, critbit_str_keybyte,
+	    critbit_str_keydiff));
+}
+
+void *
+critbit_str_cremove(struct critbit_ctree *t, const char *key)
+{
+	return (critbit_cremove_impl(t, key, strlen(key),
+	    critbit_str_keycmp, critbit_str_keybuf, critbit_str_keybyte));
+}
+
+void *
+critbit_str_fget(const struct critbit_frozen *f, const char *key)
+{
+	return (critbit_fget_impl(f, key, strlen(key),
+	    critbit_str_keycmp, critbit_str_keybuf, critbit_str_keybyte));
+}
+
+int
+critbit_str_serialize(struct critbit_tree *t, int fd)
+{
+	return (critbit_serialize_impl(t, fd, CRITBIT_M_STR,
+	    critbit_str_keyraw));
+}
+
+
+void *
+critbit_lstr_get(struct critbit_tree *t, const struct critbit_lstr *key)
+{
+	return (critbit_get_impl(t, key,
+	    critbit_lstr_keylen(t, (const uint8_t *)key),
+	    critbit_lstr_keycmp, critbit_lstr_keybuf, critbit_lstr_keybyte));
+}
+
+void
+critbit_lstr_get_batch(struct critbit_tree *t,
+    const struct critbit_lstr *const *keys, size_t n, void **out)
+{
+	critbit_get_batch_impl(t, (const void *const *)keys, n, out,
+	    critbit_lstr_keylen, critbit_lstr_keycmp, critbit_lstr_keybuf,
+	    critbit_lstr_keybyte);
+}
+
+void *
+critbit_lstr_insert(struct critbit_tree *t,
+    struct critbit_node *newnode, const struct critbit_lstr *key)
+{
+	return (critbit_insert_impl(t, newnode, (const struct critbit_key *)key,
+	    0, critbit_lstr_keylen(t, (const uint8_t *)key),
+	    critbit_lstr_keylen, critbit_lstr_keybuf, critbit_lstr_keybyte,
+	    critbit_lstr_keydiff));
+}
+
+void *
+critbit_lstr_replace(struct critbit_tree *t,
+    struct critbit_node *newnode, const struct critbit_lstr *key)
+{
+	return (critbit_insert_impl(t, newnode, (const struct critbit_key *)key,
+	    1, critbit_lstr_keylen(t, (const uint8_t *)key),
+	    critbit_lstr_keylen, critbit_lstr_keybuf, critbit_lstr_keybyte,
+	    critbit_lstr_keydiff));
+}
+
+void *
+critbit_lstr_find_or_prepare(struct critbit_tree *t,
+    const struct critbit_lstr *key, struct critbit_slot *slot)
+{
+	return (critbit_prepare_impl(t, key,
+	    critbit_lstr_keylen(t, (const uint8_t *)key), slot,
+	    critbit_lstr_keybuf, critbit_lstr_keybyte, critbit_lstr_keydiff));
+}
+
+void
+critbit_lstr_commit(struct critbit_slot *slot, struct critbit_node *newnode,
+    const struct critbit_lstr *key)
+{
+	critbit_commit_impl(slot, newnode, (const struct critbit_key *)key,
+	    critbit_lstr_keylen(slot->cs_tree, (const uint8_t *)key),
+	    critbit_lstr_keylen, critbit_lstr_keybuf, critbit_lstr_keybyte);
+}
+
+void *
+critbit_lstr_insert_finger(struct critbit_tree *t,
+    struct critbit_cursor *finger, struct critbit_node *newnode,
+    const struct critbit_lstr *key)
+{
+	return (critbit_insert_finger_impl(t, finger, newnode,
+	    (const struct critbit_key *)key,
+	    critbit_lstr_keylen(t, (const uint8_t *)key), critbit_lstr_keylen,
+	    critbit_lstr_keybuf, critbit_lstr_keybyte, critbit_lstr_keydiff));
+}
+
+void *
+critbit_lstr_remove(struct critbit_tree *t, const struct critbit_lstr *key)
+{
+	return (critbit_remove_impl(t, key,
+	    critbit_lstr_keylen(t, (const uint8_t *)key), 0, 0,
+	    critbit_lstr_keycmp, critbit_lstr_keybuf, critbit_lstr_keybyte));
+}
+
+void *
+critbit_lstr_remove_entry(struct critbit_tree *t,
+    const struct critbit_lstr *key, ptrdiff_t entryoff)
+{
+	return (critbit_remove_impl(t, key,
+	    critbit_lstr_keylen(t, (const uint8_t *)key), 1, entryoff,
+	    critbit_lstr_keycmp, critbit_lstr_keybuf, critbit_lstr_keybyte));
+}
+
+int
+critbit_lstr_bulk_load(struct critbit_tree *t, void *const *elems, size_t n,
+    size_t offset, struct critbit_node **nodes)
+{
+	return (critbit_bulk_load_impl(t, elems, n, offset, nodes,
+	    critbit_lstr_keylen, critbit_lstr_keybuf, critbit_lstr_keybyte,
+	    critbit_lstr_keydiff));
+}
+
+void
+critbit_lstr_merge(struct critbit_tree *dst, struct critbit_tree *src,
+    struct critbit_node *spare, critbit_merge_t *conflict, void *arg)
+{
+	critbit_merge_trees(dst, src, spare, conflict, arg,
+	    critbit_lstr_keylen, critbit_lstr_keybuf, critbit_lstr_keybyte,
+	    critbit_lstr_keydiff);
+}
+
+void
+critbit_lstr_split(struct critbit_tree *t, const struct critbit_lstr *key,
+    struct critbit_tree *left, struct critbit_tree *right)
+{
+	critbit_split_impl(t, key, critbit_lstr_keylen(t, (const uint8_t *)key),
+	    left, right, critbit_lstr_keylen, critbit_lstr_keybuf,
+	    critbit_lstr_keybyte, critbit_lstr_keydiff);
+}
+
+int
+critbit_lstr_join(struct critbit_tree *left, struct critbit_tree *right,
+    struct critbit_node *node)
+{
+	return (critbit_join_impl(left, right, node, critbit_lstr_keylen,
+	    critbit_lstr_keybuf, critbit_lstr_keybyte, critbit_lstr_keydiff));
+}
+
+void *
+critbit_lstr_next(struct critbit_cursor *c)
+{
+	return (critbit_cursor_step_impl(c, 1, 0, critbit_lstr_keylen,
+	    critbit_lstr_keybuf, critbit_lstr_keybyte));
+}
+
+void *
+critbit_lstr_prev(struct critbit_cursor *c)
+{
+	return (critbit_cursor_step_impl(c, 0, 0, critbit_lstr_keylen,
+	    critbit_lstr_keybuf, critbit_lstr_keybyte));
+}
+
+size_t
+critbit_lstr_rank(struct critbit_tree *t, const struct critbit_lstr *key)
+{
+	return (critbit_rank_impl(t, key,
+	    critbit_lstr_keylen(t, (const uint8_t *)key),
+	    critbit_lstr_keybuf, critbit_lstr_keybyte, critbit_lstr_keydiff));
+}
+
+size_t
+critbit_lstr_count_range(struct critbit_tree *t, const struct critbit_lstr *lo,
+    const struct critbit_lstr *hi)
+{
+	size_t rlo, rhi;
+
+	rlo = lo == NULL ? 0 : critbit_lstr_rank(t, lo);
+	rhi = hi == NULL ? critbit_count(t) : critbit_lstr_rank(t, hi);
+	return (rhi > rlo ? rhi - rlo : 0);
+}
+
+void *
+critbit_lstr_seek(struct critbit_tree *t, struct critbit_cursor *c,
+    const struct critbit_lstr *key, int how)
+{
+	struct critbit_cursor tmp;
+
+	if (c == NULL)
+		c = &tmp;
+	return (critbit_seek_impl(t, c, key,
+	    critbit_lstr_keylen(t, (const uint8_t *)key), how,
+	    critbit_lstr_keylen, critbit_lstr_keybuf, critbit_lstr_keybyte,
+	    critbit_lstr_keydiff));
+}
+
+int
+critbit_lstr_range(struct critbit_tree *t, const struct critbit_lstr *lo,
+    const struct critbit_lstr *hi, critbit_visit_t *visit, void *arg)
+{
+	return (critbit_range_impl(t, lo,
+	    lo == NULL ? 0 : critbit_lstr_keylen(t, (const uint8_t *)lo),
+	    hi, hi == NULL ? 0 : critbit_lstr_keylen(t, (const uint8_t *)hi),
+	    visit, arg, critbit_lstr_keylen, critbit_lstr_keybuf,
+	    critbit_lstr_keybyte, critbit_lstr_keydiff));
+}
+
+int
+critbit_lstr_prefix(struct critbit_tree *t, const struct critbit_lstr *prefix,
+    size_t len, critbit_visit_t *visit, void *arg)
+{
+	return (critbit_prefix_impl(t, prefix, len, len, visit, arg,
+	    critbit_lstr_keylen, critbit_lstr_keybuf, critbit_lstr_keybyte));
+}
+
+size_t
+critbit_lstr_prefix_count(struct critbit_tree *t,
+    const struct critbit_lstr *prefix, size_t len)
+{
+	return (critbit_prefix_count_impl(t, prefix, len, len,
+	    critbit_lstr_keylen, critbit_lstr_keybuf, critbit_lstr_keybyte));
+}
+
+int
+critbit_lstr_intersect_foreach(struct critbit_tree *a, struct critbit_tree *b,
+    critbit_visit_t *visit, void *arg)
+{
+	return (critbit_setop(a, b, 0, visit, arg, critbit_lstr_keylen,
+	    critbit_lstr_keybuf, critbit_lstr_keybyte, critbit_lstr_keydiff));
+}
+
+int
+critbit_lstr_diff_foreach(struct critbit_tree *a, struct critbit_tree *b,
+    critbit_visit_t *visit, void *arg)
+{
+	return (critbit_setop(a, b, 1, visit, arg, critbit_lstr_keylen,
+	    critbit_lstr_keybuf, critbit_lstr_keybyte, critbit_lstr_keydiff));
+}
+
+int
+critbit_lstr_diff(struct critbit_tree *a, struct critbit_tree *b,
+    critbit_diff_t *visit, void *arg)
+{
+	return (critbit_hashdiff(a, b, visit, arg, critbit_lstr_keylen,
+	    critbit_lstr_keybuf, critbit_lstr_keybyte, critbit_lstr_keydiff));
+}
+
+void *
+critbit_lstr_cget(struct critbit_ctree *t, const struct critbit_lstr *key)
+{
+	return (critbit_cget_impl(t, key, key->cl_len,
+	    critbit_lstr_keycmp, critbit_lstr_keybuf, critbit_lstr_keybyte));
+}
+
+int
+critbit_lstr_cinsert(struct critbit_ctree *t, const struct critbit_lstr *key,
+    void **existing)
+{
+	return (critbit_cinsert_impl(t, (const struct critbit_key *)key,
+	    key->cl_len, existing, critbit_lstr_keybuf, critbit_lstr_keybyte,
+	    critbit_lstr_keydiff));
+}
+
+void *
+critbit_lstr_cremove(struct critbit_ctree *t, const struct critbit_lstr *key)
+{
+	return (critbit_cremove_impl(t, key, key->cl_len,
+	    critbit_lstr_keycmp, critbit_lstr_keybuf, critbit_lstr_keybyte));
+}
+
+void *
+critbit_lstr_fget(const struct critbit_frozen *f,
+    const struct critbit_lstr *key)
+{
+	return (critbit_fget_impl(f, key, key->cl_len,
+	    critbit_lstr_keycmp, critbit_lstr_keybuf, critbit_lstr_keybyte));
+}
+
+int
+critbit_lstr_serialize(struct critbit_tree *t, int fd)
+{
+	return (critbit_serialize_impl(t, fd, CRITBIT_M_STR,
+	    critbit_lstr_keyraw));
+}
+
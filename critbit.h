@@ -7,6 +7,7 @@
 #define CRITBIT_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
 #ifndef CRITBIT_UNUSED
 #ifndef __unused
@@ -25,6 +26,7 @@
 extern "C" {
 #endif
 
+struct critbit_cnode;
 struct critbit_key;
 struct critbit_node;
 struct critbit_ref;
@@ -32,40 +34,667 @@ struct critbit_tree;
 
 typedef void critbit_node_free_t(void *arg, void *node);
 
+/* number of lookups advanced in lockstep by get_batch */
+#ifndef CRITBIT_BATCH
+#define CRITBIT_BATCH			16
+#endif
+
+/* seek modes: nearest key below/above, optionally matching exactly */
+#define CRITBIT_SEEK_LT			0x00
+#define CRITBIT_SEEK_GT			0x01
+#define CRITBIT_SEEK_EQ			0x02
+#define CRITBIT_SEEK_LE			(CRITBIT_SEEK_LT | CRITBIT_SEEK_EQ)
+#define CRITBIT_SEEK_GE			(CRITBIT_SEEK_GT | CRITBIT_SEEK_EQ)
+
+/* return non-zero to stop traversal */
+typedef int critbit_visit_t(void *arg, void *key);
+
+/* called with key present in only one of the trees, the other is NULL */
+typedef int critbit_diff_t(void *arg, void *akey, void *bkey);
+
+/* choose one of two equal keys, the other one is dropped from the tree */
+typedef void *critbit_merge_t(void *arg, void *dstkey, void *srckey);
+
+/* fix pointers of a restored element, non-zero aborts the restore */
+typedef int critbit_relocate_t(void *arg, void *elem);
+
+/*
+ * Maximum number of ancestors remembered by a cursor.  Deeper paths are
+ * recovered by descending from the root again.
+ */
+#ifndef CRITBIT_CURSOR_DEPTH
+#define CRITBIT_CURSOR_DEPTH		64
+#endif
+
 struct critbit_tree {
 	struct critbit_ref	*ct_root;
 	size_t			ct_keylen;
 	void			*ct_free_arg;
 	critbit_node_free_t	*ct_node_free;
+	unsigned int		ct_flags;
+	ptrdiff_t		ct_entryoff;	/* CRITBIT_F_ENTRY */
+};
+
+/* tree flags, nodes must be allocated using critbit_tree_node_size() */
+#define CRITBIT_F_COUNT			0x0001	/* keep subtree key counts */
+#define CRITBIT_F_HASH			0x0002	/* keep subtree key hashes */
+#define CRITBIT_F_ENTRY			0x0004	/* set by critbit_init_entry */
+
+/*
+ * Cursor for ordered traversal.  Cursor is invalidated by modifications of
+ * the tree.
+ */
+struct critbit_cursor {
+	struct critbit_tree	*cc_tree;
+	struct critbit_ref	*cc_leaf;
+	size_t			cc_depth;
+	size_t			cc_base;
+	struct critbit_node	*cc_path[CRITBIT_CURSOR_DEPTH];
+	unsigned char		cc_dir[CRITBIT_CURSOR_DEPTH];
+};
+
+/* node pool slab size and alignment */
+#ifndef CRITBIT_POOL_SLAB
+#define CRITBIT_POOL_SLAB		65536
+#endif
+#ifndef CRITBIT_CACHE_LINE
+#define CRITBIT_CACHE_LINE		64
+#endif
+
+struct critbit_slab;
+
+/*
+ * Node allocator carving nodes out of cache line aligned slabs.  Pass
+ * critbit_node_pool_free and the pool as nfree and freearg of the tree.
+ * Trees exchanging nodes (merge, split, join) must share a pool.
+ */
+struct critbit_node_pool {
+	struct critbit_slab	*cp_slabs;	/* all slabs, in use order */
+	struct critbit_slab	*cp_cur;
+	void			*cp_free;	/* freed nodes */
+	char			*cp_next;	/* unused part of cp_cur */
+	size_t			cp_left;
+	size_t			cp_size;
+};
+
+/*
+ * Compact tree: 12-byte nodes referring to children by 32-bit index, kept
+ * in one array with a parallel array of keys.  Holds up to 2^31 keys with
+ * crit bits in the first 2^24 bytes.  No counts or hashes are kept.
+ */
+struct critbit_ctree {
+	struct critbit_cnode	*cx_nodes;
+	struct critbit_key	**cx_keys;
+	size_t			cx_keylen;
+	unsigned int		cx_root;
+	unsigned int		cx_count;
+	unsigned int		cx_size;	/* slots allocated */
+	unsigned int		cx_used;	/* slots ever handed out */
+	unsigned int		cx_free;	/* freed slots */
+};
+
+/*
+ * Read-only copy of a tree made by critbit_freeze in one allocation.
+ * Nodes are compact and grouped in cache line blocks, keys are kept in
+ * order and shared with the tree.
+ */
+struct critbit_frozen {
+	char			*cf_base;
+	struct critbit_key	**cf_keys;
+	size_t			cf_keylen;
+	size_t			cf_count;
+	unsigned int		cf_root;
+};
+
+/*
+ * Tree written by critbit_*_serialize and mapped read-only.  Queries take
+ * raw key bytes and hand out pointers to keys in the mapping, strings
+ * being NUL terminated.  critbit_mmap_open checks the whole file and
+ * refuses damaged ones with EINVAL, the file must not change while it is
+ * mapped.
+ */
+struct critbit_mapped {
+	void			*cm_map;
+	size_t			cm_size;
+	const char		*cm_nodes;
+	const char		*cm_offs;
+	const char		*cm_keys;
+	size_t			cm_keylen;
+	size_t			cm_count;
+	unsigned int		cm_root;
+	unsigned int		cm_flags;
+};
+
+/*
+ * Node embedded in an element of an intrusive tree, sized for any flags.
+ * Such a tree is initialized with critbit_init_entry, elements are
+ * inserted with their own entry as the node.  Remove and replace hand
+ * nodes over so the node of every element stays on the path to its leaf.
+ * Commit, merge and split leave the trees alone, insert_finger returns
+ * the key itself without inserting it, bulk_load and join fail with
+ * EINVAL.
+ */
+struct critbit_entry {
+	unsigned long long	ce_node[5];
+};
+
+#define CRITBIT_ENTRY(type)		struct critbit_entry
+
+/*
+ * Key of the lstr flavor: a string with its length, so lookups need no
+ * strlen.  Queries are passed the same way.  Keys must not contain NUL
+ * bytes and need not be NUL terminated.
+ */
+struct critbit_lstr {
+	const char		*cl_str;
+	size_t			cl_len;
+};
+
+/*
+ * Insertion point prepared by find_or_prepare for commit.  Slot is
+ * invalidated by modifications of the tree.  The path above cs_where is
+ * kept for counts and hashes, unless it was deeper than the ring.
+ */
+struct critbit_slot {
+	struct critbit_tree	*cs_tree;
+	struct critbit_ref	**cs_where;
+	size_t			cs_depth;	/* nodes above cs_where */
+	struct critbit_ref	**cs_path[CRITBIT_CURSOR_DEPTH];
+	uint32_t		cs_byte;
+	uint8_t			cs_otherbits;
+	uint8_t			cs_dir;
+	uint8_t			cs_empty;
+	uint8_t			cs_deep;	/* path lost */
 };
 
 void critbit_init(struct critbit_tree *t, critbit_node_free_t *nfree,
     void *freearg, size_t keylen);
 
+void critbit_init_flags(struct critbit_tree *t, critbit_node_free_t *nfree,
+    void *freearg, size_t keylen, unsigned int flags);
+
+/* intrusive tree, entryoff is the offset of the entry from the key */
+void critbit_init_entry(struct critbit_tree *t, size_t keylen,
+    unsigned int flags, ptrdiff_t entryoff);
+
+/* free all nodes, elements are passed to efree if not NULL */
+void critbit_destroy(struct critbit_tree *t, critbit_node_free_t *efree,
+    void *arg);
+
 int critbit_empty(struct critbit_tree *t);
 
 size_t critbit_node_size(void);
 
+size_t critbit_tree_node_size(struct critbit_tree *t);
+
+/* nodesize is critbit_tree_node_size() of the trees using the pool */
+void critbit_node_pool_init(struct critbit_node_pool *p, size_t nodesize);
+
+struct critbit_node *critbit_node_pool_alloc(struct critbit_node_pool *p);
+
+void critbit_node_pool_free(void *arg, void *node);
+
+/* release all nodes at once, trees using the pool must be reinitialized */
+void critbit_node_pool_reset(struct critbit_node_pool *p);
+
+void critbit_node_pool_destroy(struct critbit_node_pool *p);
+
+void critbit_ctree_init(struct critbit_ctree *t, size_t keylen);
+
+void critbit_ctree_destroy(struct critbit_ctree *t);
+
+int critbit_ctree_reserve(struct critbit_ctree *t, size_t n);
+
+size_t critbit_ctree_count(struct critbit_ctree *t);
+
+size_t critbit_ctree_node_size(void);
+
+int critbit_ctree_foreach(struct critbit_ctree *t, critbit_visit_t *visit,
+    void *arg);
+
+/* tree is left unchanged, returns ENOMEM or EINVAL if too large */
+int critbit_freeze(struct critbit_tree *t, struct critbit_frozen *f);
+
+void critbit_frozen_free(struct critbit_frozen *f);
+
+size_t critbit_frozen_count(const struct critbit_frozen *f);
+
+/* i-th key in order */
+void *critbit_frozen_key(const struct critbit_frozen *f, size_t i);
+
+int critbit_mmap_open(struct critbit_mapped *m, const char *path);
+
+void critbit_mmap_close(struct critbit_mapped *m);
+
+size_t critbit_mmap_count(const struct critbit_mapped *m);
+
+/* i-th key in order */
+const void *critbit_mmap_key(const struct critbit_mapped *m, size_t i);
+
+const void *critbit_mmap_get(const struct critbit_mapped *m, const void *key,
+    size_t len);
+
+int critbit_mmap_prefix(const struct critbit_mapped *m, const void *prefix,
+    size_t len, critbit_visit_t *visit, void *arg);
+
+/* visit keys in range [lo, hi), NULL bound is unlimited */
+int critbit_mmap_range(const struct critbit_mapped *m, const void *lo,
+    size_t lolen, const void *hi, size_t hilen, critbit_visit_t *visit,
+    void *arg);
+
+/*
+ * Snapshot of a mutable tree: its nodes with children as indices and a
+ * copy of every element, elemsize bytes with the key at keyoff.
+ */
+int critbit_snapshot(struct critbit_tree *t, int fd, size_t elemsize,
+    size_t keyoff);
+
+/*
+ * Rebuild a snapshot into t with nodes from pool, which is initialized
+ * here, even on failure, and becomes the nfree of t.  Elements land in
+ * one array returned in elems and freed by the caller, reloc is called
+ * for each if not NULL.  Fixed is set for buf and integer keys, which
+ * lie in the element at keyoff.  Damaged snapshots are refused with
+ * EINVAL.
+ */
+int critbit_restore(struct critbit_tree *t, struct critbit_node_pool *pool,
+    int fd, size_t elemsize, size_t keyoff, int fixed, void **elems,
+    critbit_relocate_t *reloc, void *arg);
+
+/* following require CRITBIT_F_COUNT */
+size_t critbit_count(struct critbit_tree *t);
+
+void *critbit_select(struct critbit_tree *t, struct critbit_cursor *c,
+    size_t i);
+
+void critbit_cursor_init(struct critbit_cursor *c);
+
+void *critbit_first(struct critbit_tree *t, struct critbit_cursor *c);
+
+void *critbit_last(struct critbit_tree *t, struct critbit_cursor *c);
+
 void critbit_buf_init(struct critbit_tree *t, critbit_node_free_t *nfree,
     void *freearg, size_t keylen);
 
 void *critbit_buf_get(struct critbit_tree *t, const void *key);
 
+void critbit_buf_get_batch(struct critbit_tree *t, const void *const *keys,
+    size_t n, void **out);
+
 void *critbit_buf_insert(struct critbit_tree *t,
     struct critbit_node *newnode, const void *key);
 
+/* insert or replace equal key in place, returns the replaced one */
+void *critbit_buf_replace(struct critbit_tree *t,
+    struct critbit_node *newnode, const void *key);
+
+/*
+ * Two-phase insert: returns equal key or NULL with slot prepared, commit
+ * then links key there without descending.  Node may be NULL when
+ * inserting into an empty tree.
+ */
+void *critbit_buf_find_or_prepare(struct critbit_tree *t, const void *key,
+    struct critbit_slot *slot);
+
+void critbit_buf_commit(struct critbit_slot *slot,
+    struct critbit_node *newnode, const void *key);
+
+/*
+ * Insert starting from finger, a cursor left at previously inserted key.
+ * Finger is initialized by critbit_cursor_init() and invalidated by any
+ * other modification of the tree.
+ */
+void *critbit_buf_insert_finger(struct critbit_tree *t,
+    struct critbit_cursor *finger, struct critbit_node *newnode,
+    const void *key);
+
 void *critbit_buf_remove(struct critbit_tree *t, const void *key);
 
+/* intrusive trees, entryoff is the offset of the entry from the key */
+void *critbit_buf_remove_entry(struct critbit_tree *t, const void *key,
+    ptrdiff_t entryoff);
+
+int critbit_buf_bulk_load(struct critbit_tree *t, void *const *elems,
+    size_t n, size_t offset, struct critbit_node **nodes);
+
+/*
+ * Move all keys of src into dst, reusing src nodes.  Trees must have the
+ * same keylen, flags and node allocator.  One spare node is needed, it's
+ * freed if unused.  conflict is required: it picks the one of two equal
+ * keys to keep, the other is then in neither tree and is the callback's
+ * to release.
+ */
+void critbit_buf_merge(struct critbit_tree *dst, struct critbit_tree *src,
+    struct critbit_node *spare, critbit_merge_t *conflict, void *arg);
+
+/*
+ * Move keys less than key to left, the rest to right, t is left empty.
+ * left and right must be empty.  One node is freed.  Join appends right
+ * to left using node, returns EINVAL unless all keys of left are less
+ * than keys of right.  Join always takes node, it's freed if unused.
+ */
+void critbit_buf_split(struct critbit_tree *t, const void *key,
+    struct critbit_tree *left, struct critbit_tree *right);
+
+int critbit_buf_join(struct critbit_tree *left, struct critbit_tree *right,
+    struct critbit_node *node);
+
+void *critbit_buf_next(struct critbit_cursor *c);
+
+void *critbit_buf_prev(struct critbit_cursor *c);
+
+/* number of keys less than key, requires CRITBIT_F_COUNT */
+size_t critbit_buf_rank(struct critbit_tree *t, const void *key);
+
+/* number of keys in range [lo, hi), requires CRITBIT_F_COUNT */
+size_t critbit_buf_count_range(struct critbit_tree *t, const void *lo,
+    const void *hi);
+
+void *critbit_buf_seek(struct critbit_tree *t, struct critbit_cursor *c,
+    const void *key, int how);
+
+/* visit keys in range [lo, hi), NULL bound is unlimited */
+int critbit_buf_range(struct critbit_tree *t, const void *lo, const void *hi,
+    critbit_visit_t *visit, void *arg);
+
+int critbit_buf_prefix(struct critbit_tree *t, const void *prefix,
+    size_t len, critbit_visit_t *visit, void *arg);
+
+/* number of keys with prefix, O(len) with CRITBIT_F_COUNT */
+size_t critbit_buf_prefix_count(struct critbit_tree *t, const void *prefix,
+    size_t len);
+
+/*
+ * Visit in order keys of a that are also in b, or that are not in b.
+ * Both trees are walked together, skipping subtrees that can't matter.
+ */
+int critbit_buf_intersect_foreach(struct critbit_tree *a,
+    struct critbit_tree *b, critbit_visit_t *visit, void *arg);
+
+int critbit_buf_diff_foreach(struct critbit_tree *a, struct critbit_tree *b,
+    critbit_visit_t *visit, void *arg);
+
+/*
+ * Visit in order keys present in only one of a and b.  With CRITBIT_F_HASH
+ * on both trees, equal subtrees are skipped by comparing their hashes, so
+ * the cost follows the size of the difference.
+ */
+int critbit_buf_diff(struct critbit_tree *a, struct critbit_tree *b,
+    critbit_diff_t *visit, void *arg);
+
+void *critbit_buf_cget(struct critbit_ctree *t, const void *key);
+
+/* 0, EEXIST with *existing set, ENOMEM or EINVAL */
+int critbit_buf_cinsert(struct critbit_ctree *t, const void *key,
+    void **existing);
+
+void *critbit_buf_cremove(struct critbit_ctree *t, const void *key);
+
+void *critbit_buf_fget(const struct critbit_frozen *f, const void *key);
+
+int critbit_buf_serialize(struct critbit_tree *t, int fd);
+
+void *critbit_int_get(struct critbit_tree *t, const void *key);
+
+void critbit_int_get_batch(struct critbit_tree *t, const void *const *keys,
+    size_t n, void **out);
+
+void *critbit_int_insert(struct critbit_tree *t,
+    struct critbit_node *newnode, const void *key);
+
+void *critbit_int_replace(struct critbit_tree *t,
+    struct critbit_node *newnode, const void *key);
+
+void *critbit_int_find_or_prepare(struct critbit_tree *t, const void *key,
+    struct critbit_slot *slot);
+
+void critbit_int_commit(struct critbit_slot *slot,
+    struct critbit_node *newnode, const void *key);
+
+void *critbit_int_insert_finger(struct critbit_tree *t,
+    struct critbit_cursor *finger, struct critbit_node *newnode,
+    const void *key);
+
+void *critbit_int_remove(struct critbit_tree *t, const void *key);
+
+void *critbit_int_remove_entry(struct critbit_tree *t, const void *key,
+    ptrdiff_t entryoff);
+
+int critbit_int_bulk_load(struct critbit_tree *t, void *const *elems,
+    size_t n, size_t offset, struct critbit_node **nodes);
+
+void critbit_int_merge(struct critbit_tree *dst, struct critbit_tree *src,
+    struct critbit_node *spare, critbit_merge_t *conflict, void *arg);
+
+void critbit_int_split(struct critbit_tree *t, const void *key,
+    struct critbit_tree *left, struct critbit_tree *right);
+
+int critbit_int_join(struct critbit_tree *left, struct critbit_tree *right,
+    struct critbit_node *node);
+
+void *critbit_int_next(struct critbit_cursor *c);
+
+void *critbit_int_prev(struct critbit_cursor *c);
+
+/* number of keys less than key, requires CRITBIT_F_COUNT */
+size_t critbit_int_rank(struct critbit_tree *t, const void *key);
+
+/* number of keys in range [lo, hi), requires CRITBIT_F_COUNT */
+size_t critbit_int_count_range(struct critbit_tree *t, const void *lo,
+    const void *hi);
+
+void *critbit_int_seek(struct critbit_tree *t, struct critbit_cursor *c,
+    const void *key, int how);
+
+/* visit keys in range [lo, hi), NULL bound is unlimited */
+int critbit_int_range(struct critbit_tree *t, const void *lo, const void *hi,
+    critbit_visit_t *visit, void *arg);
+
+/* prefix is len most significant bytes of the integer */
+int critbit_int_prefix(struct critbit_tree *t, const void *prefix,
+    size_t len, critbit_visit_t *visit, void *arg);
+
+/* number of keys with prefix, O(len) with CRITBIT_F_COUNT */
+size_t critbit_int_prefix_count(struct critbit_tree *t, const void *prefix,
+    size_t len);
+
+int critbit_int_intersect_foreach(struct critbit_tree *a,
+    struct critbit_tree *b, critbit_visit_t *visit, void *arg);
+
+int critbit_int_diff_foreach(struct critbit_tree *a, struct critbit_tree *b,
+    critbit_visit_t *visit, void *arg);
+
+int critbit_int_diff(struct critbit_tree *a, struct critbit_tree *b,
+    critbit_diff_t *visit, void *arg);
+
+void *critbit_int_cget(struct critbit_ctree *t, const void *key);
+
+int critbit_int_cinsert(struct critbit_ctree *t, const void *key,
+    void **existing);
+
+void *critbit_int_cremove(struct critbit_ctree *t, const void *key);
+
+void *critbit_int_fget(const struct critbit_frozen *f, const void *key);
+
+int critbit_int_serialize(struct critbit_tree *t, int fd);
+
 void critbit_str_init(struct critbit_tree *t,
     critbit_node_free_t *nfree, void *freearg);
 
 void *critbit_str_get(struct critbit_tree *t, const char *key);
 
+void critbit_str_get_batch(struct critbit_tree *t, const char *const *keys,
+    size_t n, void **out);
+
 void *critbit_str_insert(struct critbit_tree *t,
     struct critbit_node *newnode, const char **key);
 
+void *critbit_str_replace(struct critbit_tree *t,
+    struct critbit_node *newnode, const char **key);
+
+void *critbit_str_find_or_prepare(struct critbit_tree *t, const char *key,
+    struct critbit_slot *slot);
+
+void critbit_str_commit(struct critbit_slot *slot,
+    struct critbit_node *newnode, const char **key);
+
+void *critbit_str_insert_finger(struct critbit_tree *t,
+    struct critbit_cursor *finger, struct critbit_node *newnode,
+    const char **key);
+
 void *critbit_str_remove(struct critbit_tree *t, const char *key);
 
+void *critbit_str_remove_entry(struct critbit_tree *t, const char *key,
+    ptrdiff_t entryoff);
+
+int critbit_str_bulk_load(struct critbit_tree *t, void *const *elems,
+    size_t n, size_t offset, struct critbit_node **nodes);
+
+void critbit_str_merge(struct critbit_tree *dst, struct critbit_tree *src,
+    struct critbit_node *spare, critbit_merge_t *conflict, void *arg);
+
+void critbit_str_split(struct critbit_tree *t, const char *key,
+    struct critbit_tree *left, struct critbit_tree *right);
+
+int critbit_str_join(struct critbit_tree *left, struct critbit_tree *right,
+    struct critbit_node *node);
+
+void *critbit_str_next(struct critbit_cursor *c);
+
+void *critbit_str_prev(struct critbit_cursor *c);
+
+/* number of keys less than key, requires CRITBIT_F_COUNT */
+size_t critbit_str_rank(struct critbit_tree *t, const char *key);
+
+/* number of keys in range [lo, hi), requires CRITBIT_F_COUNT */
+size_t critbit_str_count_range(struct critbit_tree *t, const char *lo,
+    const char *hi);
+
+void *critbit_str_seek(struct critbit_tree *t, struct critbit_cursor *c,
+    const char *key, int how);
+
+/* visit keys in range [lo, hi), NULL bound is unlimited */
+int critbit_str_range(struct critbit_tree *t, const char *lo, const char *hi,
+    critbit_visit_t *visit, void *arg);
+
+int critbit_str_prefix(struct critbit_tree *t, const char *prefix,
+    size_t len, critbit_visit_t *visit, void *arg);
+
+/* number of keys with prefix, O(len) with CRITBIT_F_COUNT */
+size_t critbit_str_prefix_count(struct critbit_tree *t, const char *prefix,
+    size_t len);
+
+int critbit_str_intersect_foreach(struct critbit_tree *a,
+    struct critbit_tree *b, critbit_visit_t *visit, void *arg);
+
+int critbit_str_diff_foreach(struct critbit_tree *a, struct critbit_tree *b,
+    critbit_visit_t *visit, void *arg);
+
+int critbit_str_diff(struct critbit_tree *a, struct critbit_tree *b,
+    critbit_diff_t *visit, void *arg);
+
+void *critbit_str_cget(struct critbit_ctree *t, const char *key);
+
+int critbit_str_cinsert(struct critbit_ctree *t, const char **key,
+    void **existing);
+
+void *critbit_str_cremove(struct critbit_ctree *t, const char *key);
+
+void *critbit_str_fget(const struct critbit_frozen *f, const char *key);
+
+int critbit_str_serialize(struct critbit_tree *t, int fd);
+
+void *critbit_lstr_get(struct critbit_tree *t,
+    const struct critbit_lstr *key);
+
+void critbit_lstr_get_batch(struct critbit_tree *t,
+    const struct critbit_lstr *const *keys, size_t n, void **out);
+
+void *critbit_lstr_insert(struct critbit_tree *t,
+    struct critbit_node *newnode, const struct critbit_lstr *key);
+
+void *critbit_lstr_replace(struct critbit_tree *t,
+    struct critbit_node *newnode, const struct critbit_lstr *key);
+
+void *critbit_lstr_find_or_prepare(struct critbit_tree *t,
+    const struct critbit_lstr *key, struct critbit_slot *slot);
+
+void critbit_lstr_commit(struct critbit_slot *slot,
+    struct critbit_node *newnode, const struct critbit_lstr *key);
+
+void *critbit_lstr_insert_finger(struct critbit_tree *t,
+    struct critbit_cursor *finger, struct critbit_node *newnode,
+    const struct critbit_lstr *key);
+
+void *critbit_lstr_remove(struct critbit_tree *t,
+    const struct critbit_lstr *key);
+
+void *critbit_lstr_remove_entry(struct critbit_tree *t,
+    const struct critbit_lstr *key, ptrdiff_t entryoff);
+
+int critbit_lstr_bulk_load(struct critbit_tree *t, void *const *elems,
+    size_t n, size_t offset, struct critbit_node **nodes);
+
+void critbit_lstr_merge(struct critbit_tree *dst, struct critbit_tree *src,
+    struct critbit_node *spare, critbit_merge_t *conflict, void *arg);
+
+void critbit_lstr_split(struct critbit_tree *t,
+    const struct critbit_lstr *key, struct critbit_tree *left,
+    struct critbit_tree *right);
+
+int critbit_lstr_join(struct critbit_tree *left, struct critbit_tree *right,
+    struct critbit_node *node);
+
+void *critbit_lstr_next(struct critbit_cursor *c);
+
+void *critbit_lstr_prev(struct critbit_cursor *c);
+
+/* number of keys less than key, requires CRITBIT_F_COUNT */
+size_t critbit_lstr_rank(struct critbit_tree *t,
+    const struct critbit_lstr *key);
+
+/* number of keys in range [lo, hi), requires CRITBIT_F_COUNT */
+size_t critbit_lstr_count_range(struct critbit_tree *t,
+    const struct critbit_lstr *lo, const struct critbit_lstr *hi);
+
+void *critbit_lstr_seek(struct critbit_tree *t, struct critbit_cursor *c,
+    const struct critbit_lstr *key, int how);
+
+/* visit keys in range [lo, hi), NULL bound is unlimited */
+int critbit_lstr_range(struct critbit_tree *t, const struct critbit_lstr *lo,
+    const struct critbit_lstr *hi, critbit_visit_t *visit, void *arg);
+
+int critbit_lstr_prefix(struct critbit_tree *t,
+    const struct critbit_lstr *prefix, size_t len, critbit_visit_t *visit,
+    void *arg);
+
+/* number of keys with prefix, O(len) with CRITBIT_F_COUNT */
+size_t critbit_lstr_prefix_count(struct critbit_tree *t,
+    const struct critbit_lstr *prefix, size_t len);
+
+int critbit_lstr_intersect_foreach(struct critbit_tree *a,
+    struct critbit_tree *b, critbit_visit_t *visit, void *arg);
+
+int critbit_lstr_diff_foreach(struct critbit_tree *a, struct critbit_tree *b,
+    critbit_visit_t *visit, void *arg);
+
+int critbit_lstr_diff(struct critbit_tree *a, struct critbit_tree *b,
+    critbit_diff_t *visit, void *arg);
+
+void *critbit_lstr_cget(struct critbit_ctree *t,
+    const struct critbit_lstr *key);
+
+int critbit_lstr_cinsert(struct critbit_ctree *t,
+    const struct critbit_lstr *key, void **existing);
+
+void *critbit_lstr_cremove(struct critbit_ctree *t,
+    const struct critbit_lstr *key);
+
+void *critbit_lstr_fget(const struct critbit_frozen *f,
+    const struct critbit_lstr *key);
+
+int critbit_lstr_serialize(struct critbit_tree *t, int fd);
+
 #define CRITBIT_HEAD(name)						\
 struct name##_critbit_head
 
@@ -93,16 +722,150 @@ CRITBIT_HEAD_PROTOTYPE(name);						\
 attr size_t name##_critbit_keylen(void);				\
 attr struct type *name##_critbit_get(CRITBIT_HEAD(name) *head,		\
     CRITBIT_KEYTYPE_##keytype key);					\
+attr void name##_critbit_get_batch(CRITBIT_HEAD(name) *head,		\
+    const CRITBIT_KEYTYPE_##keytype *keys, size_t n,			\
+    struct type **out);							\
 attr struct type *name##_critbit_insert(CRITBIT_HEAD(name) *head,	\
     struct critbit_node *newnode, struct type *entry);			\
+attr struct type *name##_critbit_replace(CRITBIT_HEAD(name) *head,	\
+    struct critbit_node *newnode, struct type *entry);			\
+attr struct type *name##_critbit_find_or_prepare(			\
+    CRITBIT_HEAD(name) *head, CRITBIT_KEYTYPE_##keytype key,		\
+    struct critbit_slot *slot);						\
+attr void name##_critbit_commit(struct critbit_slot *slot,		\
+    struct critbit_node *newnode, struct type *entry);			\
+attr struct type *name##_critbit_insert_finger(			\
+    CRITBIT_HEAD(name) *head, struct critbit_cursor *finger,		\
+    struct critbit_node *newnode, struct type *entry);			\
 attr struct type *name##_critbit_remove(CRITBIT_HEAD(name) *head,	\
-    CRITBIT_KEYTYPE_##keytype key);
+    CRITBIT_KEYTYPE_##keytype key);					\
+attr int name##_critbit_bulk_load(CRITBIT_HEAD(name) *head,		\
+    struct type *const *elems, size_t n, struct critbit_node **nodes);	\
+attr void name##_critbit_merge(CRITBIT_HEAD(name) *dst,		\
+    CRITBIT_HEAD(name) *src, struct critbit_node *spare,		\
+    struct type *(*conflict)(void *, struct type *, struct type *),	\
+    void *arg);								\
+attr void name##_critbit_split(CRITBIT_HEAD(name) *head,		\
+    CRITBIT_KEYTYPE_##keytype key, CRITBIT_HEAD(name) *left,		\
+    CRITBIT_HEAD(name) *right);						\
+attr int name##_critbit_join(CRITBIT_HEAD(name) *left,		\
+    CRITBIT_HEAD(name) *right, struct critbit_node *node);		\
+attr void name##_critbit_destroy(CRITBIT_HEAD(name) *head,		\
+    void (*efree)(void *, struct type *), void *arg);			\
+attr struct type *name##_critbit_first(CRITBIT_HEAD(name) *head,	\
+    struct critbit_cursor *cursor);					\
+attr struct type *name##_critbit_last(CRITBIT_HEAD(name) *head,	\
+    struct critbit_cursor *cursor);					\
+attr struct type *name##_critbit_next(struct critbit_cursor *cursor);	\
+attr struct type *name##_critbit_prev(struct critbit_cursor *cursor);	\
+attr size_t name##_critbit_rank(CRITBIT_HEAD(name) *head,		\
+    CRITBIT_KEYTYPE_##keytype key);					\
+attr struct type *name##_critbit_select(CRITBIT_HEAD(name) *head,	\
+    struct critbit_cursor *cursor, size_t i);				\
+attr size_t name##_critbit_count_range(CRITBIT_HEAD(name) *head,	\
+    CRITBIT_KEYTYPE_##keytype lo, CRITBIT_KEYTYPE_##keytype hi);	\
+attr struct type *name##_critbit_seek(CRITBIT_HEAD(name) *head,	\
+    struct critbit_cursor *cursor, CRITBIT_KEYTYPE_##keytype key,	\
+    int how);								\
+attr struct type *name##_critbit_lower_bound(CRITBIT_HEAD(name) *head,	\
+    CRITBIT_KEYTYPE_##keytype key);					\
+attr struct type *name##_critbit_upper_bound(CRITBIT_HEAD(name) *head,	\
+    CRITBIT_KEYTYPE_##keytype key);					\
+attr struct type *name##_critbit_predecessor(CRITBIT_HEAD(name) *head,	\
+    CRITBIT_KEYTYPE_##keytype key);					\
+attr struct type *name##_critbit_successor(CRITBIT_HEAD(name) *head,	\
+    CRITBIT_KEYTYPE_##keytype key);					\
+attr int name##_critbit_range(CRITBIT_HEAD(name) *head,		\
+    CRITBIT_KEYTYPE_##keytype lo, CRITBIT_KEYTYPE_##keytype hi,	\
+    int (*visit)(void *, struct type *), void *arg);			\
+attr int name##_critbit_prefix(CRITBIT_HEAD(name) *head,		\
+    CRITBIT_KEYTYPE_##keytype prefix, size_t len,			\
+    int (*visit)(void *, struct type *), void *arg);			\
+attr size_t name##_critbit_prefix_count(CRITBIT_HEAD(name) *head,	\
+    CRITBIT_KEYTYPE_##keytype prefix, size_t len);			\
+attr int name##_critbit_intersect_foreach(CRITBIT_HEAD(name) *a,	\
+    CRITBIT_HEAD(name) *b, int (*visit)(void *, struct type *),	\
+    void *arg);								\
+attr int name##_critbit_diff_foreach(CRITBIT_HEAD(name) *a,		\
+    CRITBIT_HEAD(name) *b, int (*visit)(void *, struct type *),	\
+    void *arg);								\
+attr int name##_critbit_diff(CRITBIT_HEAD(name) *a,			\
+    CRITBIT_HEAD(name) *b,						\
+    int (*visit)(void *, struct type *, struct type *), void *arg);	\
+attr int name##_critbit_snapshot(CRITBIT_HEAD(name) *head, int fd);	\
+attr int name##_critbit_restore(CRITBIT_HEAD(name) *head,		\
+    struct critbit_node_pool *pool, int fd, struct type **elems,	\
+    int (*reloc)(void *, struct type *), void *arg);
 
 #define CRITBIT_GENERATE_INTERNAL(name, type, keytype, field, attr)	\
+struct name##_critbit_visitor {						\
+	int (*visit)(void *, struct type *);				\
+	void *arg;							\
+};									\
+									\
+CRITBIT_UNUSED static int						\
+name##_critbit_visit(void *arg, void *key)				\
+{									\
+	struct name##_critbit_visitor *v = arg;				\
+	return (v->visit(v->arg, CRITBIT_CAST(type, field, key)));	\
+}									\
+									\
+struct name##_critbit_differ {						\
+	int (*visit)(void *, struct type *, struct type *);		\
+	void *arg;							\
+};									\
+									\
+CRITBIT_UNUSED static int						\
+name##_critbit_diff_visit(void *arg, void *a, void *b)			\
+{									\
+	struct name##_critbit_differ *v = arg;				\
+	return (v->visit(v->arg, CRITBIT_CAST(type, field, a),		\
+	    CRITBIT_CAST(type, field, b)));				\
+}									\
+									\
+struct name##_critbit_relocator {					\
+	int (*reloc)(void *, struct type *);				\
+	void *arg;							\
+};									\
+									\
+CRITBIT_UNUSED static int						\
+name##_critbit_relocate(void *arg, void *elem)				\
+{									\
+	struct name##_critbit_relocator *r = arg;			\
+	return (r->reloc(r->arg, elem));				\
+}									\
+									\
+struct name##_critbit_merger {						\
+	struct type *(*conflict)(void *, struct type *, struct type *);	\
+	void *arg;							\
+};									\
+									\
+CRITBIT_UNUSED static void *						\
+name##_critbit_merge_conflict(void *arg, void *a, void *b)		\
+{									\
+	struct name##_critbit_merger *m = arg;				\
+	struct type *r;							\
+	r = m->conflict(m->arg, CRITBIT_CAST(type, field, a),		\
+	    CRITBIT_CAST(type, field, b));				\
+	return (&r->field);						\
+}									\
+									\
+struct name##_critbit_freer {						\
+	void (*efree)(void *, struct type *);				\
+	void *arg;							\
+};									\
+									\
+CRITBIT_UNUSED static void						\
+name##_critbit_free(void *arg, void *key)				\
+{									\
+	struct name##_critbit_freer *f = arg;				\
+	f->efree(f->arg, CRITBIT_CAST(type, field, key));		\
+}									\
+									\
 attr size_t								\
 name##_critbit_keylen(void)						\
 {									\
-	/* ignored by critbit_str_* */					\
+	/* ignored by critbit_str_* and critbit_lstr_* */		\
 	return (sizeof(CRITBIT_KEYTYPE_##keytype));			\
 }									\
 									\
@@ -115,6 +878,25 @@ name##_critbit_get(CRITBIT_HEAD(name) *head,				\
 	return (CRITBIT_CAST(type, field, r));				\
 }									\
 									\
+attr void name##_critbit_get_batch(CRITBIT_HEAD(name) *head,		\
+    const CRITBIT_KEYTYPE_##keytype *keys, size_t n,			\
+    struct type **out)							\
+{									\
+	const void *k[CRITBIT_BATCH];					\
+	void *r[CRITBIT_BATCH];						\
+	size_t i, j, m;							\
+									\
+	for (i = 0; i < n; i += m) {					\
+		m = n - i < CRITBIT_BATCH ? n - i : CRITBIT_BATCH;	\
+		for (j = 0; j < m; ++j)					\
+			k[j] = CRITBIT_KEYREF_##keytype(keys[i + j]);	\
+		CRITBIT_METHOD(keytype,get_batch)(&head->treehead,	\
+		    (void *)k, m, r);					\
+		for (j = 0; j < m; ++j)					\
+			out[i + j] = CRITBIT_CAST(type, field, r[j]);	\
+	}								\
+}									\
+									\
 attr struct type *name##_critbit_insert(CRITBIT_HEAD(name) *head,	\
     struct critbit_node *newnode, struct type *entry)			\
 {									\
@@ -123,12 +905,306 @@ attr struct type *name##_critbit_insert(CRITBIT_HEAD(name) *head,	\
 	return (CRITBIT_CAST(type, field, r));				\
 }									\
 									\
+attr struct type *name##_critbit_replace(CRITBIT_HEAD(name) *head,	\
+    struct critbit_node *newnode, struct type *entry)			\
+{									\
+	void *r = CRITBIT_METHOD(keytype,replace)(&head->treehead,	\
+	    newnode, &(entry->field));					\
+	return (CRITBIT_CAST(type, field, r));				\
+}									\
+									\
+attr struct type *name##_critbit_find_or_prepare(			\
+    CRITBIT_HEAD(name) *head, CRITBIT_KEYTYPE_##keytype key,		\
+    struct critbit_slot *slot)						\
+{									\
+	void *r = CRITBIT_METHOD(keytype,find_or_prepare)(		\
+	    &head->treehead, CRITBIT_KEYREF_##keytype(key), slot);	\
+	return (CRITBIT_CAST(type, field, r));				\
+}									\
+									\
+attr void name##_critbit_commit(struct critbit_slot *slot,		\
+    struct critbit_node *newnode, struct type *entry)			\
+{									\
+	CRITBIT_METHOD(keytype,commit)(slot, newnode, &(entry->field));	\
+}									\
+									\
+attr struct type *name##_critbit_insert_finger(			\
+    CRITBIT_HEAD(name) *head, struct critbit_cursor *finger,		\
+    struct critbit_node *newnode, struct type *entry)			\
+{									\
+	void *r = CRITBIT_METHOD(keytype,insert_finger)(		\
+	    &head->treehead, finger, newnode, &(entry->field));		\
+	return (CRITBIT_CAST(type, field, r));				\
+}									\
+									\
 attr struct type *name##_critbit_remove(CRITBIT_HEAD(name) *head,	\
     CRITBIT_KEYTYPE_##keytype key)					\
 {									\
 	void *r = CRITBIT_METHOD(keytype,remove)(&head->treehead,	\
 	    CRITBIT_KEYREF_##keytype(key));				\
 	return (CRITBIT_CAST(type, field, r));				\
+}									\
+									\
+attr int name##_critbit_bulk_load(CRITBIT_HEAD(name) *head,		\
+    struct type *const *elems, size_t n, struct critbit_node **nodes)	\
+{									\
+	return (CRITBIT_METHOD(keytype,bulk_load)(&head->treehead,	\
+	    (void *const *)elems, n, offsetof(struct type, field),	\
+	    nodes));							\
+}									\
+									\
+attr void name##_critbit_merge(CRITBIT_HEAD(name) *dst,		\
+    CRITBIT_HEAD(name) *src, struct critbit_node *spare,		\
+    struct type *(*conflict)(void *, struct type *, struct type *),	\
+    void *arg)								\
+{									\
+	struct name##_critbit_merger m = { conflict, arg };		\
+	CRITBIT_METHOD(keytype,merge)(&dst->treehead, &src->treehead,	\
+	    spare, name##_critbit_merge_conflict, &m);			\
+}									\
+									\
+attr void name##_critbit_split(CRITBIT_HEAD(name) *head,		\
+    CRITBIT_KEYTYPE_##keytype key, CRITBIT_HEAD(name) *left,		\
+    CRITBIT_HEAD(name) *right)						\
+{									\
+	CRITBIT_METHOD(keytype,split)(&head->treehead,			\
+	    CRITBIT_KEYREF_##keytype(key), &left->treehead,		\
+	    &right->treehead);						\
+}									\
+									\
+attr int name##_critbit_join(CRITBIT_HEAD(name) *left,		\
+    CRITBIT_HEAD(name) *right, struct critbit_node *node)		\
+{									\
+	return (CRITBIT_METHOD(keytype,join)(&left->treehead,		\
+	    &right->treehead, node));					\
+}									\
+									\
+attr void name##_critbit_destroy(CRITBIT_HEAD(name) *head,		\
+    void (*efree)(void *, struct type *), void *arg)			\
+{									\
+	struct name##_critbit_freer f = { efree, arg };			\
+	critbit_destroy(&head->treehead,				\
+	    efree == NULL ? NULL : name##_critbit_free, &f);		\
+}									\
+									\
+attr struct type *name##_critbit_first(CRITBIT_HEAD(name) *head,	\
+    struct critbit_cursor *cursor)					\
+{									\
+	void *r = critbit_first(&head->treehead, cursor);		\
+	return (CRITBIT_CAST(type, field, r));				\
+}									\
+									\
+attr struct type *name##_critbit_last(CRITBIT_HEAD(name) *head,	\
+    struct critbit_cursor *cursor)					\
+{									\
+	void *r = critbit_last(&head->treehead, cursor);		\
+	return (CRITBIT_CAST(type, field, r));				\
+}									\
+									\
+attr struct type *name##_critbit_next(struct critbit_cursor *cursor)	\
+{									\
+	void *r = CRITBIT_METHOD(keytype,next)(cursor);			\
+	return (CRITBIT_CAST(type, field, r));				\
+}									\
+									\
+attr struct type *name##_critbit_prev(struct critbit_cursor *cursor)	\
+{									\
+	void *r = CRITBIT_METHOD(keytype,prev)(cursor);			\
+	return (CRITBIT_CAST(type, field, r));				\
+}									\
+									\
+attr size_t name##_critbit_rank(CRITBIT_HEAD(name) *head,		\
+    CRITBIT_KEYTYPE_##keytype key)					\
+{									\
+	return (CRITBIT_METHOD(keytype,rank)(&head->treehead,		\
+	    CRITBIT_KEYREF_##keytype(key)));				\
+}									\
+									\
+attr struct type *name##_critbit_select(CRITBIT_HEAD(name) *head,	\
+    struct critbit_cursor *cursor, size_t i)				\
+{									\
+	void *r = critbit_select(&head->treehead, cursor, i);		\
+	return (CRITBIT_CAST(type, field, r));				\
+}									\
+									\
+attr size_t name##_critbit_count_range(CRITBIT_HEAD(name) *head,	\
+    CRITBIT_KEYTYPE_##keytype lo, CRITBIT_KEYTYPE_##keytype hi)	\
+{									\
+	return (CRITBIT_METHOD(keytype,count_range)(&head->treehead,	\
+	    CRITBIT_KEYREF_##keytype(lo),				\
+	    CRITBIT_KEYREF_##keytype(hi)));				\
+}									\
+									\
+attr struct type *name##_critbit_seek(CRITBIT_HEAD(name) *head,	\
+    struct critbit_cursor *cursor, CRITBIT_KEYTYPE_##keytype key,	\
+    int how)								\
+{									\
+	void *r = CRITBIT_METHOD(keytype,seek)(&head->treehead, cursor,	\
+	    CRITBIT_KEYREF_##keytype(key), how);			\
+	return (CRITBIT_CAST(type, field, r));				\
+}									\
+									\
+attr struct type *name##_critbit_lower_bound(CRITBIT_HEAD(name) *head,	\
+    CRITBIT_KEYTYPE_##keytype key)					\
+{									\
+	return (name##_critbit_seek(head, NULL, key, CRITBIT_SEEK_GE));	\
+}									\
+									\
+attr struct type *name##_critbit_upper_bound(CRITBIT_HEAD(name) *head,	\
+    CRITBIT_KEYTYPE_##keytype key)					\
+{									\
+	return (name##_critbit_seek(head, NULL, key, CRITBIT_SEEK_GT));	\
+}									\
+									\
+attr struct type *name##_critbit_predecessor(CRITBIT_HEAD(name) *head,	\
+    CRITBIT_KEYTYPE_##keytype key)					\
+{									\
+	return (name##_critbit_seek(head, NULL, key, CRITBIT_SEEK_LT));	\
+}									\
+									\
+attr struct type *name##_critbit_successor(CRITBIT_HEAD(name) *head,	\
+    CRITBIT_KEYTYPE_##keytype key)					\
+{									\
+	return (name##_critbit_seek(head, NULL, key, CRITBIT_SEEK_GT));	\
+}									\
+									\
+attr int name##_critbit_range(CRITBIT_HEAD(name) *head,		\
+    CRITBIT_KEYTYPE_##keytype lo, CRITBIT_KEYTYPE_##keytype hi,	\
+    int (*visit)(void *, struct type *), void *arg)			\
+{									\
+	struct name##_critbit_visitor v = { visit, arg };		\
+	return (CRITBIT_METHOD(keytype,range)(&head->treehead,		\
+	    CRITBIT_KEYREF_##keytype(lo), CRITBIT_KEYREF_##keytype(hi),	\
+	    name##_critbit_visit, &v));					\
+}									\
+									\
+attr int name##_critbit_prefix(CRITBIT_HEAD(name) *head,		\
+    CRITBIT_KEYTYPE_##keytype prefix, size_t len,			\
+    int (*visit)(void *, struct type *), void *arg)			\
+{									\
+	struct name##_critbit_visitor v = { visit, arg };		\
+	return (CRITBIT_METHOD(keytype,prefix)(&head->treehead,		\
+	    CRITBIT_KEYREF_##keytype(prefix), len,			\
+	    name##_critbit_visit, &v));					\
+}									\
+									\
+attr size_t name##_critbit_prefix_count(CRITBIT_HEAD(name) *head,	\
+    CRITBIT_KEYTYPE_##keytype prefix, size_t len)			\
+{									\
+	return (CRITBIT_METHOD(keytype,prefix_count)(&head->treehead,	\
+	    CRITBIT_KEYREF_##keytype(prefix), len));			\
+}									\
+									\
+attr int name##_critbit_intersect_foreach(CRITBIT_HEAD(name) *a,	\
+    CRITBIT_HEAD(name) *b, int (*visit)(void *, struct type *),	\
+    void *arg)								\
+{									\
+	struct name##_critbit_visitor v = { visit, arg };		\
+	return (CRITBIT_METHOD(keytype,intersect_foreach)(&a->treehead,	\
+	    &b->treehead, name##_critbit_visit, &v));			\
+}									\
+									\
+attr int name##_critbit_diff_foreach(CRITBIT_HEAD(name) *a,		\
+    CRITBIT_HEAD(name) *b, int (*visit)(void *, struct type *),	\
+    void *arg)								\
+{									\
+	struct name##_critbit_visitor v = { visit, arg };		\
+	return (CRITBIT_METHOD(keytype,diff_foreach)(&a->treehead,	\
+	    &b->treehead, name##_critbit_visit, &v));			\
+}									\
+									\
+attr int name##_critbit_diff(CRITBIT_HEAD(name) *a,			\
+    CRITBIT_HEAD(name) *b,						\
+    int (*visit)(void *, struct type *, struct type *), void *arg)	\
+{									\
+	struct name##_critbit_differ v = { visit, arg };		\
+	return (CRITBIT_METHOD(keytype,diff)(&a->treehead,		\
+	    &b->treehead, name##_critbit_diff_visit, &v));		\
+}									\
+									\
+attr int name##_critbit_snapshot(CRITBIT_HEAD(name) *head, int fd)	\
+{									\
+	return (critbit_snapshot(&head->treehead, fd, sizeof(struct type), \
+	    offsetof(struct type, field)));				\
+}									\
+									\
+attr int name##_critbit_restore(CRITBIT_HEAD(name) *head,		\
+    struct critbit_node_pool *pool, int fd, struct type **elems,	\
+    int (*reloc)(void *, struct type *), void *arg)			\
+{									\
+	struct name##_critbit_relocator r = { reloc, arg };		\
+	void *e;							\
+	int rv;								\
+									\
+	rv = critbit_restore(&head->treehead, pool, fd,		\
+	    sizeof(struct type), offsetof(struct type, field),		\
+	    CRITBIT_FIXED_##keytype, &e,				\
+	    reloc == NULL ? NULL : name##_critbit_relocate, &r);	\
+	*elems = e;							\
+	return (rv);							\
+}
+
+/* intrusive trees, nodes are taken from the entry field of elements */
+#define CRITBIT_PROTOTYPE_ENTRY_INLINE(name, type, keytype)		\
+CRITBIT_PROTOTYPE_ENTRY_INTERNAL(name, type, keytype,			\
+    CRITBIT_UNUSED static __inline)
+
+#define CRITBIT_GENERATE_ENTRY_INLINE(name, type, keytype, field, entry) \
+CRITBIT_GENERATE_ENTRY_INTERNAL(name, type, keytype, field, entry,	\
+    CRITBIT_UNUSED static __inline)
+
+#define CRITBIT_PROTOTYPE_ENTRY_STATIC(name, type, keytype)		\
+CRITBIT_PROTOTYPE_ENTRY_INTERNAL(name, type, keytype,			\
+    CRITBIT_UNUSED static)
+
+#define CRITBIT_GENERATE_ENTRY_STATIC(name, type, keytype, field, entry) \
+CRITBIT_GENERATE_ENTRY_INTERNAL(name, type, keytype, field, entry,	\
+    CRITBIT_UNUSED static)
+
+#define CRITBIT_PROTOTYPE_ENTRY_INTERNAL(name, type, keytype, attr)	\
+CRITBIT_PROTOTYPE_INTERNAL(name, type, keytype, attr)			\
+attr struct type *name##_critbit_insert_entry(CRITBIT_HEAD(name) *head,	\
+    struct type *elm);							\
+attr struct type *name##_critbit_remove_entry(CRITBIT_HEAD(name) *head,	\
+    CRITBIT_KEYTYPE_##keytype key);					\
+attr struct type *name##_critbit_replace_entry(			\
+    CRITBIT_HEAD(name) *head, struct type *elm);			\
+attr ptrdiff_t name##_critbit_entryoff(void)
+
+#define CRITBIT_GENERATE_ENTRY_INTERNAL(name, type, keytype, field, entry, \
+    attr)								\
+CRITBIT_GENERATE_INTERNAL(name, type, keytype, field, attr)		\
+									\
+attr ptrdiff_t								\
+name##_critbit_entryoff(void)						\
+{									\
+	return ((ptrdiff_t)offsetof(struct type, entry) -		\
+	    (ptrdiff_t)offsetof(struct type, field));			\
+}									\
+									\
+attr struct type *name##_critbit_insert_entry(CRITBIT_HEAD(name) *head,	\
+    struct type *elm)							\
+{									\
+	void *r = CRITBIT_METHOD(keytype,insert)(&head->treehead,	\
+	    (struct critbit_node *)(void *)&(elm->entry), &(elm->field)); \
+	return (CRITBIT_CAST(type, field, r));				\
+}									\
+									\
+attr struct type *name##_critbit_remove_entry(CRITBIT_HEAD(name) *head,	\
+    CRITBIT_KEYTYPE_##keytype key)					\
+{									\
+	void *r = CRITBIT_METHOD(keytype,remove_entry)(&head->treehead,	\
+	    CRITBIT_KEYREF_##keytype(key),				\
+	    name##_critbit_entryoff());					\
+	return (CRITBIT_CAST(type, field, r));				\
+}									\
+									\
+attr struct type *name##_critbit_replace_entry(			\
+    CRITBIT_HEAD(name) *head, struct type *elm)			\
+{									\
+	void *r = CRITBIT_METHOD(keytype,replace)(&head->treehead,	\
+	    (struct critbit_node *)(void *)&(elm->entry), &(elm->field)); \
+	return (CRITBIT_CAST(type, field, r));				\
 }
 
 #define CRITBIT_METHOD(keytype, method)					\
@@ -141,13 +1217,22 @@ __XCONCAT(__XCONCAT(critbit_,keytype),_##method)
 #define CRITBIT_INIT(name, head, nfree, freearg)			\
 critbit_init(&((head)->treehead), (nfree), (freearg), name##_critbit_keylen())
 
-#define critbit_int32			critbit_buf
-#define critbit_int64			critbit_buf
-#define critbit_intptr			critbit_buf
-#define critbit_ptr			critbit_buf
+#define CRITBIT_INIT_FLAGS(name, head, nfree, freearg, flags)		\
+critbit_init_flags(&((head)->treehead), (nfree), (freearg),		\
+    name##_critbit_keylen(), (flags))
+
+#define CRITBIT_NODE_SIZE(head)						\
+critbit_tree_node_size(&((head)->treehead))
+
+/* integer keys are ordered numerically as signed values */
+#define critbit_int32			critbit_int
+#define critbit_int64			critbit_int
+#define critbit_intptr			critbit_int
+#define critbit_ptr			critbit_int
 
 #define CRITBIT_KEYREF_buf(a)		(a)
 #define CRITBIT_KEYREF_str(a)		(a)
+#define CRITBIT_KEYREF_lstr(a)		(a)
 #define CRITBIT_KEYREF_scalar(a)	(&(a))
 #define CRITBIT_KEYREF_int32(a)		CRITBIT_KEYREF_scalar(a)
 #define CRITBIT_KEYREF_int64(a)		CRITBIT_KEYREF_scalar(a)
@@ -156,20 +1241,127 @@ critbit_init(&((head)->treehead), (nfree), (freearg), name##_critbit_keylen())
 
 #define CRITBIT_KEYTYPE_buf		const void *
 #define CRITBIT_KEYTYPE_str		const char *
+#define CRITBIT_KEYTYPE_lstr		const struct critbit_lstr *
 #define CRITBIT_KEYTYPE_int32		int32_t
 #define CRITBIT_KEYTYPE_int64		int64_t
 #define CRITBIT_KEYTYPE_intptr		intptr_t
 #define CRITBIT_KEYTYPE_ptr		const void *
 
+#define CRITBIT_FIXED_buf		1
+#define CRITBIT_FIXED_str		0
+#define CRITBIT_FIXED_lstr		0
+#define CRITBIT_FIXED_int32		1
+#define CRITBIT_FIXED_int64		1
+#define CRITBIT_FIXED_intptr		1
+#define CRITBIT_FIXED_ptr		1
+
 #define CRITBIT_GET(name, tree, key)					\
 name##_critbit_get((tree), (key))
 
+#define CRITBIT_GET_BATCH(name, tree, keys, n, out)			\
+name##_critbit_get_batch((tree), (keys), (n), (out))
+
 #define CRITBIT_INSERT(name, tree, newnode, key)			\
 name##_critbit_insert((tree), (newnode), (key))
 
+#define CRITBIT_REPLACE(name, tree, newnode, key)			\
+name##_critbit_replace((tree), (newnode), (key))
+
+#define CRITBIT_FIND_OR_PREPARE(name, tree, key, slot)			\
+name##_critbit_find_or_prepare((tree), (key), (slot))
+
+#define CRITBIT_COMMIT(name, slot, newnode, key)			\
+name##_critbit_commit((slot), (newnode), (key))
+
+#define CRITBIT_INSERT_FINGER(name, tree, finger, newnode, key)		\
+name##_critbit_insert_finger((tree), (finger), (newnode), (key))
+
 #define CRITBIT_REMOVE(name, tree, key)					\
 name##_critbit_remove((tree), (key))
 
+#define CRITBIT_INIT_ENTRY(name, head, flags)				\
+critbit_init_entry(&((head)->treehead), name##_critbit_keylen(),	\
+    (flags), name##_critbit_entryoff())
+
+#define CRITBIT_INSERT_ENTRY(name, tree, elm)				\
+name##_critbit_insert_entry((tree), (elm))
+
+#define CRITBIT_REMOVE_ENTRY(name, tree, key)				\
+name##_critbit_remove_entry((tree), (key))
+
+#define CRITBIT_REPLACE_ENTRY(name, tree, elm)				\
+name##_critbit_replace_entry((tree), (elm))
+
+#define CRITBIT_BULK_LOAD(name, tree, elems, n, nodes)			\
+name##_critbit_bulk_load((tree), (elems), (n), (nodes))
+
+#define CRITBIT_MERGE(name, dst, src, spare, conflict, arg)		\
+name##_critbit_merge((dst), (src), (spare), (conflict), (arg))
+
+#define CRITBIT_SPLIT(name, tree, key, left, right)			\
+name##_critbit_split((tree), (key), (left), (right))
+
+#define CRITBIT_JOIN(name, left, right, node)				\
+name##_critbit_join((left), (right), (node))
+
+#define CRITBIT_DESTROY(name, tree, efree, arg)				\
+name##_critbit_destroy((tree), (efree), (arg))
+
+#define CRITBIT_FIRST(name, tree, cursor)				\
+name##_critbit_first((tree), (cursor))
+
+#define CRITBIT_LAST(name, tree, cursor)				\
+name##_critbit_last((tree), (cursor))
+
+#define CRITBIT_NEXT(name, cursor)					\
+name##_critbit_next((cursor))
+
+#define CRITBIT_PREV(name, cursor)					\
+name##_critbit_prev((cursor))
+
+#define CRITBIT_RANK(name, tree, key)					\
+name##_critbit_rank((tree), (key))
+
+#define CRITBIT_SELECT(name, tree, cursor, i)				\
+name##_critbit_select((tree), (cursor), (i))
+
+#define CRITBIT_SEEK(name, tree, cursor, key, how)			\
+name##_critbit_seek((tree), (cursor), (key), (how))
+
+#define CRITBIT_RANGE(name, tree, lo, hi, visit, arg)			\
+name##_critbit_range((tree), (lo), (hi), (visit), (arg))
+
+#define CRITBIT_PREFIX(name, tree, prefix, len, visit, arg)		\
+name##_critbit_prefix((tree), (prefix), (len), (visit), (arg))
+
+#define CRITBIT_PREFIX_COUNT(name, tree, prefix, len)			\
+name##_critbit_prefix_count((tree), (prefix), (len))
+
+#define CRITBIT_INTERSECT_FOREACH(name, a, b, visit, arg)		\
+name##_critbit_intersect_foreach((a), (b), (visit), (arg))
+
+#define CRITBIT_DIFF_FOREACH(name, a, b, visit, arg)			\
+name##_critbit_diff_foreach((a), (b), (visit), (arg))
+
+#define CRITBIT_DIFF(name, a, b, visit, arg)				\
+name##_critbit_diff((a), (b), (visit), (arg))
+
+#define CRITBIT_SNAPSHOT(name, tree, fd)				\
+name##_critbit_snapshot((tree), (fd))
+
+#define CRITBIT_RESTORE(name, tree, pool, fd, elems, reloc, arg)	\
+name##_critbit_restore((tree), (pool), (fd), (elems), (reloc), (arg))
+
+#define CRITBIT_FOREACH(x, name, tree, cursor)				\
+for ((x) = CRITBIT_FIRST(name, tree, cursor);				\
+    (x) != NULL;							\
+    (x) = CRITBIT_NEXT(name, cursor))
+
+#define CRITBIT_FOREACH_REVERSE(x, name, tree, cursor)			\
+for ((x) = CRITBIT_LAST(name, tree, cursor);				\
+    (x) != NULL;							\
+    (x) = CRITBIT_PREV(name, cursor))
+
 #ifdef __cplusplus
 }
 #endif